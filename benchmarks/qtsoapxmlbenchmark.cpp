@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2013, 2014 Jesús Pérez (a) Chuso <kde at chuso dot net>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Library General Public License as published
+ * by the Free Software Foundation; either version 2 of the License or
+ * ( at your option ) version 3 or, at the discretion of KDE e.V.
+ * ( which shall act as a proxy as in section 14 of the GPLv3 ), any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "qtsoap/qtsoapxml.h"
+#include <QtTest>
+#include <QDomDocument>
+#include <qtest_kde.h>
+
+/*!
+ * \class QtSoapXmlBenchmark
+ * \brief The QtSoapXmlBenchmark class compares the SOAP response tokenizer with QDom.
+ *
+ * The input is a <code>get_entry_list</code> response of a thousand
+ * contacts, with a few escaped characters in every entry like real ones.
+ */
+class QtSoapXmlBenchmark : public QObject
+{
+  Q_OBJECT
+  private Q_SLOTS:
+    void initTestCase();
+    void domSetContent();
+    void xmlReader();
+    void byteSearch();
+    void scannerSearch();
+
+  private:
+    QByteArray response;
+    int delimiters;
+};
+
+/*!
+ * Builds the response and checks that the tokenizer accepts it, so its
+ * timings are not those of the QDom fallback.
+ */
+void QtSoapXmlBenchmark::initTestCase()
+{
+  const int entries = 1000;
+  const int fields = 20;
+  response = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+             "<SOAP-ENV:Envelope xmlns:SOAP-ENV=\"http://schemas.xmlsoap.org/soap/envelope/\""
+             " xmlns:xsd=\"http://www.w3.org/2001/XMLSchema\" xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\""
+             " xmlns:SOAP-ENC=\"http://schemas.xmlsoap.org/soap/encoding/\" xmlns:tns=\"http://www.sugarcrm.com/sugarcrm\">"
+             "<SOAP-ENV:Body><ns1:get_entry_listResponse xmlns:ns1=\"http://www.sugarcrm.com/sugarcrm\">"
+             "<return xsi:type=\"tns:get_entry_list_result\">";
+  response += "<result_count xsi:type=\"xsd:int\">" + QByteArray::number(entries) + "</result_count>";
+  response += "<next_offset xsi:type=\"xsd:int\">" + QByteArray::number(entries) + "</next_offset>";
+  response += "<entry_list xsi:type=\"SOAP-ENC:Array\" SOAP-ENC:arrayType=\"tns:entry_value[" + QByteArray::number(entries) + "]\">";
+  for (int i=0; i<entries; i++)
+  {
+    QByteArray id = QByteArray::number(i, 16).rightJustified(8, '0') + "-1234-5678-9abc-def012345678";
+    response += "<item xsi:type=\"tns:entry_value\"><id xsi:type=\"xsd:string\">" + id + "</id>"
+                "<module_name xsi:type=\"xsd:string\">Contacts</module_name>"
+                "<name_value_list xsi:type=\"SOAP-ENC:Array\" SOAP-ENC:arrayType=\"tns:name_value[" + QByteArray::number(fields) + "]\">";
+    for (int j=0; j<fields; j++)
+    {
+      QByteArray value = (j % 5 == 0)? "Jes\xc3\xbas P\xc3\xa9rez &amp; Co &lt;sales&gt;" : "value " + QByteArray::number(i * fields + j);
+      response += "<item xsi:type=\"tns:name_value\"><name xsi:type=\"xsd:string\">field_" + QByteArray::number(j) + "</name>"
+                  "<value xsi:type=\"xsd:string\">" + value + "</value></item>";
+    }
+    response += "</name_value_list></item>";
+  }
+  response += "</entry_list></return></ns1:get_entry_listResponse></SOAP-ENV:Body></SOAP-ENV:Envelope>";
+
+  QDomDocument doc;
+  QVERIFY(QtSoapXmlReader::read(response, &doc));
+  qDebug("%d bytes, scanner: %s", response.size(), QtSoapXmlScanner::implementation());
+
+  delimiters = 0;
+  for (const char *p = response.constData(); p < response.constData() + response.size(); p++)
+    if ((*p == '<') || (*p == '&') || (*p == '\r'))
+      delimiters++;
+}
+
+/*!
+ * Parses the response with QDomDocument::setContent(), as before the tokenizer.
+ */
+void QtSoapXmlBenchmark::domSetContent()
+{
+  QBENCHMARK
+  {
+    QDomDocument doc;
+    doc.setContent(response, true);
+  }
+}
+
+/*!
+ * Parses the response with QtSoapXmlReader, as QtSoapMessage::setContent() does.
+ */
+void QtSoapXmlBenchmark::xmlReader()
+{
+  QBENCHMARK
+  {
+    QDomDocument doc;
+    QtSoapXmlReader::read(response, &doc);
+  }
+}
+
+/*!
+ * Finds every markup delimiter of the response one byte at a time.
+ */
+void QtSoapXmlBenchmark::byteSearch()
+{
+  const char *end = response.constData() + response.size();
+  int found = 0;
+  QBENCHMARK
+  {
+    found = 0;
+    for (const char *p = response.constData(); p < end; p++)
+      if ((*p == '<') || (*p == '&') || (*p == '\r'))
+        found++;
+  }
+  QCOMPARE(found, delimiters);
+}
+
+/*!
+ * Finds every markup delimiter of the response with QtSoapXmlScanner.
+ */
+void QtSoapXmlBenchmark::scannerSearch()
+{
+  const char *end = response.constData() + response.size();
+  int found = 0;
+  QBENCHMARK
+  {
+    found = 0;
+    for (const char *p = QtSoapXmlScanner::findFirstOf(response.constData(), end, '<', '&', '\r'); p < end;
+         p = QtSoapXmlScanner::findFirstOf(p + 1, end, '<', '&', '\r'))
+      found++;
+  }
+  QCOMPARE(found, delimiters);
+}
+
+QTEST_KDEMAIN_CORE(QtSoapXmlBenchmark)
+
+#include "qtsoapxmlbenchmark.moc"
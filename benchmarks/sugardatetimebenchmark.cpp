@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2013, 2014 Jesús Pérez (a) Chuso <kde at chuso dot net>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Library General Public License as published
+ * by the Free Software Foundation; either version 2 of the License or
+ * ( at your option ) version 3 or, at the discretion of KDE e.V.
+ * ( which shall act as a proxy as in section 14 of the GPLv3 ), any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "sugardatetime.h"
+#include <QtTest>
+#include <QStringList>
+#include <qtest_kde.h>
+
+/*!
+ * \class SugarDateTimeBenchmark
+ * \brief The SugarDateTimeBenchmark class compares SugarDateTime with the Qt and KDE parsers it replaced.
+ *
+ * The input is a block of timestamps as SugarCRM sends them, as many as
+ * a page of entries has. The Qt and KDE parsers are given the same
+ * timestamps in strict ISO 8601, which is the only form they parse.
+ */
+class SugarDateTimeBenchmark : public QObject
+{
+  Q_OBJECT
+  private Q_SLOTS:
+    void initTestCase();
+    void kDateTimeFromString();
+    void sugarToKDateTime();
+    void qDateTimeFromString();
+    void sugarToQDateTime();
+
+  private:
+    QStringList timestamps;
+    QStringList isoTimestamps;
+};
+
+/*!
+ * Builds the timestamps and checks that every parser reads them, and
+ * that SugarDateTime reads them as KDateTime::fromString() does.
+ */
+void SugarDateTimeBenchmark::initTestCase()
+{
+  QDateTime base(QDate(2014, 3, 1), QTime(8, 30, 0), Qt::UTC);
+  for (int i=0; i<5000; i++)
+  {
+    QDateTime time = base.addSecs(i * 3907);
+    timestamps << time.toString("yyyy-MM-dd hh:mm:ss");
+    isoTimestamps << time.toString("yyyy-MM-ddThh:mm:ssZ");
+  }
+
+  for (int i=0; i<timestamps.count(); i++)
+  {
+    KDateTime expected = KDateTime::fromString(isoTimestamps.at(i), KDateTime::ISODate);
+    KDateTime parsed = SugarDateTime::toKDateTime(timestamps.at(i));
+    QVERIFY(expected.isValid());
+    QVERIFY(parsed.isValid());
+    QCOMPARE(parsed.dateTime(), expected.dateTime());
+    QVERIFY(QDateTime::fromString(isoTimestamps.at(i), Qt::ISODate).isValid());
+  }
+}
+
+/*!
+ * Parses the timestamps with KDateTime::fromString(), as before SugarDateTime.
+ */
+void SugarDateTimeBenchmark::kDateTimeFromString()
+{
+  QBENCHMARK
+  {
+    foreach (const QString &timestamp, isoTimestamps)
+      KDateTime::fromString(timestamp, KDateTime::ISODate);
+  }
+}
+
+/*!
+ * Parses the timestamps with SugarDateTime::toKDateTime().
+ */
+void SugarDateTimeBenchmark::sugarToKDateTime()
+{
+  QBENCHMARK
+  {
+    foreach (const QString &timestamp, timestamps)
+      SugarDateTime::toKDateTime(timestamp);
+  }
+}
+
+/*!
+ * Parses the timestamps with QDateTime::fromString(), as before SugarDateTime.
+ */
+void SugarDateTimeBenchmark::qDateTimeFromString()
+{
+  QBENCHMARK
+  {
+    foreach (const QString &timestamp, isoTimestamps)
+      QDateTime::fromString(timestamp, Qt::ISODate);
+  }
+}
+
+/*!
+ * Parses the timestamps with SugarDateTime::toQDateTime().
+ */
+void SugarDateTimeBenchmark::sugarToQDateTime()
+{
+  QBENCHMARK
+  {
+    foreach (const QString &timestamp, timestamps)
+      SugarDateTime::toQDateTime(timestamp);
+  }
+}
+
+QTEST_KDEMAIN_CORE(SugarDateTimeBenchmark)
+
+#include "sugardatetimebenchmark.moc"
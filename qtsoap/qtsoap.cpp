@@ -39,9 +39,13 @@
 ****************************************************************************/
 
 #include "qtsoap.h"
+#include "qtsoapxml.h"
 #include <QSet>
+#include <QBuffer>
+#include <QtConcurrentRun>
 #include <QNetworkRequest>
 #include <QNetworkReply>
+#include <float.h>
 
 /*! \page qtsoap-overview.html
 
@@ -133,6 +137,121 @@ namespace {
 	return tagName;
     }
 
+    // Same as localName(), but returns a reference into \a name
+    // instead of a new string, with surrounding spaces skipped.
+    QStringRef localNameRef(const QString &name)
+    {
+	int from = name.indexOf(':') + 1;
+	int to = name.length();
+	while (from < to && name.at(from).isSpace())
+	    ++from;
+	while (to > from && name.at(to - 1).isSpace())
+	    --to;
+	return name.midRef(from, to - from);
+    }
+
+    // Local name of a parsed element. Documents are parsed with
+    // namespace processing, so QDom already holds it and no new
+    // string needs to be built.
+    QString elementLocalName(const QDomElement &e)
+    {
+	const QString name = e.localName();
+	return name.isNull() ? localName(e.tagName()) : name;
+    }
+
+    const QString &typeAttributeName()
+    {
+	static const QString name(QLatin1String("type"));
+	return name;
+    }
+
+    inline ushort foldCase(ushort c)
+    {
+	return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+    }
+
+    QHash<QtSoapTypeName, QtSoapType::Type> simpleTypeNames()
+    {
+	QHash<QtSoapTypeName, QtSoapType::Type> types;
+	for (int t = QtSoapType::Duration; t < QtSoapType::Array; ++t)
+	    types.insert(QtSoapType::typeToName(QtSoapType::Type(t)).toLower(), QtSoapType::Type(t));
+	return types;
+    }
+
+    QtSoapType::Type typeFromName(const QStringRef &name)
+    {
+	static const QHash<QtSoapTypeName, QtSoapType::Type> types = simpleTypeNames();
+	return types.value(QtSoapTypeName(name), QtSoapType::Other);
+    }
+
+    // Opens the element for \a name, using \a tag as its local name
+    // instead if it is set. Registered namespaces are all declared on
+    // the envelope, so their cached prefix is written as is; the
+    // writer only has to look up and declare unregistered ones.
+    void writeStartElement(QXmlStreamWriter &writer, const QtSoapQName &name, const QString &tag)
+    {
+	const QString &local = tag.isEmpty() ? name.name() : tag;
+	if (name.uri().isEmpty()) {
+	    writer.writeStartElement(local);
+	    return;
+	}
+
+	const QString prefix = name.prefix();
+	if (prefix.isEmpty())
+	    writer.writeStartElement(name.uri(), local);
+	else
+	    writer.writeStartElement(prefix + QLatin1Char(':') + local);
+    }
+}
+
+/*! \class QtSoapTypeName qtsoap.h
+    \internal
+
+    Case-insensitive key for SOAP type names. A key built from a
+    QStringRef only points at the characters, so type attributes can
+    be looked up without lowercasing them into a new string first.
+*/
+
+/*! \internal
+*/
+QtSoapTypeName::QtSoapTypeName(const QString &name)
+    : owner(name), s(owner.unicode()), len(owner.length())
+{
+}
+
+/*! \internal
+*/
+QtSoapTypeName::QtSoapTypeName(const QStringRef &name)
+    : s(name.unicode()), len(name.length())
+{
+}
+
+/*! \internal
+
+    Hashes \a name with ASCII letters folded to lower case.
+*/
+uint qHash(const QtSoapTypeName &name)
+{
+    uint h = 0;
+    const QChar *s = name.unicode();
+    for (int i = 0; i < name.length(); ++i)
+	h = 31 * h + foldCase(s[i].unicode());
+    return h;
+}
+
+/*! \internal
+*/
+bool operator ==(const QtSoapTypeName &n1, const QtSoapTypeName &n2)
+{
+    if (n1.length() != n2.length())
+	return false;
+
+    const QChar *s1 = n1.unicode();
+    const QChar *s2 = n2.unicode();
+    for (int i = 0; i < n1.length(); ++i)
+	if (foldCase(s1[i].unicode()) != foldCase(s2[i].unicode()))
+	    return false;
+    return true;
 }
 
 /*! \class QtSoapQName qtsoap.h
@@ -195,6 +314,21 @@ QString QtSoapQName::uri() const
     return nuri;
 }
 
+/*!
+    Returns the prefix registered in QtSoapNamespaces for the QName's
+    URI, or an empty string if there is none.
+
+    The prefix is looked up in the current snapshot of the registry,
+    which takes no lock and writes nothing, so names shared by copies of
+    a message can be serialized from several threads at once.
+*/
+QString QtSoapQName::prefix() const
+{
+    if (nuri.isEmpty())
+	return QString();
+    return QtSoapNamespaces::instance().prefixFor(nuri);
+}
+
 /*!
     Sets the QName's name to \a s, and sets the URI to an empty string.
 */
@@ -363,6 +497,11 @@ bool operator <(const QtSoapQName &s1, const QtSoapQName &s2)
     Use insert() or append() to insert items into an array manually.
     append() only works with one dimensional arrays.
 
+    Consecutive arrays, which is what most SOAP services return, are
+    kept in a contiguous vector. The array only switches to a sparse,
+    position-keyed representation when an item is inserted beyond the
+    current end or when parse() sees a \c position attribute.
+
     toDomElement() returns a QDomElement representation of the SOAP
     array.
 
@@ -491,7 +630,8 @@ QtSoapType::QtSoapType(const QtSoapQName &name, Type type)
 }
 
 /*!
-    Creates a QtSoapType copy of \a copy.
+    Creates a QtSoapType copy of \a copy. The reference count used by
+    QtSmartPtr is not copied; the new object starts unreferenced.
 */
 QtSoapType::QtSoapType(const QtSoapType &copy)
     : t(copy.t), errorStr(copy.errorStr), i(copy.i),
@@ -515,7 +655,8 @@ void QtSoapType::clear()
 }
 
 /*!
-    Makes this QtSoapType equal to \a copy.
+    Makes this QtSoapType equal to \a copy. The reference count of
+    this object is left untouched.
 */
 QtSoapType &QtSoapType::operator =(const QtSoapType &copy)
 {
@@ -595,92 +736,8 @@ QString QtSoapType::typeToName(QtSoapType::Type t)
 */
 QtSoapType::Type QtSoapType::nameToType(const QString &name)
 {
-    const QString type = name.trimmed().toLower();
-
-    if (type == "string")
-	return String;
-    else if (type == "normalizedstring")
-	return NormalizedString;
-    else if (type == "token")
-	return Token;
-    else if (type == "language")
-	return Language;
-    else if (type == "name")
-	return Name;
-    else if (type == "ncname")
-	return NCName;
-    else if (type == "nmtoken")
-	return NMTOKEN;
-    else if (type == "id")
-	return ID;
-    else if (type == "idref")
-	return IDREF;
-    else if (type == "entity")
-	return ENTITY;
-    else if (type == "base64binary")
-	return Base64Binary;
-    else if (type == "hexBinary")
-	return HexBinary;
-    else if (type == "anyuri")
-	return AnyURI;
-    else if (type == "qname")
-	return QName;
-    else if (type == "notation")
-	return NOTATION;
-    else if (type == "duration")
-	return Duration;
-    else if (type == "datetime")
-	return DateTime;
-    else if (type == "time")
-	return Time;
-    else if (type == "date")
-	return Date;
-    else if (type == "gyearmonth")
-	return GYearMonth;
-    else if (type == "gyear")
-	return GYear;
-    else if (type == "gmonthday")
-	return GMonthDay;
-    else if (type == "gday")
-	return GDay;
-    else if (type == "gmonth")
-	return GMonth;
-    else if (type == "decimal")
-	return Decimal;
-    else if (type == "integer")
-	return Integer;
-    else if (type == "nonPositiveinteger")
-	return NonPositiveInteger;
-    else if (type == "negativeinteger")
-	return NegativeInteger;
-    else if (type == "long")
-	return Long;
-    else if (type == "int")
-	return Int;
-    else if (type == "short")
-	return Short;
-    else if (type == "byte")
-	return Byte;
-    else if (type == "nonnegativeinteger")
-	return NonNegativeInteger;
-    else if (type == "unsignedlong")
-	return UnsignedLong;
-    else if (type == "unsignedint")
-	return UnsignedInt;
-    else if (type == "unsignedshort")
-	return UnsignedShort;
-    else if (type == "unsignedbyte")
-	return UnsignedByte;
-    else if (type == "positiveinteger")
-	return PositiveInteger;
-    else if (type == "float")
-	return Float;
-    else if (type == "double")
-	return Double;
-    else if (type == "boolean")
-	return Boolean;
-    else
-	return Other;
+    const QString type = name.trimmed();
+    return typeFromName(type.midRef(0));
 }
 
 /*!
@@ -717,6 +774,19 @@ QDomElement QtSoapType::toDomElement(QDomDocument document) const
     return QDomElement();
 }
 
+/*!
+    Writes the XML representation of this QtSoapType to \a writer.
+    If \a tag is not empty, it is used as the element's local name
+    instead of name(). The default implementation writes nothing.
+
+    \sa toDomElement()
+*/
+void QtSoapType::writeXml(QXmlStreamWriter &writer, const QString &tag) const
+{
+    Q_UNUSED(writer);
+    Q_UNUSED(tag);
+}
+
 /*!
     Returns the QString representation of this QtSoapType's type.
 */
@@ -898,7 +968,7 @@ bool QtSoapType::parse(QDomNode /* node */)
     the array can contain.
 */
 QtSoapArray::QtSoapArray()
-    : QtSoapType(QtSoapQName(), Array), arrayType(Other), order(1)
+    : QtSoapType(QtSoapQName(), Array), isSparse(false), arrayType(Other), order(1)
 {
     lastIndex = 0;
     siz0 = 0;
@@ -919,7 +989,7 @@ QtSoapArray::QtSoapArray()
 */
 QtSoapArray::QtSoapArray(const QtSoapQName &name, QtSoapType::Type type, int size0,
 			 int size1, int size2, int size3, int size4)
-    : QtSoapType(name, Array), lastIndex(0), arrayType(type),
+    : QtSoapType(name, Array), isSparse(false), lastIndex(0), arrayType(type),
       siz0(size0), siz1(size1), siz2(size2), siz3(size3),
       siz4(size4)
 {
@@ -951,7 +1021,9 @@ QtSoapArray::~QtSoapArray()
 */
 void QtSoapArray::clear()
 {
-    array.clear();
+    items.clear();
+    sparseItems.clear();
+    isSparse = false;
     lastIndex = 0;
     arrayType = Other;
     siz0 = siz1 = siz2 = siz3 = siz4 = 0;
@@ -978,7 +1050,9 @@ QtSoapArray &QtSoapArray::operator = (const QtSoapArray &copy)
     siz2 = copy.siz2;
     siz3 = copy.siz3;
     siz4 = copy.siz4;
-    array = copy.array;
+    items = copy.items;
+    sparseItems = copy.sparseItems;
+    isSparse = copy.isSparse;
 
     return *this;
 }
@@ -997,10 +1071,13 @@ void QtSoapArray::append(QtSoapType *item)
 	return;
     }
 
-    if (array.count() == 0) {
-	array.insert(0, item);
+    if (!isSparse) {
+	items.append(item);
+	lastIndex = items.count() - 1;
+    } else if (sparseItems.count() == 0) {
+	sparseItems.insert(0, item);
     } else {
-	array.insert(lastIndex + 1, item);
+	sparseItems.insert(lastIndex + 1, item);
 	++lastIndex;
     }
 }
@@ -1034,7 +1111,35 @@ void QtSoapArray::insert(int pos, QtSoapType *item)
     else if (order == 1 && pos > lastIndex)
 	lastIndex = pos;
 
-    array.insert(pos, item);
+    if (!isSparse) {
+	if (pos == items.count()) {
+	    items.append(item);
+	    return;
+	} else if (pos >= 0 && pos < items.count()) {
+	    items[pos] = item;
+	    return;
+	}
+	makeSparse();
+    }
+
+    sparseItems.insert(pos, item);
+}
+
+/*! \internal
+
+    Moves the items of a consecutive array into the position-keyed
+    hash. Called the first time an item lands outside the range
+    covered by the vector.
+*/
+void QtSoapArray::makeSparse()
+{
+    if (isSparse)
+	return;
+
+    for (int i = 0; i < items.count(); ++i)
+	sparseItems.insert(i, items.at(i));
+    items.clear();
+    isSparse = true;
 }
 
 /*!
@@ -1198,7 +1303,7 @@ QString QtSoapArray::arrayTypeString() const
 */
 QDomElement QtSoapArray::toDomElement(QDomDocument doc) const
 {
-    QString prefix = QtSoapNamespaces::instance().prefixFor(n.uri());
+    QString prefix = n.prefix();
     QDomElement a = n.uri() == ""
 		    ? doc.createElement( n.name())
 		    : doc.createElementNS(n.uri(), prefix + ":" + n.name());
@@ -1233,6 +1338,26 @@ QDomElement QtSoapArray::toDomElement(QDomDocument doc) const
     return a;
 }
 
+/*!
+    Writes the XML representation of this QtSoapArray to \a writer,
+    the same way toDomElement() builds it. If \a tag is not empty,
+    it is used as the element's local name.
+*/
+void QtSoapArray::writeXml(QXmlStreamWriter &writer, const QString &tag) const
+{
+    static const QString itemTag(QLatin1String("item"));
+
+    writeStartElement(writer, n, tag);
+    writer.writeAttribute(XML_SCHEMA_INSTANCE, QLatin1String("type"), QLatin1String("xsd:Array"));
+    writer.writeAttribute(SOAPv11_ENCODING, QLatin1String("arrayType"), "xsd:" + arrayTypeString());
+
+    // Items carry no position for the same reason as in toDomElement()
+    for (QtSoapArrayIterator i(*const_cast<QtSoapArray *>(this)); !i.atEnd(); ++i)
+	i.data()->writeXml(writer, itemTag);
+
+    writer.writeEndElement();
+}
+
 /*! \reimp
 
     For this class, always returns true.
@@ -1253,16 +1378,20 @@ bool QtSoapArray::parse(QDomNode node)
 	return false;
 
     QDomElement e = node.toElement();
-    QDomAttr typeattr = e.attributeNode("type");
-    if (!typeattr.isNull() && (localName(typeattr.value()).toLower() != "array"))
+    QDomAttr typeattr = e.attributeNode(typeAttributeName());
+    if (!typeattr.isNull()
+	&& localNameRef(typeattr.value()).compare(QLatin1String("array"), Qt::CaseInsensitive) != 0)
 	return false;
 
 
     QDomNodeList children = e.childNodes();
     int c = children.count();
-    array.clear();
-    // ### array.resize(c);
+    items.clear();
+    sparseItems.clear();
+    isSparse = false;
+    items.reserve(c);
 
+    QtSoapTypeFactory::DispatchCache cache;
     int pos = 0;
     for (int i = 0; i < c; ++i) {
 	QDomNode n = children.item(i);
@@ -1275,7 +1404,7 @@ bool QtSoapArray::parse(QDomNode node)
 
 	QDomElement elem = n.toElement();
 
-	QtSmartPtr<QtSoapType> type = QtSoapTypeFactory::instance().soapType(elem);
+	QtSmartPtr<QtSoapType> type = QtSoapTypeFactory::instance().soapType(elem, &cache);
 	if (!type.ptr()) {
 	    // ### An error in the soap document.
 	    return false;
@@ -1283,14 +1412,19 @@ bool QtSoapArray::parse(QDomNode node)
 
 	// ### Check namespace
 	QDomAttr posattr = elem.attributeNode("position");
-	if (!posattr.isNull())
+	if (!posattr.isNull()) {
 	    pos = posattr.value().toInt();
+	    makeSparse();
+	}
 
-	array.insert(pos, type);
+	if (isSparse)
+	    sparseItems.insert(pos, type);
+	else
+	    items.append(type);
 	++pos;
     }
 
-    setName(QtSoapQName(localName(e.tagName()), e.namespaceURI()));
+    setName(QtSoapQName(elementLocalName(e), e.namespaceURI()));
     return true;
 }
 
@@ -1300,7 +1434,7 @@ bool QtSoapArray::parse(QDomNode node)
 */
 int QtSoapArray::count() const
 {
-    return array.count();
+    return isSparse ? sparseItems.count() : items.count();
 }
 
 /*!
@@ -1379,8 +1513,15 @@ QtSoapType &QtSoapArray::at(int pos)
 {
     static QtSoapType NIL;
 
-    if (array.find(pos) != array.end())
-	return *array[pos];
+    if (!isSparse) {
+	if (pos >= 0 && pos < items.count())
+	    return *items.at(pos);
+	return NIL;
+    }
+
+    QHash<int, QtSmartPtr<QtSoapType> >::ConstIterator it = sparseItems.constFind(pos);
+    if (it != sparseItems.constEnd())
+	return **it;
     else
 	return NIL;
 }
@@ -1450,8 +1591,15 @@ const QtSoapType &QtSoapArray::at(int pos) const
 {
     static QtSoapType NIL;
 
-    if (array.find(pos) != array.end())
-	return *array[pos];
+    if (!isSparse) {
+	if (pos >= 0 && pos < items.count())
+	    return *items.at(pos);
+	return NIL;
+    }
+
+    QHash<int, QtSmartPtr<QtSoapType> >::ConstIterator it = sparseItems.constFind(pos);
+    if (it != sparseItems.constEnd())
+	return **it;
     else
 	return NIL;
 }
@@ -1516,7 +1664,7 @@ const QtSoapType &QtSoapArray::at(int pos0, int pos1, int pos2, int pos3, int po
     the iterator to point to the first element.
 */
 QtSoapArrayIterator::QtSoapArrayIterator(QtSoapArray &array)
-    : it(array.array.begin()), arr(&array)
+    : it(array.sparseItems.begin()), index(0), arr(&array)
 {
 }
 
@@ -1524,7 +1672,7 @@ QtSoapArrayIterator::QtSoapArrayIterator(QtSoapArray &array)
     Constructs a QtSoapArrayIterator that is a copy of \a copy.
 */
 QtSoapArrayIterator::QtSoapArrayIterator(const QtSoapArrayIterator &copy)
-    : it(copy.it), arr(copy.arr)
+    : it(copy.it), index(copy.index), arr(copy.arr)
 {
 }
 
@@ -1533,7 +1681,9 @@ QtSoapArrayIterator::QtSoapArrayIterator(const QtSoapArrayIterator &copy)
 */
 bool QtSoapArrayIterator::atEnd() const
 {
-    return (it == arr->array.end());
+    if (!arr->isSparse)
+	return index >= arr->items.count();
+    return (it == arr->sparseItems.end());
 }
 
 /*!
@@ -1543,6 +1693,7 @@ bool QtSoapArrayIterator::atEnd() const
 QtSoapArrayIterator &QtSoapArrayIterator::operator =(const QtSoapArrayIterator &copy)
 {
     it = copy.it;
+    index = copy.index;
     arr = copy.arr;
 
     return *this;
@@ -1563,7 +1714,7 @@ QtSoapArrayIterator::~QtSoapArrayIterator()
 */
 int QtSoapArrayIterator::pos() const
 {
-    return it.key();
+    return arr->isSparse ? it.key() : index;
 }
 
 /*!
@@ -1577,7 +1728,7 @@ int QtSoapArrayIterator::pos() const
 void QtSoapArrayIterator::pos(int *pos0, int *pos1, int *pos2,
 			      int *pos3, int *pos4) const
 {
-    const int key = it.key();
+    const int key = pos();
 
     switch (arr->order) {
     case 1:
@@ -1638,9 +1789,9 @@ void QtSoapArrayIterator::pos(int *pos0, int *pos1, int *pos2,
 */
 QtSoapType *QtSoapArrayIterator::data()
 {
-    if (it == arr->array.end())
+    if (atEnd())
         return 0;
-    return it.value().ptr();
+    return arr->isSparse ? it.value().ptr() : arr->items.at(index).ptr();
 }
 
 /*!
@@ -1649,9 +1800,9 @@ QtSoapType *QtSoapArrayIterator::data()
 */
 const QtSoapType *QtSoapArrayIterator::current() const
 {
-    if (it == arr->array.end())
+    if (atEnd())
         return 0;
-    return it.value().ptr();
+    return arr->isSparse ? it.value().ptr() : arr->items.at(index).ptr();
 }
 
 /*!
@@ -1659,7 +1810,10 @@ const QtSoapType *QtSoapArrayIterator::current() const
 */
 void QtSoapArrayIterator::operator ++()
 {
-    ++it;
+    if (arr->isSparse)
+	++it;
+    else
+	++index;
 }
 
 /*!
@@ -1668,7 +1822,7 @@ void QtSoapArrayIterator::operator ++()
 */
 bool QtSoapArrayIterator::operator != (const QtSoapArrayIterator &j) const
 {
-    return it != j.it;
+    return !(*this == j);
 }
 
 /*!
@@ -1677,6 +1831,8 @@ bool QtSoapArrayIterator::operator != (const QtSoapArrayIterator &j) const
 */
 bool QtSoapArrayIterator::operator == (const QtSoapArrayIterator &j) const
 {
+    if (!arr->isSparse)
+	return arr == j.arr && index == j.index;
     return it == j.it;
 }
 
@@ -1755,7 +1911,7 @@ void QtSoapStruct::insert(QtSoapType *item)
 */
 QDomElement QtSoapStruct::toDomElement(QDomDocument doc) const
 {
-    QString prefix = QtSoapNamespaces::instance().prefixFor(n.uri());
+    QString prefix = n.prefix();
     QDomElement a = n.uri() == ""
 		    ? doc.createElement(n.name())
 		    : doc.createElementNS(n.uri(), prefix + ":" + n.name());
@@ -1766,6 +1922,18 @@ QDomElement QtSoapStruct::toDomElement(QDomDocument doc) const
     return a;
 }
 
+/*!
+    Writes the XML representation of this struct to \a writer. If \a
+    tag is not empty, it is used as the element's local name.
+*/
+void QtSoapStruct::writeXml(QXmlStreamWriter &writer, const QString &tag) const
+{
+    writeStartElement(writer, n, tag);
+    for (QtSoapStructIterator i(*const_cast<QtSoapStruct *>(this)); i.data(); ++i)
+	i.data()->writeXml(writer);
+    writer.writeEndElement();
+}
+
 /*! \reimp
  */
 bool QtSoapStruct::isValid() const
@@ -1788,6 +1956,7 @@ bool QtSoapStruct::parse(QDomNode node)
     int c = children.count();
     dict.clear();
 
+    QtSoapTypeFactory::DispatchCache cache;
     for (int i = 0; i < c; ++i) {
 	QDomNode n = children.item(i);
         if (n.isComment())
@@ -1799,7 +1968,7 @@ bool QtSoapStruct::parse(QDomNode node)
 	    return false;
 	}
 
-	QtSmartPtr<QtSoapType> type = QtSoapTypeFactory::instance().soapType(n.toElement());
+	QtSmartPtr<QtSoapType> type = QtSoapTypeFactory::instance().soapType(n.toElement(), &cache);
 	if (!type.ptr()) {
 	    errorStr = "In the struct element " + e.tagName();
 	    errorStr += ", child #" + QString::number(i) + ", ";
@@ -1810,7 +1979,7 @@ bool QtSoapStruct::parse(QDomNode node)
 	dict.append(type);
     }
 
-    setName(QtSoapQName(localName(e.tagName()), e.namespaceURI()));
+    setName(QtSoapQName(elementLocalName(e), e.namespaceURI()));
     return true;
 }
 
@@ -1913,9 +2082,9 @@ QtSoapType &QtSoapStruct::at(const QtSoapQName &key)
 {
     static QtSoapType NIL;
 
-    QListIterator<QtSmartPtr<QtSoapType> > it(dict);
-    while (it.hasNext()) {
-        QtSoapType *ret = it.next().ptr();
+    QList<QtSmartPtr<QtSoapType> >::ConstIterator it = dict.constBegin();
+    for (; it != dict.constEnd(); ++it) {
+        QtSoapType *ret = it->ptr();
         if (ret->name() == key)
             return *ret;
     }
@@ -1934,9 +2103,12 @@ const QtSoapType &QtSoapStruct::at(const QtSoapQName &key) const
 {
     static QtSoapType NIL;
 
-    for (QtSoapStructIterator i(*const_cast<QtSoapStruct *>(this)); i.current(); ++i)
-	if (i.key() == key)
-	    return *i.current();
+    QList<QtSmartPtr<QtSoapType> >::ConstIterator it = dict.constBegin();
+    for (; it != dict.constEnd(); ++it) {
+        const QtSoapType *ret = it->ptr();
+        if (ret->name() == key)
+            return *ret;
+    }
 
     return NIL;
 }
@@ -2019,6 +2191,7 @@ bool QtSoapStructIterator::operator ==(const QtSoapStructIterator &j) const
     Constructs an empty QtSoapSimpleType.
 */
 QtSoapSimpleType::QtSoapSimpleType()
+    : storage(NoValue)
 {
 }
 
@@ -2029,7 +2202,7 @@ QtSoapSimpleType::QtSoapSimpleType()
     (qualified name) to \a name.
 */
 QtSoapSimpleType::QtSoapSimpleType(const QtSoapQName &name)
-    : QtSoapType(name)
+    : QtSoapType(name), storage(NoValue)
 {
 }
 
@@ -2040,8 +2213,9 @@ QtSoapSimpleType::QtSoapSimpleType(const QtSoapQName &name)
     (qualified name) to \a name and its value to \a n.
 */
 QtSoapSimpleType::QtSoapSimpleType(const QtSoapQName &name, int n)
-    : QtSoapType(name, Int), v(QVariant(n))
+    : QtSoapType(name, Int), storage(IntValue)
 {
+    number.intValue = n;
 }
 
 /*!
@@ -2055,8 +2229,9 @@ QtSoapSimpleType::QtSoapSimpleType(const QtSoapQName &name, int n)
     and int.
 */
 QtSoapSimpleType::QtSoapSimpleType(const QtSoapQName &name, bool n, int)
-    : QtSoapType(name, Boolean), v(QVariant(n))
+    : QtSoapType(name, Boolean), storage(BoolValue)
 {
+    number.boolValue = n;
 }
 
 /*!
@@ -2066,7 +2241,7 @@ QtSoapSimpleType::QtSoapSimpleType(const QtSoapQName &name, bool n, int)
     (qualified name) to \a name and its value to \a n.
 */
 QtSoapSimpleType::QtSoapSimpleType(const QtSoapQName &name, const QString &n)
-    : QtSoapType(name, String), v(QVariant(n))
+    : QtSoapType(name, String), storage(StringValue), str(n)
 {
 }
 
@@ -2074,8 +2249,9 @@ QtSoapSimpleType::QtSoapSimpleType(const QtSoapQName &name, const QString &n)
     Constructs a QtSoapSimpleType that is a copy of \a copy.
 */
 QtSoapSimpleType::QtSoapSimpleType(const QtSoapSimpleType &copy)
-    : QtSoapType(copy), v(copy.v)
+    : QtSoapType(copy), storage(copy.storage), str(copy.str)
 {
+    number = copy.number;
 }
 
 /*!
@@ -2090,7 +2266,8 @@ QtSoapSimpleType::~QtSoapSimpleType()
 */
 void QtSoapSimpleType::clear()
 {
-    v.clear();
+    storage = NoValue;
+    str.clear();
 }
 
 /*!
@@ -2099,18 +2276,32 @@ void QtSoapSimpleType::clear()
 */
 QDomElement QtSoapSimpleType::toDomElement(QDomDocument doc) const
 {
-    QString prefix = QtSoapNamespaces::instance().prefixFor(n.uri());
+    QString prefix = n.prefix();
     QDomElement a = n.uri() == ""
 		    ? doc.createElement(n.name())
 		    : doc.createElementNS(n.uri(), prefix + ":" + n.name());
 
     QString schemaprefix = QtSoapNamespaces::instance().prefixFor(XML_SCHEMA_INSTANCE);
     a.setAttributeNS(XML_SCHEMA_INSTANCE, schemaprefix + ":type", "xsd:" + typeName());
-    a.appendChild(doc.createTextNode(v.toString()));
+    a.appendChild(doc.createTextNode(toString()));
 
     return a;
 }
 
+/*!
+    Writes the XML representation of this QtSoapSimpleType to \a
+    writer. If \a tag is not empty, it is used as the element's local
+    name. The value is escaped and encoded by the writer directly, no
+    intermediate document is built.
+*/
+void QtSoapSimpleType::writeXml(QXmlStreamWriter &writer, const QString &tag) const
+{
+    writeStartElement(writer, n, tag);
+    writer.writeAttribute(XML_SCHEMA_INSTANCE, QLatin1String("type"), "xsd:" + typeName());
+    writer.writeCharacters(toString());
+    writer.writeEndElement();
+}
+
 /*! \reimp
 */
 bool QtSoapSimpleType::isValid() const
@@ -2129,7 +2320,9 @@ QtSoapSimpleType &QtSoapSimpleType::operator =(const QtSoapSimpleType &copy)
     n = copy.n;
     u = copy.u;
     h = copy.h;
-    v = copy.v;
+    storage = copy.storage;
+    str = copy.str;
+    number = copy.number;
 
     return *this;
 }
@@ -2138,6 +2331,10 @@ QtSoapSimpleType &QtSoapSimpleType::operator =(const QtSoapSimpleType &copy)
     Inspects \a node and constructs the QtSoapSimpleType content if \a
     node qualifies as a SOAP simple type. Returns true if it does;
     otherwise returns false.
+
+    The element's text is converted to typed storage here, so the
+    value no longer refers to the parsed document and reading it
+    from several threads at once is safe.
 */
 bool QtSoapSimpleType::parse(QDomNode node)
 {
@@ -2146,42 +2343,16 @@ bool QtSoapSimpleType::parse(QDomNode node)
 
     QDomElement e = node.toElement();
 
-    QDomAttr typeattr = e.attributeNode("type");
-    QString type = typeattr.isNull() ? QString("string") : localName(typeattr.value()).toLower();
+    QDomAttr typeattr = e.attributeNode(typeAttributeName());
+    t = typeattr.isNull() ? String : typeFromName(localNameRef(typeattr.value()));
+    str.clear();
 
-    t = QtSoapType::nameToType(type);
+    const QString text = elementText(e);
     switch (t) {
-    case Duration:
-    case DateTime:
-    case Time:
-    case Date:
-    case GYearMonth:
-    case GYear:
-    case GMonthDay:
-    case GDay:
-    case GMonth:
-    case Base64Binary:
-    case HexBinary:
-    case AnyURI:
-    case QName:
-    case NOTATION:
-    case String:
-    case NormalizedString:
-    case Token:
-    case Language:
-    case Name:
-    case NMTOKEN:
-    case NCName:
-    case ID:
-    case IDREF:
-    case ENTITY:
-	v = QVariant(e.text());
-	break;
     case Float:
-	v = QVariant(e.text().toFloat());
-	break;
     case Double:
-	v = QVariant(e.text().toDouble());
+	number.doubleValue = text.toDouble();
+	storage = DoubleValue;
 	break;
     case Decimal:
     case Integer:
@@ -2197,37 +2368,70 @@ bool QtSoapSimpleType::parse(QDomNode node)
     case UnsignedInt:
     case UnsignedShort:
     case UnsignedByte:
-	if (e.text() == "" || (e.text() != "" && (e.text()[0].isNumber() || e.text()[0] == '-')))
-	    v = QVariant(e.text().toInt());
-	else {
+	if (text == "" || text[0].isNumber() || text[0] == '-') {
+	    number.intValue = text.toInt();
+	    storage = IntValue;
+	} else {
+	    storage = NoValue;
 	    errorStr = "Type error at element \"" + e.tagName() + "\"";
 	    return false;
 	}
-
 	break;
     case Boolean: {
-	QString val = e.text().trimmed().toLower();
-	if (val == "false")
-	    v = QVariant(false);
-	else if (val == "true")
-	    v = QVariant(true);
+	QString val = text.trimmed().toLower();
+	storage = NoValue;
+	if (val == "false") {
+	    number.boolValue = false;
+	    storage = BoolValue;
+	} else if (val == "true") {
+	    number.boolValue = true;
+	    storage = BoolValue;
+	}
     }
 	break;
     default:
-	v = e.text();
+	str = text;
+	storage = StringValue;
 	break;
     }
 
-    setName(QtSoapQName(localName(e.tagName()), e.namespaceURI()));
+    setName(QtSoapQName(elementLocalName(e), e.namespaceURI()));
     return true;
 }
 
+/*! \internal
+
+    Returns the text of \a e. The common case of an element holding
+    a single text node shares that node's string instead of
+    concatenating a new one.
+*/
+QString QtSoapSimpleType::elementText(const QDomElement &e)
+{
+    QDomNode child = e.firstChild();
+    if (child.isNull())
+	return QString("");
+    if (child.nextSibling().isNull() && (child.isText() || child.isCDATASection()))
+	return child.nodeValue();
+    return e.text();
+}
+
 /*!
     Returns the value of the simple type as a QString.
 */
 QString QtSoapSimpleType::toString() const
 {
-    return v.toString();
+    switch (storage) {
+    case StringValue:
+	return str;
+    case IntValue:
+	return QString::number(number.intValue);
+    case DoubleValue:
+	return QString::number(number.doubleValue, 'g', t == Float ? FLT_DIG : DBL_DIG);
+    case BoolValue:
+	return number.boolValue ? QString("true") : QString("false");
+    default:
+	return QString();
+    }
 }
 
 /*!
@@ -2235,7 +2439,18 @@ QString QtSoapSimpleType::toString() const
 */
 int QtSoapSimpleType::toInt() const
 {
-    return v.toInt();
+    switch (storage) {
+    case StringValue:
+	return str.toInt();
+    case IntValue:
+	return number.intValue;
+    case DoubleValue:
+	return qRound(number.doubleValue);
+    case BoolValue:
+	return number.boolValue ? 1 : 0;
+    default:
+	return 0;
+    }
 }
 
 /*!
@@ -2243,7 +2458,18 @@ int QtSoapSimpleType::toInt() const
 */
 bool QtSoapSimpleType::toBool() const
 {
-    return v.toBool();
+    switch (storage) {
+    case StringValue:
+	return !str.isEmpty() && str != "0" && str.toLower() != "false";
+    case IntValue:
+	return number.intValue != 0;
+    case DoubleValue:
+	return number.doubleValue != 0;
+    case BoolValue:
+	return number.boolValue;
+    default:
+	return false;
+    }
 }
 
 
@@ -2252,7 +2478,20 @@ bool QtSoapSimpleType::toBool() const
 */
 QVariant QtSoapSimpleType::value() const
 {
-    return v;
+    switch (storage) {
+    case StringValue:
+	return QVariant(str);
+    case IntValue:
+	return QVariant(number.intValue);
+    case DoubleValue:
+	if (t == Float)
+	    return QVariant(float(number.doubleValue));
+	return QVariant(number.doubleValue);
+    case BoolValue:
+	return QVariant(number.boolValue);
+    default:
+	return QVariant();
+    }
 }
 
 /*! \class QtSoapMessage qtsoap.h
@@ -2401,6 +2640,7 @@ void QtSoapMessage::clear()
 */
 QtSoapMessage &QtSoapMessage::operator =(const QtSoapMessage &copy)
 {
+    type = copy.type;
     envelope = copy.envelope;
     m = copy.m;
     margs = copy.margs;
@@ -2438,6 +2678,9 @@ bool QtSoapMessage::setContent(QDomDocument &d)
     validates as a SOAP message. Any existing message content is
     replaced.
 
+    UTF-8 documents are tokenized by QtSoapXmlReader; anything it does
+    not handle is parsed by QDomDocument instead.
+
     If the import fails, this message becomes a Fault message.
 
     Returns true if the import succeeds, otherwise false.
@@ -2448,8 +2691,8 @@ bool QtSoapMessage::setContent(const QByteArray &buffer)
     QString errorMsg;
 
     QDomDocument doc;
-    if (!doc.setContent(buffer, true, &errorMsg,
-			&errorLine, &errorColumn)) {
+    if (!QtSoapXmlReader::read(buffer, &doc)
+	&& !doc.setContent(buffer, true, &errorMsg, &errorLine, &errorColumn)) {
 	QString s;
 	s.sprintf("%s at line %i, column %i", errorMsg.toLatin1().constData(),
 		  errorLine, errorColumn);
@@ -2549,25 +2792,198 @@ bool QtSoapMessage::isValidSoapMessage(const QDomDocument &candidate)
 /*!
     Returns the XML representation of the SOAP message as a QString,
     optionally indenting using \a indent spaces.
+
+    \sa toXml()
 */
 QString QtSoapMessage::toXmlString(int indent) const
 {
-    QDomImplementation impl;
-    QDomDocument doc = impl.createDocument(QString(), QString("placeholder"),
-                                           QDomDocumentType());
-    doc.removeChild(doc.firstChild());
-    doc.appendChild(envelope.toDomElement(doc));
+    QBuffer buffer;
+    buffer.open(QIODevice::WriteOnly);
+    writeXml(&buffer, indent);
+    return QString::fromUtf8(buffer.data().constData(), buffer.data().size());
+}
 
-    QDomElement env = doc.firstChild().toElement();
+/*!
+    Returns the UTF-8 encoded XML representation of the SOAP message.
+    This is what QtSoapHttpTransport sends as the request body.
 
-    env.setAttribute(QtSoapNamespaces::instance().prefixFor(SOAPv11_ENVELOPE)
-		     + ":" + "encodingStyle",
-		     SOAPv11_ENCODING);
+    \sa writeXml()
+*/
+QByteArray QtSoapMessage::toXml() const
+{
+    QByteArray xml;
+    QBuffer buffer(&xml);
+    buffer.open(QIODevice::WriteOnly);
+    writeXml(&buffer);
+    buffer.close();
+    return xml;
+}
 
-    env.setAttribute("xmlns:" + QtSoapNamespaces::instance().prefixFor(XML_SCHEMA),
-		     XML_SCHEMA);
+/*!
+    Serializes the SOAP message as UTF-8 straight into \a device,
+    optionally indenting using \a indent spaces. No QDomDocument is
+    built on the way; every registered namespace is declared once on
+    the envelope.
+*/
+void QtSoapMessage::writeXml(QIODevice *device, int indent) const
+{
+    QXmlStreamWriter writer(device);
+    if (indent > 0) {
+	writer.setAutoFormatting(true);
+	writer.setAutoFormattingIndent(indent);
+    }
 
-    return doc.toString(indent);
+    const QMap<QString, QString> namespaces = QtSoapNamespaces::instance().registeredNamespaces();
+    for (QMap<QString, QString>::ConstIterator it = namespaces.constBegin(); it != namespaces.constEnd(); ++it)
+	if (!it.value().isEmpty())
+	    writer.writeNamespace(it.key(), it.value());
+
+    writeStartElement(writer, envelope.name(), QString());
+    writer.writeAttribute(SOAPv11_ENVELOPE, QLatin1String("encodingStyle"), SOAPv11_ENCODING);
+    for (QtSoapStructIterator i(const_cast<QtSoapStruct &>(envelope)); i.data(); ++i)
+	i.data()->writeXml(writer);
+    writer.writeEndElement();
+}
+
+namespace {
+    // Runs on a worker thread, see QtSoapHttpTransport::readResponse()
+    QtSoapMessage parseResponse(const QByteArray &buffer)
+    {
+	QtSoapMessage message;
+	message.setContent(buffer);
+	return message;
+    }
+
+    const char placeholderMarker[] = "{qtsoap-arg:";
+
+    // A simple type whose text is a placeholder marker, whatever its
+    // declared type is, so that the xsi:type attribute comes out right.
+    class QtSoapPlaceholderType : public QtSoapSimpleType
+    {
+    public:
+	QtSoapPlaceholderType(const QtSoapQName &name, int index, QtSoapType::Type type)
+	    : QtSoapSimpleType(name, QLatin1String(placeholderMarker) + QString::number(index) + QLatin1Char('}'))
+	{
+	    t = type;
+	}
+    };
+
+    // Appends \a text to \a out escaped as XML character data,
+    // copying the runs between markup characters in one go.
+    void appendEscaped(QByteArray &out, const QByteArray &text)
+    {
+	const char *p = text.constData();
+	const char *end = p + text.size();
+	while (p < end) {
+	    const char *special = QtSoapXmlScanner::findFirstOf(p, end, '&', '<', '>');
+	    out.append(p, special - p);
+	    if (special == end)
+		break;
+	    out.append(*special == '&' ? "&amp;" : (*special == '<' ? "&lt;" : "&gt;"));
+	    p = special + 1;
+	}
+    }
+}
+
+/*! \class QtSoapMessageTemplate qtsoap.h
+    \brief The QtSoapMessageTemplate class is a pre-serialized SOAP
+    message with slots for variable arguments.
+
+    Requests that are sent over and over with the same structure only
+    differ in a few argument values. A template is built once from a
+    QtSoapMessage whose variable arguments were created with
+    placeholder(). instantiate() then produces the request body by
+    copying the invariant parts and splicing in the escaped values,
+    without building or serializing a message tree.
+
+    \code
+    QtSoapMessage message;
+    message.setMethod("get_entry");
+    message.addMethodArgument(QtSoapMessageTemplate::placeholder(QtSoapQName("session"), 0));
+    message.addMethodArgument(QtSoapMessageTemplate::placeholder(QtSoapQName("id"), 1));
+    QtSoapMessageTemplate getEntry(message);
+
+    transport.submitRequest(getEntry.instantiate(QStringList() << session << id), path);
+    \endcode
+*/
+
+/*!
+    Constructs a null template.
+*/
+QtSoapMessageTemplate::QtSoapMessageTemplate()
+{
+}
+
+/*!
+    Serializes \a message and records where its placeholders are.
+*/
+QtSoapMessageTemplate::QtSoapMessageTemplate(const QtSoapMessage &message)
+{
+    const QByteArray xml = message.toXml();
+    const int markerLength = sizeof(placeholderMarker) - 1;
+
+    int cut = 0;
+    int from = 0;
+    int at;
+    while ((at = xml.indexOf(placeholderMarker, from)) != -1) {
+	from = at + markerLength;
+	const int close = xml.indexOf('}', from);
+	if (close == -1)
+	    break;
+	bool ok;
+	const int index = xml.mid(from, close - from).toInt(&ok);
+	if (!ok)
+	    continue;
+
+	segments.append(xml.mid(cut, at - cut));
+	arguments.append(index);
+	cut = from = close + 1;
+    }
+    segments.append(xml.mid(cut));
+}
+
+/*!
+    Returns true if this template was not built from a message.
+*/
+bool QtSoapMessageTemplate::isNull() const
+{
+    return segments.isEmpty();
+}
+
+/*!
+    Returns the UTF-8 encoded message with each placeholder replaced
+    by the escaped value at its index in \a values. Placeholders
+    without a value are left empty.
+*/
+QByteArray QtSoapMessageTemplate::instantiate(const QStringList &values) const
+{
+    QList<QByteArray> encoded;
+    int size = 0;
+    for (int i = 0; i < segments.count(); ++i)
+	size += segments.at(i).size();
+    for (int i = 0; i < arguments.count(); ++i) {
+	encoded.append(values.value(arguments.at(i)).toUtf8());
+	size += encoded.last().size();
+    }
+
+    QByteArray xml;
+    xml.reserve(size + size / 16);
+    xml.append(segments.value(0));
+    for (int i = 0; i < arguments.count(); ++i) {
+	appendEscaped(xml, encoded.at(i));
+	xml.append(segments.at(i + 1));
+    }
+    return xml;
+}
+
+/*!
+    Returns a new simple type named \a name that stands for the value
+    at \a index when the template is instantiated. \a type is the
+    schema type it is declared as in the message.
+*/
+QtSoapType *QtSoapMessageTemplate::placeholder(const QtSoapQName &name, int index, QtSoapType::Type type)
+{
+    return new QtSoapPlaceholderType(name, index, type);
 }
 
 /*!
@@ -2888,6 +3304,7 @@ void QtSoapMessage::addMethodArgument(const QString &name, const QString &uri, i
     known SOAP types.
 */
 QtSoapTypeFactory::QtSoapTypeFactory()
+    : arrayHandler(0), structHandler(0), stringHandler(0)
 {
     QtSoapTypeConstructor<QtSoapStruct> *structConstructor = new QtSoapTypeConstructor<QtSoapStruct>();
     deleteList.append(structConstructor);
@@ -2927,6 +3344,10 @@ QtSoapTypeFactory::QtSoapTypeFactory()
     registerHandler("float", basicTypeConstructor);
     registerHandler("double", basicTypeConstructor);
     registerHandler("other", structConstructor);
+
+    arrayHandler = arrayConstructor;
+    structHandler = structConstructor;
+    stringHandler = basicTypeConstructor;
 }
 
 /*!
@@ -2953,10 +3374,11 @@ QtSoapTypeFactory &QtSoapTypeFactory::instance()
 
 /*!
     Registers a handler \a handler for a QtSoapType called \a name.
+    Type names are matched case-insensitively.
 */
 bool QtSoapTypeFactory::registerHandler(const QString &name, QtSoapTypeConstructorBase *handler)
 {
-    if (typeHandlers.find(name) != typeHandlers.end()) {
+    if (typeHandlers.contains(name)) {
 	errorStr = "A handler for " + name + " is already registered.";
 	return false;
     }
@@ -2969,51 +3391,85 @@ bool QtSoapTypeFactory::registerHandler(const QString &name, QtSoapTypeConstruct
 */
 QtSmartPtr<QtSoapType> QtSoapTypeFactory::soapType(QDomNode node) const
 {
-    if (node.isNull() || !node.isElement())
-	return QtSmartPtr<QtSoapType>();
+    return soapType(node, 0);
+}
 
-    QDomElement elem = node.toElement();
+/*! \internal
 
-    QDomAttr attr = elem.attributeNode("type");
-    QtSoapTypeConstructorBase *constructor = 0;
-    if (!attr.isNull()) {
-        QHash<QString, QtSoapTypeConstructorBase *>::ConstIterator it;
-	it = typeHandlers.find(localName(attr.value().toLower()));
-        if (it != typeHandlers.end())
-            constructor = *it;
-    }
-
-    if (attr.isNull() || !constructor) {
-        QHash<QString, QtSoapTypeConstructorBase *>::ConstIterator it;
-	if (node.firstChild().isElement()) {
-            if (localName(node.nodeName().toLower()) == "array") {
-                it = typeHandlers.find("array");
-            } else
-                it = typeHandlers.find("struct");
-        } else
-	    it = typeHandlers.find("string");
-        if (it != typeHandlers.end())
-            constructor = *it;
-    }
+    Builds the QtSoapType for \a node. Parsers walking the children of
+    one element pass the same \a cache for every child, so runs of
+    siblings with the same tag and type reuse the previous decision.
+*/
+QtSmartPtr<QtSoapType> QtSoapTypeFactory::soapType(QDomNode node, DispatchCache *cache) const
+{
+    if (node.isNull() || !node.isElement())
+	return QtSmartPtr<QtSoapType>();
 
+    QtSoapTypeConstructorBase *constructor = constructorFor(node.toElement(), cache);
     if (!constructor) {
 	return QtSmartPtr<QtSoapType>();
     }
 
     QtSoapType *type = constructor->createObject(node);
 
-    if (!type)
+    if (!type) {
+	QMutexLocker locker(&errorLock);
 	errorStr = constructor->errorString();
+    }
 
     return QtSmartPtr<QtSoapType>(type);
 }
 
+/*! \internal
+
+    Picks the constructor for \a elem from its type attribute or, if
+    it has none or an unknown one, from its structure. Names are
+    compared case-insensitively in place, without building lowered
+    copies.
+*/
+QtSoapTypeConstructorBase *QtSoapTypeFactory::constructorFor(const QDomElement &elem, DispatchCache *cache) const
+{
+    QDomAttr attr = elem.attributeNode(typeAttributeName());
+    const QString type = attr.isNull() ? QString() : attr.value();
+    const bool complex = elem.firstChild().isElement();
+    const QString tag = elem.tagName();
+
+    if (cache && cache->constructor && cache->complex == complex
+	&& cache->type == type && cache->type.isNull() == type.isNull()
+	&& cache->tag == tag)
+	return cache->constructor;
+
+    QtSoapTypeConstructorBase *constructor = 0;
+    if (!attr.isNull())
+	constructor = typeHandlers.value(QtSoapTypeName(localNameRef(type)), 0);
+
+    if (!constructor) {
+	if (complex) {
+	    if (localNameRef(tag).compare(QLatin1String("array"), Qt::CaseInsensitive) == 0)
+		constructor = arrayHandler;
+	    else
+		constructor = structHandler;
+	} else
+	    constructor = stringHandler;
+    }
+
+    if (cache) {
+	cache->type = type;
+	cache->tag = tag;
+	cache->complex = complex;
+	cache->constructor = constructor;
+    }
+
+    return constructor;
+}
+
 /*!
     Returns a human readable interpretation of the last error
     that occurred.
 */
 QString QtSoapTypeFactory::errorString() const
 {
+    QMutexLocker locker(&errorLock);
     return errorStr;
 }
 
@@ -3098,7 +3554,7 @@ QString QtSoapTypeFactory::errorString() const
 */
 
 QtSoapHttpTransport::QtSoapHttpTransport(QObject *parent)
-    : QObject(parent), networkMgr(this)
+    : QObject(parent), networkMgr(this), soapResponseSize(0)
 {
     connect(&networkMgr, SIGNAL(finished(QNetworkReply *)),
             SLOT(readResponse(QNetworkReply *)));
@@ -3150,6 +3606,18 @@ void QtSoapHttpTransport::setAction(const QString &action)
     HTTP server set using setHost().
 */
 void QtSoapHttpTransport::submitRequest(QtSoapMessage &request, const QString &path)
+{
+    submitRequest(request.toXml(), path);
+}
+
+/*!
+    \overload
+
+    Submits the already serialized SOAP message \a request, for
+    example one produced by QtSoapMessageTemplate::instantiate(), to
+    the path \a path on the HTTP server set using setHost().
+*/
+void QtSoapHttpTransport::submitRequest(const QByteArray &request, const QString &path)
 {
     QNetworkRequest networkReq;
     networkReq.setHeader(QNetworkRequest::ContentTypeHeader, QLatin1String("text/xml;charset=utf-8"));
@@ -3160,7 +3628,7 @@ void QtSoapHttpTransport::submitRequest(QtSoapMessage &request, const QString &p
     networkReq.setUrl(url);
 
     soapResponse.clear();
-    networkRep = networkMgr.post(networkReq, request.toXmlString().toUtf8().constData());
+    networkRep = networkMgr.post(networkReq, request);
 }
 
 
@@ -3187,6 +3655,15 @@ QNetworkAccessManager *QtSoapHttpTransport::networkAccessManager()
 }
 
 
+/*!
+    Returns the size in bytes of the body of the most recently received
+    response, or 0 if it failed at the network level.
+*/
+qint64 QtSoapHttpTransport::responseSize() const
+{
+    return soapResponseSize;
+}
+
 /*!
     Returns a pointer to the QNetworkReply object of the current (or last)
     request, or 0 if no such object is currently available.
@@ -3214,21 +3691,23 @@ void QtSoapHttpTransport::readResponse(QNetworkReply *reply)
     case QNetworkReply::ContentNotFoundError:
     case QNetworkReply::UnknownContentError:
         {
-            soapResponse.setContent(reply->readAll());
-
-            int httpStatus = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
-            if (httpStatus != 200 && httpStatus != 100) {
-                if (soapResponse.faultCode() == QtSoapMessage::Other)
-                    soapResponse.setFaultCode(QtSoapMessage::Client);
-                /*
-                QString httpReason = reply->attribute(QNetworkRequest::HttpReasonPhraseAttribute).toString();
-                soapResponse.setFaultString(QString("HTTP status %2 (%3).\n%1").arg(soapResponse.faultString().toString()).arg(httpStatus).arg(httpReason));
-                */
-            }
+            // Parsing large responses takes a while, so it is done on
+            // the global thread pool; responseParsed() picks it up.
+            QFutureWatcher<QtSoapMessage> *watcher = new QFutureWatcher<QtSoapMessage>(this);
+            QByteArray data = reply->readAll();
+            watcher->setProperty("httpStatus", reply->attribute(QNetworkRequest::HttpStatusCodeAttribute));
+            watcher->setProperty("size", data.size());
+            connect(watcher, SIGNAL(finished()), SLOT(responseParsed()));
+            parsing.enqueue(watcher);
+            watcher->setFuture(QtConcurrent::run(parseResponse, data));
+            reply->deleteLater();
+            return;
         }
         break;
     default:
         {
+            soapResponse.clear();
+            soapResponseSize = 0;
             soapResponse.setFaultCode(QtSoapMessage::Client);
             soapResponse.setFaultString(QString("Network transport error (%1): %2").arg(reply->error()).arg(reply->errorString()));
         }
@@ -3241,6 +3720,34 @@ void QtSoapHttpTransport::readResponse(QNetworkReply *reply)
     reply->deleteLater();
 }
 
+/*! \internal
+
+    Delivers the responses that have been parsed, in the order they
+    were received.
+*/
+void QtSoapHttpTransport::responseParsed()
+{
+    while (!parsing.isEmpty() && parsing.head()->isFinished()) {
+	QFutureWatcher<QtSoapMessage> *watcher = parsing.dequeue();
+	soapResponse = watcher->result();
+	soapResponseSize = watcher->property("size").toLongLong();
+
+	int httpStatus = watcher->property("httpStatus").toInt();
+	if (httpStatus != 200 && httpStatus != 100) {
+	    if (soapResponse.faultCode() == QtSoapMessage::Other)
+		soapResponse.setFaultCode(QtSoapMessage::Client);
+	    /*
+	    QString httpReason = reply->attribute(QNetworkRequest::HttpReasonPhraseAttribute).toString();
+	    soapResponse.setFaultString(QString("HTTP status %2 (%3).\n%1").arg(soapResponse.faultString().toString()).arg(httpStatus).arg(httpReason));
+	    */
+	}
+	watcher->deleteLater();
+
+	emit responseReady();
+	emit responseReady(soapResponse);
+    }
+}
+
 /*! \class QtSoapNamespaces qtsoap.h
 
     \brief The QtSoapNamespaces class provides a registry for XML
@@ -3283,21 +3790,61 @@ QtSoapNamespaces &QtSoapNamespaces::instance()
 */
 QtSoapNamespaces::QtSoapNamespaces()
 {
+    current = new Registry;
+}
+
+/*! \internal
+
+    Destructs the registry and every snapshot it has published.
+*/
+QtSoapNamespaces::~QtSoapNamespaces()
+{
+    delete static_cast<Registry *>(current);
+    qDeleteAll(retired);
 }
 
 /*!
     Registers the namespace \a uri with the prefix \a prefix.
+
+    Registering is rare compared to lookups, so the registry is kept
+    as an immutable snapshot that readers use without locking. A new
+    snapshot is published for each change; registering a namespace
+    again with the same prefix does nothing.
 */
 void QtSoapNamespaces::registerNamespace(const QString &prefix, const QString &uri)
 {
-    namespaces.insert(uri, prefix);
+    QMutexLocker locker(&writeLock);
+    Registry *old = current;
+    QHash<QString, QString>::ConstIterator it = old->prefixes.constFind(uri);
+    if (it != old->prefixes.constEnd() && *it == prefix)
+	return;
+
+    Registry *updated = new Registry(*old);
+    updated->prefixes.insert(uri, prefix);
+    updated->ordered.insert(uri, prefix);
+    current.fetchAndStoreRelease(updated);
+
+    // Readers may still hold the old snapshot, and there are only as
+    // many of them as registrations.
+    retired.append(old);
 }
 
 /*!
     Returns the prefix for the namespace \a uri, or an empty string if
-    no prefix has been registered for \a uri.
+    no prefix has been registered for \a uri. This function is thread
+    safe.
+*/
+QString QtSoapNamespaces::prefixFor(const QString &uri) const
+{
+    const Registry *registry = current;
+    return registry->prefixes.value(uri);
+}
+
+/*!
+    Returns every registered namespace, mapping its URI to its prefix.
 */
-QString QtSoapNamespaces::prefixFor(const QString &uri)
+QMap<QString, QString> QtSoapNamespaces::registeredNamespaces() const
 {
-    return namespaces.value(uri);
+    const Registry *registry = current;
+    return registry->ordered;
 }
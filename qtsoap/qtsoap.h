@@ -43,11 +43,18 @@
 #include <QString>
 #include <QVariant>
 #include <QtXml>
+#include <QXmlStreamWriter>
 #include <QNetworkAccessManager>
 #include <QUrl>
 #include <QHash>
+#include <QVector>
+#include <QAtomicInt>
+#include <QAtomicPointer>
+#include <QMutex>
 #include <QLinkedList>
 #include <QPointer>
+#include <QQueue>
+#include <QFutureWatcher>
 
 #if defined(Q_OS_WIN)
 #  if !defined(QT_QTSOAP_EXPORT) && !defined(QT_QTSOAP_IMPORT)
@@ -73,50 +80,57 @@
 #define XML_SCHEMA_INSTANCE "http://www.w3.org/1999/XMLSchema-instance"
 #define XML_NAMESPACE       "http://www.w3.org/XML/1998/namespace"
 
+/*
+    Reference counted handle to a QtSoapType. The count lives in the
+    pointee itself (see QtSoapType::refCount), so copying a handle
+    never allocates and a handle is the size of a plain pointer.
+*/
 template <class T>
 class QtSmartPtr
 {
 public:
     inline QtSmartPtr(T *data = 0)
+	: d(data)
     {
-	d = data;
-	r = new int;
-	*r = 1;
+	if (d)
+	    d->refCount.ref();
     }
 
     inline QtSmartPtr(const QtSmartPtr &copy)
+	: d(copy.d)
     {
-	if (*copy.r != 0)
-	    ++(*copy.r);
+	if (d)
+	    d->refCount.ref();
+    }
 
-	r = copy.r;
-	d = copy.d;
+#ifdef Q_COMPILER_RVALUE_REFS
+    inline QtSmartPtr(QtSmartPtr &&other)
+	: d(other.d)
+    {
+	other.d = 0;
+    }
+
+    inline QtSmartPtr &operator =(QtSmartPtr &&other)
+    {
+	qSwap(d, other.d);
+	return *this;
     }
+#endif
 
     inline ~QtSmartPtr()
     {
-        if ((*r) == 0)
-            delete r;
-	else if ((*r) != 0 && --(*r) == 0) {
-	    delete r;
-	    if (d) delete d;
-	}
+	if (d && !d->refCount.deref())
+	    delete d;
     }
 
     inline QtSmartPtr &operator =(const QtSmartPtr &copy)
     {
-	if (*copy.r != 0)
-	    ++(*copy.r);
-
-        if ((*r) == 0)
-            delete r;
-	else if ((*r) != 0 && --(*r) == 0) {
-	    delete r;
-	    if (d) delete d;
-	}
-
-	r = copy.r;
+	T *old = d;
 	d = copy.d;
+	if (d)
+	    d->refCount.ref();
+	if (old && !old->refCount.deref())
+	    delete old;
 	return *this;
     }
 
@@ -140,19 +154,12 @@ public:
 	return *d;
     }
 
-    inline T *releasedPtr() const
-    {
-	(*r) = 0;
-	return d;
-    }
-
     inline bool isNull() const
     {
 	return d == 0;
     }
 
 private:
-    int *r;
     T *d;
 };
 
@@ -166,6 +173,7 @@ public:
 
     QString name() const;
     QString uri() const;
+    QString prefix() const;
 
 private:
     QString n;
@@ -212,6 +220,7 @@ public:
     virtual const QtSoapType &operator [](const QString &name) const;
 
     virtual QDomElement toDomElement(QDomDocument) const;
+    virtual void writeXml(QXmlStreamWriter &writer, const QString &tag = QString()) const;
 
     virtual Type type() const;
     virtual QString id() const;
@@ -232,6 +241,10 @@ public:
     static QString typeToName(QtSoapType::Type t);
     static Type nameToType(const QString &);
 
+private:
+    template <class T> friend class QtSmartPtr;
+    mutable QAtomicInt refCount;
+
 protected:
     Type t;
     QString errorStr;
@@ -241,6 +254,8 @@ protected:
     QString h;
 };
 
+Q_DECLARE_TYPEINFO(QtSmartPtr<QtSoapType>, Q_MOVABLE_TYPE);
+
 class QtSoapArrayIterator;
 
 class QT_QTSOAP_EXPORT QtSoapArray : public QtSoapType
@@ -286,14 +301,18 @@ public:
     void insert(int pos0,int pos1,int pos2,int pos3,int pos4, QtSoapType *item);
 
     QDomElement toDomElement(QDomDocument doc) const;
+    void writeXml(QXmlStreamWriter &writer, const QString &tag = QString()) const;
 
     friend class QtSoapArrayIterator;
 
 protected:
     QString arraySizeString() const;
     QString arrayTypeString() const;
+    void makeSparse();
 
-    QHash<int, QtSmartPtr<QtSoapType> > array;
+    QVector<QtSmartPtr<QtSoapType> > items;
+    QHash<int, QtSmartPtr<QtSoapType> > sparseItems;
+    bool isSparse;
     int lastIndex;
 
 private:
@@ -324,6 +343,7 @@ public:
 
 private:
     QHash<int, QtSmartPtr<QtSoapType> >::Iterator it;
+    int index;
     QtSoapArray *arr;
 };
 
@@ -359,6 +379,7 @@ public:
     void insert(QtSoapType *item);
 
     QDomElement toDomElement(QDomDocument doc) const;
+    void writeXml(QXmlStreamWriter &writer, const QString &tag = QString()) const;
 
     friend class QtSoapStructIterator;
 
@@ -408,9 +429,21 @@ public:
     QVariant value() const;
 
     QDomElement toDomElement(QDomDocument doc) const;
+    void writeXml(QXmlStreamWriter &writer, const QString &tag = QString()) const;
 
 protected:
-    QVariant v;
+    enum Storage { NoValue, StringValue, IntValue, DoubleValue, BoolValue };
+
+    static QString elementText(const QDomElement &e);
+
+    Storage storage;
+    QString str;
+    union Number {
+	int intValue;
+	double doubleValue;
+	bool boolValue;
+    };
+    Number number;
 };
 
 class QT_QTSOAP_EXPORT QtSoapMessage
@@ -460,6 +493,8 @@ public:
     // Generating
     void clear();
     QString toXmlString(int indent = 0) const;
+    QByteArray toXml() const;
+    void writeXml(QIODevice *device, int indent = 0) const;
 
     // Errors
     QString errorString() const;
@@ -490,6 +525,23 @@ private:
     QString errorStr;
 };
 
+class QT_QTSOAP_EXPORT QtSoapMessageTemplate
+{
+public:
+    QtSoapMessageTemplate();
+    QtSoapMessageTemplate(const QtSoapMessage &message);
+
+    bool isNull() const;
+    QByteArray instantiate(const QStringList &values) const;
+
+    static QtSoapType *placeholder(const QtSoapQName &name, int index,
+				   QtSoapType::Type type = QtSoapType::String);
+
+private:
+    QList<QByteArray> segments;
+    QList<int> arguments;
+};
+
 class QT_QTSOAP_EXPORT QtSoapTypeConstructorBase
 {
 public:
@@ -520,6 +572,7 @@ public:
 	if (t->parse(node)) {
 	    return t;
 	} else {
+	    QMutexLocker locker(&errorLock);
 	    errorStr = t->errorString();
 	    delete t;
 	    return 0;
@@ -528,13 +581,33 @@ public:
 
     QString errorString() const
     {
+	QMutexLocker locker(&errorLock);
 	return errorStr;
     }
 
 private:
+    mutable QMutex errorLock;
     mutable QString errorStr;
 };
 
+class QT_QTSOAP_EXPORT QtSoapTypeName
+{
+public:
+    QtSoapTypeName(const QString &name);
+    QtSoapTypeName(const QStringRef &name);
+
+    const QChar *unicode() const { return s; }
+    int length() const { return len; }
+
+private:
+    QString owner;
+    const QChar *s;
+    int len;
+};
+
+uint qHash(const QtSoapTypeName &name);
+bool operator ==(const QtSoapTypeName &n1, const QtSoapTypeName &n2);
+
 class QT_QTSOAP_EXPORT QtSoapTypeFactory
 {
 private:
@@ -543,17 +616,34 @@ private:
 public:
     ~QtSoapTypeFactory();
 
+    struct DispatchCache
+    {
+	DispatchCache() : complex(false), constructor(0) {}
+
+	QString type;
+	QString tag;
+	bool complex;
+	QtSoapTypeConstructorBase *constructor;
+    };
+
     static QtSoapTypeFactory &instance();
 
     bool registerHandler(const QString &name, QtSoapTypeConstructorBase *handler);
 
     QtSmartPtr<QtSoapType> soapType(QDomNode node) const;
+    QtSmartPtr<QtSoapType> soapType(QDomNode node, DispatchCache *cache) const;
 
     QString errorString() const;
 
 private:
+    QtSoapTypeConstructorBase *constructorFor(const QDomElement &elem, DispatchCache *cache) const;
+
+    mutable QMutex errorLock;
     mutable QString errorStr;
-    QHash<QString, QtSoapTypeConstructorBase *> typeHandlers;
+    QHash<QtSoapTypeName, QtSoapTypeConstructorBase *> typeHandlers;
+    QtSoapTypeConstructorBase *arrayHandler;
+    QtSoapTypeConstructorBase *structHandler;
+    QtSoapTypeConstructorBase *stringHandler;
     QLinkedList<QtSoapTypeConstructorBase*> deleteList;
 };
 
@@ -561,13 +651,23 @@ class QT_QTSOAP_EXPORT QtSoapNamespaces
 {
 public:
     void registerNamespace(const QString &prefix, const QString &uri);
-    QString prefixFor(const QString &ns);
+    QString prefixFor(const QString &ns) const;
+    QMap<QString, QString> registeredNamespaces() const;
 
     static QtSoapNamespaces &instance();
 
 private:
-    QMap<QString, QString> namespaces;
+    struct Registry
+    {
+	QHash<QString, QString> prefixes;
+	QMap<QString, QString> ordered;
+    };
+
+    QAtomicPointer<Registry> current;
+    QMutex writeLock;
+    QList<Registry *> retired;
     QtSoapNamespaces();
+    ~QtSoapNamespaces();
 };
 
 class QT_QTSOAP_EXPORT QtSoapHttpTransport : public QObject
@@ -582,7 +682,9 @@ public:
     void setHost(const QString &host, int port); //obsolete
     void setAction(const QString &action);
     void submitRequest(QtSoapMessage &request, const QString &path);
+    void submitRequest(const QByteArray &request, const QString &path);
     const QtSoapMessage &getResponse() const;
+    qint64 responseSize() const;
 
     QNetworkAccessManager *networkAccessManager();
     QNetworkReply *networkReply();
@@ -593,13 +695,16 @@ Q_SIGNALS:
 
 private Q_SLOTS:
     void readResponse(QNetworkReply *reply);
+    void responseParsed();
 
 private:
     QNetworkAccessManager networkMgr;
+    QQueue<QFutureWatcher<QtSoapMessage> *> parsing;
     QPointer<QNetworkReply> networkRep;
     QUrl url;
     QString soapAction;
     QtSoapMessage soapResponse;
+    qint64 soapResponseSize;
 };
 
 #endif
@@ -0,0 +1,780 @@
+/*
+ * Copyright (c) 2013, 2014 Jesús Pérez (a) Chuso <kde at chuso dot net>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Library General Public License as published
+ * by the Free Software Foundation; either version 2 of the License or
+ * ( at your option ) version 3 or, at the discretion of KDE e.V.
+ * ( which shall act as a proxy as in section 14 of the GPLv3 ), any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "qtsoapxml.h"
+#include "qtsoap.h"
+
+#include <QHash>
+#include <QPair>
+#include <QVector>
+#include <string.h>
+
+// SSE2 is part of the x86-64 baseline, AVX2 is only used after
+// checking the running CPU for it.
+#if defined(__GNUC__) && defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+#  define QTSOAP_XML_SSE2
+#  include <emmintrin.h>
+#  if defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)
+#    define QTSOAP_XML_AVX2
+#    include <immintrin.h>
+#  endif
+#endif
+
+namespace
+{
+  const char *findFirstOfScalar(const char *p, const char *end, char c0, char c1, char c2)
+  {
+    for (; p < end; ++p)
+      if ((*p == c0) || (*p == c1) || (*p == c2))
+        return p;
+    return end;
+  }
+
+#ifdef QTSOAP_XML_SSE2
+  const char *findFirstOfSse2(const char *p, const char *end, char c0, char c1, char c2)
+  {
+    const __m128i v0 = _mm_set1_epi8(c0);
+    const __m128i v1 = _mm_set1_epi8(c1);
+    const __m128i v2 = _mm_set1_epi8(c2);
+    while (end - p >= 16)
+    {
+      const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+      const __m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, v0),
+                                                     _mm_cmpeq_epi8(chunk, v1)),
+                                        _mm_cmpeq_epi8(chunk, v2));
+      const int mask = _mm_movemask_epi8(hits);
+      if (mask != 0)
+        return p + __builtin_ctz(mask);
+      p += 16;
+    }
+    return findFirstOfScalar(p, end, c0, c1, c2);
+  }
+#endif
+
+#ifdef QTSOAP_XML_AVX2
+  __attribute__((target("avx2")))
+  const char *findFirstOfAvx2(const char *p, const char *end, char c0, char c1, char c2)
+  {
+    const __m256i v0 = _mm256_set1_epi8(c0);
+    const __m256i v1 = _mm256_set1_epi8(c1);
+    const __m256i v2 = _mm256_set1_epi8(c2);
+    while (end - p >= 32)
+    {
+      const __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+      const __m256i hits = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, v0),
+                                                           _mm256_cmpeq_epi8(chunk, v1)),
+                                           _mm256_cmpeq_epi8(chunk, v2));
+      const unsigned int mask = _mm256_movemask_epi8(hits);
+      if (mask != 0)
+        return p + __builtin_ctz(mask);
+      p += 32;
+    }
+    return findFirstOfSse2(p, end, c0, c1, c2);
+  }
+#endif
+
+  typedef const char *(*FindFirstOf)(const char *, const char *, char, char, char);
+
+  FindFirstOf selectFindFirstOf()
+  {
+#ifdef QTSOAP_XML_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+      return findFirstOfAvx2;
+#endif
+#ifdef QTSOAP_XML_SSE2
+    return findFirstOfSse2;
+#else
+    return findFirstOfScalar;
+#endif
+  }
+
+  const FindFirstOf findFirstOfImpl = selectFindFirstOf();
+
+  int utf8Encode(unsigned int c, char *out)
+  {
+    if (c < 0x80)
+    {
+      out[0] = char(c);
+      return 1;
+    }
+    if (c < 0x800)
+    {
+      out[0] = char(0xC0 | (c >> 6));
+      out[1] = char(0x80 | (c & 0x3F));
+      return 2;
+    }
+    if (c < 0x10000)
+    {
+      out[0] = char(0xE0 | (c >> 12));
+      out[1] = char(0x80 | ((c >> 6) & 0x3F));
+      out[2] = char(0x80 | (c & 0x3F));
+      return 3;
+    }
+    out[0] = char(0xF0 | (c >> 18));
+    out[1] = char(0x80 | ((c >> 12) & 0x3F));
+    out[2] = char(0x80 | ((c >> 6) & 0x3F));
+    out[3] = char(0x80 | (c & 0x3F));
+    return 4;
+  }
+
+  // Decodes the entity reference starting right after the '&' at p.
+  // Returns the position after the ';' or 0 if it is not valid.
+  const char *decodeEntity(const char *p, const char *end, char *out, int *written)
+  {
+    const char *semicolon = static_cast<const char *>(memchr(p, ';', qMin<long>(end - p, 12)));
+    if (semicolon == 0)
+      return 0;
+    const int len = semicolon - p;
+
+    if (p[0] == '#')
+    {
+      unsigned int c = 0;
+      const bool hex = (len > 1) && ((p[1] == 'x') || (p[1] == 'X'));
+      const char *digit = p + (hex? 2 : 1);
+      if (digit == semicolon)
+        return 0;
+      for (; digit < semicolon; ++digit)
+      {
+        unsigned int d;
+        if ((*digit >= '0') && (*digit <= '9'))
+          d = *digit - '0';
+        else if (hex && (*digit >= 'a') && (*digit <= 'f'))
+          d = *digit - 'a' + 10;
+        else if (hex && (*digit >= 'A') && (*digit <= 'F'))
+          d = *digit - 'A' + 10;
+        else
+          return 0;
+        c = c * (hex? 16 : 10) + d;
+        if (c > 0x10FFFF)
+          return 0;
+      }
+      if ((c == 0) || ((c >= 0xD800) && (c <= 0xDFFF)))
+        return 0;
+      *written = utf8Encode(c, out);
+      return semicolon + 1;
+    }
+
+    char c;
+    if ((len == 2) && (p[0] == 'l') && (p[1] == 't'))
+      c = '<';
+    else if ((len == 2) && (p[0] == 'g') && (p[1] == 't'))
+      c = '>';
+    else if ((len == 3) && (memcmp(p, "amp", 3) == 0))
+      c = '&';
+    else if ((len == 4) && (memcmp(p, "quot", 4) == 0))
+      c = '"';
+    else if ((len == 4) && (memcmp(p, "apos", 4) == 0))
+      c = '\'';
+    else
+      return 0;
+    *out = c;
+    *written = 1;
+    return semicolon + 1;
+  }
+
+  // Decodes one multi-byte UTF-8 sequence starting at p. Returns the
+  // position after it or 0 if it is malformed, overlong, a surrogate
+  // or beyond U+10FFFF.
+  const char *utf8DecodeSequence(const char *p, const char *end, ushort **out)
+  {
+    const uchar lead = uchar(*p);
+    int extra;
+    unsigned int c;
+    unsigned int min;
+    if ((lead & 0xE0) == 0xC0)
+    {
+      extra = 1;
+      c = lead & 0x1F;
+      min = 0x80;
+    }
+    else if ((lead & 0xF0) == 0xE0)
+    {
+      extra = 2;
+      c = lead & 0x0F;
+      min = 0x800;
+    }
+    else if ((lead & 0xF8) == 0xF0)
+    {
+      extra = 3;
+      c = lead & 0x07;
+      min = 0x10000;
+    }
+    else
+      return 0;
+
+    if (end - p <= extra)
+      return 0;
+    for (int i = 1; i <= extra; ++i)
+    {
+      const uchar next = uchar(p[i]);
+      if ((next & 0xC0) != 0x80)
+        return 0;
+      c = (c << 6) | (next & 0x3F);
+    }
+    if ((c < min) || (c > 0x10FFFF) || ((c >= 0xD800) && (c <= 0xDFFF)))
+      return 0;
+
+    if (c >= 0x10000)
+    {
+      c -= 0x10000;
+      *(*out)++ = ushort(0xD800 | (c >> 10));
+      *(*out)++ = ushort(0xDC00 | (c & 0x3FF));
+    }
+    else
+      *(*out)++ = ushort(c);
+    return p + extra + 1;
+  }
+
+  // Converts UTF-8 to UTF-16. out needs room for end - begin units,
+  // which is enough since no sequence produces more units than bytes.
+  // Returns the number of units written or -1 on invalid input.
+  int utf8ToUtf16(const char *begin, const char *end, ushort *out)
+  {
+    ushort *o = out;
+    const char *p = begin;
+    while (p < end)
+    {
+#ifdef QTSOAP_XML_SSE2
+      // Widen ASCII sixteen bytes at a time
+      const __m128i zero = _mm_setzero_si128();
+      while (end - p >= 16)
+      {
+        const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        const int mask = _mm_movemask_epi8(chunk);
+        if (mask != 0)
+        {
+          const int ascii = __builtin_ctz(mask);
+          for (int i = 0; i < ascii; ++i)
+            o[i] = uchar(p[i]);
+          o += ascii;
+          p += ascii;
+          break;
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(o), _mm_unpacklo_epi8(chunk, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(o + 8), _mm_unpackhi_epi8(chunk, zero));
+        o += 16;
+        p += 16;
+      }
+#endif
+      while ((p < end) && (uchar(*p) < 0x80))
+        *o++ = uchar(*p++);
+      if (p < end)
+      {
+        p = utf8DecodeSequence(p, end, &o);
+        if (p == 0)
+          return -1;
+      }
+    }
+    return o - out;
+  }
+}
+
+/*!
+ * \class QtSoapXmlScanner
+ * \brief Byte-level helpers used by QtSoapXmlReader to scan UTF-8 XML in bulk.
+ *
+ * Markup characters are searched for 16 or 32 bytes at a time using
+ * SSE2 or, when the running CPU supports it, AVX2. Other builds use a
+ * plain byte loop. ASCII runs are widened to UTF-16 16 bytes at a time
+ * as well.
+ */
+
+/*!
+ * Finds the first occurrence of any of three bytes.
+ * \param[in] begin First byte to look at.
+ * \param[in] end One past the last byte to look at.
+ * \param[in] c0 Byte to look for.
+ * \param[in] c1 Byte to look for.
+ * \param[in] c2 Byte to look for.
+ * \return Position of the first matching byte or end if there is none.
+ */
+const char *QtSoapXmlScanner::findFirstOf(const char *begin, const char *end, char c0, char c1, char c2)
+{
+  return findFirstOfImpl(begin, end, c0, c1, c2);
+}
+
+/*!
+ * Copies character data replacing entity and character references
+ * with the characters they stand for and line breaks with '\\n'.
+ * Runs of plain text between references are copied in one go.
+ * \param[in] begin First byte of the character data.
+ * \param[in] end One past the last byte of the character data.
+ * \param[out] out Buffer with room for at least end - begin bytes.
+ * \return Number of bytes written to out, or -1 if an unknown or malformed reference was found.
+ */
+int QtSoapXmlScanner::unescape(const char *begin, const char *end, char *out)
+{
+  char *o = out;
+  const char *p = begin;
+  while (p < end)
+  {
+    const char *special = findFirstOfImpl(p, end, '&', '\r', '&');
+    memcpy(o, p, special - p);
+    o += special - p;
+    if (special == end)
+      break;
+
+    if (*special == '\r')
+    {
+      *o++ = '\n';
+      p = special + 1;
+      if ((p < end) && (*p == '\n'))
+        ++p;
+    }
+    else
+    {
+      int written = 0;
+      p = decodeEntity(special + 1, end, o, &written);
+      if (p == 0)
+        return -1;
+      o += written;
+    }
+  }
+  return o - out;
+}
+
+/*!
+ * Converts UTF-8 to a QString, rejecting malformed input instead of
+ * replacing it. The string is allocated once and filled in place.
+ * \param[in] begin First byte to convert.
+ * \param[in] end One past the last byte to convert.
+ * \param[out] out String to store the result in. It is left untouched on error.
+ * \return true if the input was valid UTF-8, false otherwise.
+ */
+bool QtSoapXmlScanner::toUtf16(const char *begin, const char *end, QString *out)
+{
+  QString s;
+  s.resize(end - begin);
+  const int len = utf8ToUtf16(begin, end, reinterpret_cast<ushort *>(s.data()));
+  if (len < 0)
+    return false;
+  s.resize(len);
+  *out = s;
+  return true;
+}
+
+/*!
+ * \return Name of the scanning code path selected for this CPU.
+ */
+const char *QtSoapXmlScanner::implementation()
+{
+#ifdef QTSOAP_XML_AVX2
+  if (findFirstOfImpl == findFirstOfAvx2)
+    return "avx2";
+#endif
+#ifdef QTSOAP_XML_SSE2
+  if (findFirstOfImpl == findFirstOfSse2)
+    return "sse2";
+#endif
+  return "scalar";
+}
+
+namespace
+{
+  inline bool isXmlSpace(char c)
+  {
+    return (c == ' ') || (c == '\t') || (c == '\n') || (c == '\r');
+  }
+
+  inline bool isNameEnd(char c)
+  {
+    return isXmlSpace(c) || (c == '/') || (c == '>') || (c == '=');
+  }
+
+  struct OpenElement
+  {
+    QString tag;
+    int namespaceMark;
+  };
+
+  struct PendingAttribute
+  {
+    QString name;
+    QString value;
+  };
+
+  /*
+   * Builds a QDomDocument from a UTF-8 buffer the same way
+   * QDomDocument::setContent() does with namespace processing
+   * enabled. Anything outside the plain subset SOAP servers send
+   * (a DOCTYPE, another encoding, undeclared prefixes, malformed
+   * markup) makes it give up so the caller can let QDom handle it.
+   */
+  class DomBuilder
+  {
+    public:
+      DomBuilder(const QByteArray &buffer);
+      bool build(QDomDocument *doc);
+
+    private:
+      bool readDeclaration();
+      bool readStartTag();
+      bool readEndTag();
+      bool readText();
+      bool readCData();
+      bool skipPast(const char *terminator);
+      bool decode(const char *from, const char *to, QString *out);
+      bool resolve(const QString &qname, bool isAttribute, QString *uri) const;
+      QString name(const char *from, const char *to);
+
+      const char *p;
+      const char *end;
+      QDomDocument document;
+      QDomNode current;
+      bool rootSeen;
+      QVector<OpenElement> open;
+      QVector<QPair<QString, QString> > namespaces;
+      QHash<QByteArray, QString> names;
+      QByteArray scratch;
+  };
+
+  DomBuilder::DomBuilder(const QByteArray &buffer)
+    : p(buffer.constData()), end(buffer.constData() + buffer.size()), rootSeen(false)
+  {
+  }
+
+  bool DomBuilder::build(QDomDocument *doc)
+  {
+    // Only UTF-8, with or without byte order mark, is handled here
+    if ((end - p >= 3) && (memcmp(p, "\xEF\xBB\xBF", 3) == 0))
+      p += 3;
+    if ((p == end) || (*p == '\0') || (uchar(*p) >= 0xFE))
+      return false;
+
+    QDomImplementation impl;
+    document = impl.createDocument(QString(), QString("placeholder"), QDomDocumentType());
+    document.removeChild(document.firstChild());
+    current = document;
+
+    if ((end - p >= 6) && (memcmp(p, "<?xml", 5) == 0) && isXmlSpace(p[5]) && !readDeclaration())
+      return false;
+
+    while (p < end)
+    {
+      if (*p != '<')
+      {
+        if (!readText())
+          return false;
+        continue;
+      }
+
+      ++p;
+      if (p == end)
+        return false;
+      bool ok;
+      if (*p == '/')
+      {
+        ++p;
+        ok = readEndTag();
+      }
+      else if (*p == '?')
+        ok = skipPast("?>");
+      else if ((end - p >= 3) && (memcmp(p, "!--", 3) == 0))
+        ok = skipPast("-->");
+      else if ((end - p >= 8) && (memcmp(p, "![CDATA[", 8) == 0))
+      {
+        p += 8;
+        ok = readCData();
+      }
+      else if (*p == '!')
+        ok = false;
+      else
+        ok = readStartTag();
+      if (!ok)
+        return false;
+    }
+
+    if (!rootSeen || !open.isEmpty())
+      return false;
+    *doc = document;
+    return true;
+  }
+
+  bool DomBuilder::readDeclaration()
+  {
+    const char *begin = p;
+    if (!skipPast("?>"))
+      return false;
+    const QByteArray declaration = QByteArray::fromRawData(begin, p - begin);
+    const int pos = declaration.indexOf("encoding");
+    if (pos == -1)
+      return true;
+
+    const char *q = begin + pos + 8;
+    while ((q < p) && (isXmlSpace(*q) || (*q == '=')))
+      ++q;
+    if ((q == p) || ((*q != '"') && (*q != '\'')))
+      return false;
+    const char quote = *q++;
+    const char *valueEnd = static_cast<const char *>(memchr(q, quote, p - q));
+    if (valueEnd == 0)
+      return false;
+    const int len = valueEnd - q;
+    return ((len == 5) && (qstrnicmp(q, "utf-8", 5) == 0))
+        || ((len == 4) && (qstrnicmp(q, "utf8", 4) == 0))
+        || ((len == 8) && (qstrnicmp(q, "us-ascii", 8) == 0));
+  }
+
+  bool DomBuilder::readStartTag()
+  {
+    if (rootSeen && open.isEmpty())
+      return false;
+
+    const char *nameBegin = p;
+    while ((p < end) && !isNameEnd(*p))
+      ++p;
+    if ((p == nameBegin) || (p == end))
+      return false;
+    const QString qname = name(nameBegin, p);
+
+    const int mark = namespaces.count();
+    QVector<PendingAttribute> attributes;
+    bool empty = false;
+    forever
+    {
+      while ((p < end) && isXmlSpace(*p))
+        ++p;
+      if (p == end)
+        return false;
+      if (*p == '>')
+      {
+        ++p;
+        break;
+      }
+      if (*p == '/')
+      {
+        if ((p + 1 == end) || (p[1] != '>'))
+          return false;
+        p += 2;
+        empty = true;
+        break;
+      }
+
+      const char *attrBegin = p;
+      while ((p < end) && !isNameEnd(*p))
+        ++p;
+      const char *attrEnd = p;
+      if (attrBegin == attrEnd)
+        return false;
+      while ((p < end) && isXmlSpace(*p))
+        ++p;
+      if ((p == end) || (*p != '='))
+        return false;
+      ++p;
+      while ((p < end) && isXmlSpace(*p))
+        ++p;
+      if ((p == end) || ((*p != '"') && (*p != '\'')))
+        return false;
+      const char quote = *p++;
+      const char *valueBegin = p;
+      p = QtSoapXmlScanner::findFirstOf(p, end, quote, '<', quote);
+      if ((p == end) || (*p == '<'))
+        return false;
+      QString value;
+      if (!decode(valueBegin, p, &value))
+        return false;
+      ++p;
+
+      if ((attrEnd - attrBegin == 5) && (memcmp(attrBegin, "xmlns", 5) == 0))
+        namespaces.append(qMakePair(QString(""), value));
+      else if ((attrEnd - attrBegin > 6) && (memcmp(attrBegin, "xmlns:", 6) == 0))
+        namespaces.append(qMakePair(name(attrBegin + 6, attrEnd), value));
+      else
+      {
+        PendingAttribute attribute;
+        attribute.name = name(attrBegin, attrEnd);
+        attribute.value = value;
+        attributes.append(attribute);
+      }
+    }
+
+    QString uri;
+    if (!resolve(qname, false, &uri))
+      return false;
+    QDomElement element = document.createElementNS(uri, qname);
+    foreach (const PendingAttribute &attribute, attributes)
+    {
+      if (!resolve(attribute.name, true, &uri))
+        return false;
+      element.setAttributeNS(uri, attribute.name, attribute.value);
+    }
+    current.appendChild(element);
+    rootSeen = true;
+
+    if (empty)
+      namespaces.resize(mark);
+    else
+    {
+      OpenElement o;
+      o.tag = qname;
+      o.namespaceMark = mark;
+      open.append(o);
+      current = element;
+    }
+    return true;
+  }
+
+  bool DomBuilder::readEndTag()
+  {
+    const char *nameBegin = p;
+    while ((p < end) && !isNameEnd(*p))
+      ++p;
+    if (open.isEmpty() || (name(nameBegin, p) != open.last().tag))
+      return false;
+    while ((p < end) && isXmlSpace(*p))
+      ++p;
+    if ((p == end) || (*p != '>'))
+      return false;
+    ++p;
+
+    namespaces.resize(open.last().namespaceMark);
+    open.removeLast();
+    current = current.parentNode();
+    return true;
+  }
+
+  bool DomBuilder::readText()
+  {
+    const char *begin = p;
+    p = QtSoapXmlScanner::findFirstOf(p, end, '<', '<', '<');
+
+    // Like QDom, drop text made only of whitespace
+    const char *q = begin;
+    while ((q < p) && isXmlSpace(*q))
+      ++q;
+    if (q == p)
+      return true;
+    if (open.isEmpty())
+      return false;
+
+    QString text;
+    if (!decode(begin, p, &text))
+      return false;
+    current.appendChild(document.createTextNode(text));
+    return true;
+  }
+
+  bool DomBuilder::readCData()
+  {
+    const char *begin = p;
+    if (!skipPast("]]>") || open.isEmpty())
+      return false;
+    current.appendChild(document.createCDATASection(QString::fromUtf8(begin, p - 3 - begin)));
+    return true;
+  }
+
+  bool DomBuilder::skipPast(const char *terminator)
+  {
+    const int len = qstrlen(terminator);
+    while (p < end)
+    {
+      p = static_cast<const char *>(memchr(p, terminator[0], end - p));
+      if (p == 0)
+        break;
+      if ((end - p >= len) && (memcmp(p, terminator, len) == 0))
+      {
+        p += len;
+        return true;
+      }
+      ++p;
+    }
+    p = end;
+    return false;
+  }
+
+  bool DomBuilder::decode(const char *from, const char *to, QString *out)
+  {
+    if (QtSoapXmlScanner::findFirstOf(from, to, '&', '\r', '&') == to)
+      return QtSoapXmlScanner::toUtf16(from, to, out);
+
+    scratch.resize(to - from);
+    const int len = QtSoapXmlScanner::unescape(from, to, scratch.data());
+    if (len < 0)
+      return false;
+    return QtSoapXmlScanner::toUtf16(scratch.constData(), scratch.constData() + len, out);
+  }
+
+  bool DomBuilder::resolve(const QString &qname, bool isAttribute, QString *uri) const
+  {
+    const int colon = qname.indexOf(':');
+    if (colon == -1)
+    {
+      // Unprefixed attributes have no namespace
+      *uri = QString("");
+      if (isAttribute)
+        return true;
+      for (int i = namespaces.count() - 1; i >= 0; --i)
+        if (namespaces.at(i).first.isEmpty())
+        {
+          *uri = namespaces.at(i).second;
+          break;
+        }
+      return true;
+    }
+
+    const QStringRef prefix = qname.leftRef(colon);
+    if (prefix == QLatin1String("xml"))
+    {
+      *uri = XML_NAMESPACE;
+      return true;
+    }
+    for (int i = namespaces.count() - 1; i >= 0; --i)
+      if (namespaces.at(i).first == prefix)
+      {
+        *uri = namespaces.at(i).second;
+        return true;
+      }
+    return false;
+  }
+
+  QString DomBuilder::name(const char *from, const char *to)
+  {
+    const QByteArray key = QByteArray::fromRawData(from, to - from);
+    QHash<QByteArray, QString>::const_iterator it = names.constFind(key);
+    if (it != names.constEnd())
+      return *it;
+
+    const QString n = QString::fromUtf8(from, to - from);
+    names.insert(QByteArray(from, to - from), n);
+    return n;
+  }
+}
+
+/*!
+ * \class QtSoapXmlReader
+ * \brief Fast path used by QtSoapMessage to turn a SOAP response into a QDomDocument.
+ *
+ * The resulting document is equivalent to what QDomDocument::setContent()
+ * produces with namespace processing enabled, but tokenizing and
+ * unescaping are done with QtSoapXmlScanner over the raw UTF-8 bytes.
+ */
+
+/*!
+ * Parses a UTF-8 XML document.
+ * \param[in] buffer Raw XML document.
+ * \param[out] doc Document to store the result in. It is left untouched if parsing fails.
+ * \return true if the document was parsed, false if it uses features this reader does not handle or is not well-formed; QDomDocument::setContent() should be used then.
+ */
+bool QtSoapXmlReader::read(const QByteArray &buffer, QDomDocument *doc)
+{
+  DomBuilder builder(buffer);
+  return builder.build(doc);
+}
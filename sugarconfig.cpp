@@ -121,4 +121,55 @@ void SugarConfig::setUpdateInterval(unsigned int i)
 void SugarConfig::setUpdateUnits(UpdateUnits u)
 {
     ui->updateUnits->setCurrentIndex(u);
-}
\ No newline at end of file
+}
+
+/*!
+ * \return Server-side filter of each module, empty for modules without one.
+ */
+QMap<QString, QString> SugarConfig::filters()
+{
+    QMap<QString, QString> f;
+    for (int row = 0; row < ui->filters->rowCount(); row++)
+        f[ui->filters->item(row, 0)->text()] = ui->filters->item(row, 1)->text();
+    return f;
+}
+
+/*!
+ * Sets the modules and their server-side filters in the configuration dialog box.
+ * \param[in] f Filter of each module.
+ */
+void SugarConfig::setFilters(const QMap<QString, QString> &f)
+{
+    ui->filters->setRowCount(f.count());
+    int row = 0;
+    for (QMap<QString, QString>::const_iterator filter = f.constBegin(); filter != f.constEnd(); filter++, row++)
+    {
+        QTableWidgetItem *module = new QTableWidgetItem(filter.key());
+        module->setFlags(module->flags() & ~Qt::ItemIsEditable);
+        ui->filters->setItem(row, 0, module);
+        ui->filters->setItem(row, 1, new QTableWidgetItem(filter.value()));
+        ui->filters->setItem(row, 2, new QTableWidgetItem());
+    }
+}
+
+/*!
+ * \return Comma-separated fields requested for each module, empty for modules requesting all of them.
+ */
+QMap<QString, QString> SugarConfig::fields()
+{
+    QMap<QString, QString> f;
+    for (int row = 0; row < ui->filters->rowCount(); row++)
+        f[ui->filters->item(row, 0)->text()] = ui->filters->item(row, 2)->text();
+    return f;
+}
+
+/*!
+ * Sets the fields requested for each module in the configuration dialog box.
+ * Must be called after setFilters(), which fills in the modules.
+ * \param[in] f Comma-separated fields of each module.
+ */
+void SugarConfig::setFields(const QMap<QString, QString> &f)
+{
+    for (int row = 0; row < ui->filters->rowCount(); row++)
+        ui->filters->item(row, 2)->setText(f.value(ui->filters->item(row, 0)->text()));
+}
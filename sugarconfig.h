@@ -22,6 +22,7 @@
 #define SUGARCONFIG_H
 
 #include <QDialog>
+#include <QMap>
 
 enum UpdateUnits { Seconds, Minutes };
 namespace Ui {
@@ -40,11 +41,15 @@ public:
     QString password();
     unsigned char updateInterval();
     UpdateUnits updateUnits();
+    QMap<QString, QString> filters();
+    QMap<QString, QString> fields();
     void setUrl(QString s);
     void setUsername(QString s);
     void setPassword(QString s);
     void setUpdateInterval(unsigned int i);
     void setUpdateUnits(UpdateUnits u);
+    void setFilters(const QMap<QString, QString> &f);
+    void setFields(const QMap<QString, QString> &f);
 
 private:
     Ui::SugarConfig *ui;
@@ -24,18 +24,19 @@
 
 #include "settings.h"
 #include "settingsadaptor.h"
+#include "sugardatetime.h"
+#include "sugarremoteid.h"
 
 #include <QtDBus/QDBusConnection>
 
 #include <KWindowSystem>
-#include <KABC/Addressee>
 #include <KCalCore/Todo>
-#include <KCalCore/Event>
 #include <Akonadi/ItemFetchJob>
 #include <Akonadi/ItemCreateJob>
 #include <Akonadi/ItemModifyJob>
 #include <Akonadi/ItemDeleteJob>
 #include <Akonadi/ItemFetchScope>
+#include <Akonadi/ItemSync>
 #include <Akonadi/CollectionFetchJob>
 #include <Akonadi/CollectionFetchScope>
 #include <Akonadi/CollectionModifyJob>
@@ -43,7 +44,12 @@
 #include <KLocalizedString>
 #include <Akonadi/AttributeFactory>
 #include <QMessageBox>
+#include <QtConcurrentRun>
+#include <QtConcurrentMap>
+#include <QThreadPool>
+#include <QFutureWatcher>
 #include "datetimeattribute.h"
+#include "synccheckpointattribute.h"
 
 using namespace Akonadi;
 
@@ -56,69 +62,9 @@ using namespace Akonadi;
  * Constructs a new SugarCrmSource object.
  */
 SugarCrmResource::SugarCrmResource( const QString &id )
-  : ResourceBase( id )
-{
-  // Populate Map of valid modules and required fields for each module
-  module *modinfo = new module;
-  modinfo->fields
-    << "id" << "salutation" << "first_name" << "last_name" << "birthdate"
-    << "email1" << "email2"
-    << "phone_home" << "phone_mobile" << "phone_work" << "phone_fax" << "phone_other"
-    << "primary_address_street" << "primary_address_city" << "primary_address_state" << "primary_address_postalcode" << "primary_address_country"
-    << "alt_address_street" << "alt_address_city" << "alt_address_state" << "alt_address_postalcode" << "alt_address_country"
-    << "account_name" << "title" << "department" << "description";
-  // Remaining available fields:
-  // date_entered, date_modified, modified_user_id, modified_by_name,
-  // created_by, created_by_name, deleted, assigned_user_id,
-  // assigned_user_name, do_not_call, assistant, assistant_phone,
-  // lead_source, account_id, opportunity_role_fields, reports_to_id
-  // report_to_name, campaign_id, campaign_name, c_accept_status_fields
-  // m_accept_status_fields
-  modinfo->mimes << "text/directory";
-  modinfo->payload_function = &SugarCrmResource::contactPayload;
-  modinfo->soap_function = &SugarCrmResource::contactSoap;
-  SugarCrmResource::Modules["Contacts"] = SugarCrmResource::Modules["Leads"] = *modinfo;
-  // TODO Do the same with task statuses
-  phones["phone_home"]   = KABC::PhoneNumber::Home;
-  phones["phone_mobile"] = KABC::PhoneNumber::Cell;
-  phones["phone_work"]   = KABC::PhoneNumber::Work;
-  phones["phone_fax"]    = KABC::PhoneNumber::Fax;
-  delete modinfo;
-
-  modinfo = new module;
-  modinfo->fields << "id" << "name" << "description" << "status" << "priority" << "date_entered" << "date_due_flag" << "date_due" << "date_start_flag" << "date_start";
-  modinfo->mimes << KCalCore::Todo::todoMimeType();
-  modinfo->payload_function = &SugarCrmResource::taskPayload;
-  modinfo->soap_function = &SugarCrmResource::taskSoap;
-  SugarCrmResource::Modules["Tasks"] = *modinfo;
-  delete modinfo;
-
-  modinfo = new module;
-  modinfo->fields << "id" << "name" << "description" << "case_number" << "status" << "priority" << "date_entered" << "date_due_flag" << "date_due" << "date_start_flag" << "date_start";
-  modinfo->mimes << KCalCore::Todo::todoMimeType();
-  // TODO: where status is active
-  modinfo->payload_function = &SugarCrmResource::taskPayload;
-  modinfo->soap_function = &SugarCrmResource::taskSoap;
-  SugarCrmResource::Modules["Cases"] = *modinfo;
-  delete modinfo;
-
-  modinfo = new module;
-  modinfo->fields << "id" << "name" << "description" << "percent_complete" << "project_phase" << "date_entered" << "date_ending" << "date_starting";
-  modinfo->mimes << KCalCore::Todo::todoMimeType();
-  // TODO: where status is active
-  modinfo->payload_function = &SugarCrmResource::projectPayload;
-  modinfo->soap_function = &SugarCrmResource::projectSoap;
-  SugarCrmResource::Modules["Project"] = *modinfo;
-  delete modinfo;
-
-  modinfo = new module;
-  modinfo->fields << "id" << "name" << "status" << "quantity" << "date_start" << "related_type" << "related_id" << "date_entered";
-  modinfo->mimes << KCalCore::Event::eventMimeType();
-  // TODO: where status is active
-  modinfo->payload_function = &SugarCrmResource::bookingPayload;
-  modinfo->soap_function = &SugarCrmResource::bookingSoap;
-  SugarCrmResource::Modules["Booking"] = *modinfo;
-  delete modinfo;
+  : ResourceBase( id ), pending_updates(0), clock_offset(0), pending_reconciles(0), reconcile_scheduled(false), metadata(id)
+{
+  registerModules();
 
   new SettingsAdaptor( Settings::self() );
   QDBusConnection::sessionBus().registerObject( QLatin1String( "/Settings" ),
@@ -126,6 +72,21 @@ SugarCrmResource::SugarCrmResource( const QString &id )
 
   changeRecorder()->itemFetchScope().fetchFullPayload();
   AttributeFactory::registerAttribute<DateTimeAttribute>();
+  AttributeFactory::registerAttribute<SyncCursorAttribute>();
+  AttributeFactory::registerAttribute<SyncCheckpointAttribute>();
+
+  // Listings are delivered page by page and every page is kept even if
+  // the listing does not finish, so it can be resumed
+  setItemStreamingEnabled(true);
+  setItemTransactionMode(ItemSync::MultipleTransactions);
+  connect(this, SIGNAL(retrieveNextItemSyncBatch(int)), this, SLOT(itemSyncBatchCommitted()));
+
+  soap = newSoap();
+  selectFields();
+
+  // Payload conversion and SOAP parsing share the global pool
+  if (Settings::self()->conversionThreads() > 0)
+    QThreadPool::globalInstance()->setMaxThreadCount(Settings::self()->conversionThreads());
 
   CollectionFetchJob *job = new Akonadi::CollectionFetchJob(Akonadi::Collection::root(), Akonadi::CollectionFetchJob::Recursive, this);
   job->fetchScope().setResource(identifier());
@@ -151,16 +112,27 @@ void SugarCrmResource::resourceCollectionsRetrieved(KJob *job)
   }
   foreach (Collection c, fetchJob->collections())
   {
-    resource_collection* rc = new resource_collection;
-    rc->id = c.id();
-    rc->last_sync = NULL;
-    if (c.hasAttribute<DateTimeAttribute>())
-      rc->last_sync = new QDateTime(c.attribute<DateTimeAttribute>()->value());
-    resource_collections[c.remoteId()] = *rc;
-    delete rc;
+    resource_collection rc;
+    rc.id = c.id();
+    if (c.hasAttribute<SyncCursorAttribute>())
+    {
+      rc.cursor = *(c.attribute<SyncCursorAttribute>());
+      clock_offset = rc.cursor.clockOffset();
+    }
+    else if (c.hasAttribute<DateTimeAttribute>())
+    {
+      // Collections synchronized before cursors existed only have a time,
+      // entries modified at that very time are fetched again
+      QString last_sync = c.attribute<DateTimeAttribute>()->value().toString("yyyy-MM-dd hh:mm:ss");
+      rc.cursor = SyncCursorAttribute(last_sync, QString(), 0, 0);
+    }
+    resource_collections[c.remoteId()] = rc;
   }
   if (resource_collections.count() > 0)
+  {
     QTimer::singleShot(Settings::self()->updateInterval()*1000, this, SLOT(update()));
+    scheduleReconcile();
+  }
 }
 
 /*!
@@ -169,102 +141,465 @@ void SugarCrmResource::resourceCollectionsRetrieved(KJob *job)
  */
 void SugarCrmResource::update()
 {
+  // Previous pass is still running, it will schedule the next one
+  if (pending_updates > 0)
+    return;
+
+  // Keep track of how far the server clock is, it does not need a session
+  SugarReply *timeReply = soap->getServerTime();
+  timeReply->setProperty("sent", QDateTime::currentDateTime().toUTC());
+  connect(timeReply, SIGNAL(finished(SugarReply*)), this, SLOT(serverTimeReceived(SugarReply*)));
+
   QMapIterator<QString, resource_collection> rc(resource_collections);
-  SugarSoap soap(Settings::self()->url().url());
   while (rc.hasNext())
   {
     rc.next();
-    if (rc.value().last_sync == NULL) continue;
-    QDateTime *last_sync = rc.value().last_sync;
-    QVector <QMap<QString, QString> > *entries = soap.getEntries(rc.key(), rc.value().last_sync);
-    int num_entries = entries->count();
-    for (
-      int i = 0;
-      i<num_entries;
-      i++
-    )
+    const SyncCursorAttribute &cursor = rc.value().cursor;
+    if (cursor.isNull()) continue;
+    // The cursor only moves once every change has been applied
+    module_update &state = updates[rc.key()];
+    state = module_update();
+    state.cursor = cursor;
+    state.hash = schemaHash(rc.key());
+    state.pending = 0;
+    state.failed = false;
+    state.pending_checks = 0;
+    pending_updates++;
+
+    // Items lack the fields that were not requested before or hold the
+    // entries a different filter let in, so the module is fetched again
+    if ((cursor.schemaHash() != 0) && (cursor.schemaHash() != state.hash))
     {
-      QMap<QString, QString> entry = entries->at(i);
-      Item item(Modules[rc.key()].mimes.first());
-      item.setRemoteId(entry["id"] + "@" + rc.key());
-      Collection c(rc.value().id);
-
-      // We need to check first if item actually exists in Akonadi
-      ItemFetchJob *itemJob = new ItemFetchJob(item);
-      bool itemFound = false;
-      QEventLoop loop;
-      connect(itemJob, SIGNAL(finished(KJob*)), &loop, SLOT(quit()));
-      itemJob->setCollection(c);
-      loop.exec();
-      if ((itemJob->error() == 0) && (itemJob->items().count() == 1))
-      {
-        itemFound = true;
-        item = itemJob->items().first();
-      }
-      delete itemJob;
+      // Items are taken first, so any item the listing does not return
+      // afterwards does not match the filter any more
+      ItemFetchJob *job = new ItemFetchJob(Collection(rc.value().id), this);
+      job->setProperty("module", rc.key());
+      connect(job, SIGNAL(result(KJob*)), this, SLOT(resyncItemsFetched(KJob*)));
+      state.pending++;
+      continue;
+    }
 
-      if ((entry["deleted"] == "1") && (itemFound))
-      {
-        ItemDeleteJob *itemJob = new ItemDeleteJob(item);
-        QEventLoop loop;
-        connect(itemJob, SIGNAL(finished(KJob*)), &loop, SLOT(quit()));
-        loop.exec();
-        if (itemJob->error() != 0)
-          // TODO If it can't find item, error should probably be ignored.
-          qDebug("Unable to delete item %s: %s", entry["id"].toLatin1().constData(), itemJob->errorString().toLatin1().constData());
-        delete itemJob;
-      }
-      else if (QDateTime::fromString(entry["date_entered"], Qt::ISODate) <= *(rc.value().last_sync))
-      {
-        if (itemFound)
-        {
-          // Modification
-          QHash<QString, QString> *soapItem = soap.getEntry(rc.key(), entry["id"]);
-          Item newItem = (this->*SugarCrmResource::Modules[rc.key()].payload_function)(*soapItem, item);
-          delete soapItem;
-          newItem.setRemoteId(item.remoteId());
-          newItem.setParentCollection(item.parentCollection());
-          ItemModifyJob *itemJob = new ItemModifyJob(newItem);
-          QEventLoop loop;
-          connect(itemJob, SIGNAL(finished(KJob*)), &loop, SLOT(quit()));
-          loop.exec();
-          if (itemJob->error() != 0)
-            qDebug("Unable to modify item %s: %s", entry["id"].toLatin1().constData(), itemJob->errorString().toLatin1().constData());
-          delete itemJob;
-        }
-      }
-      else
+    QString filter = moduleFilter(rc.key());
+    SugarReply *reply = soap->getEntries(rc.key(), cursor.lastModified(), cursor.lastId(), true, filter);
+    reply->setProperty("last_sync", cursor.lastModified());
+    connect(reply, SIGNAL(finished(SugarReply*)), this, SLOT(updateEntriesReceived(SugarReply*)));
+    state.pending++;
+
+    if (!filter.isEmpty())
+    {
+      // Entries that changed so that they no longer match the filter
+      // have to leave Akonadi as if they had been deleted
+      reply = soap->getEntries(rc.key(), cursor.lastModified(), cursor.lastId(), false, "NOT (" + filter + ")");
+      reply->setProperty("excluded", true);
+      connect(reply, SIGNAL(finished(SugarReply*)), this, SLOT(updateEntriesReceived(SugarReply*)));
+      state.pending++;
+    }
+  }
+  if (pending_updates == 0)
+    QTimer::singleShot(Settings::self()->updateInterval()*1000, this, SLOT(update()));
+}
+
+/*!
+ * Records how far ahead the server clock is from the local one.
+ * \param[in] reply Reply to the getServerTime() request issued by update().
+ */
+void SugarCrmResource::serverTimeReceived(SugarReply *reply)
+{
+  reply->deleteLater();
+  if ((reply->hasError()) || (!reply->time().isValid()))
+    return;
+
+  // Half the round trip is the best guess of when the server answered
+  QDateTime sent = reply->property("sent").toDateTime();
+  QDateTime received = QDateTime::currentDateTime().toUTC();
+  QDateTime local = sent.addMSecs(sent.msecsTo(received) / 2);
+  clock_offset = local.secsTo(reply->time());
+}
+
+/*!
+ * Lists every entry of a module that matches its filter once the items of
+ * its collection are known. Pages are applied as they arrive, so the
+ * module is never held in memory at once.
+ * \param[in] job Job that fetched the items of the module collection.
+ */
+void SugarCrmResource::resyncItemsFetched(KJob *job)
+{
+  QString mod = job->property("module").toString();
+  module_update &state = updates[mod];
+  if (job->error() != 0)
+  {
+    qDebug("Unable to fetch %s again: %s", mod.toLatin1().constData(), job->errorString().toLatin1().constData());
+    state.failed = true;
+  }
+  else
+  {
+    state.local = qobject_cast<ItemFetchJob*>(job)->items();
+    SugarReply *reply = soap->getEntryPages(mod, moduleFilter(mod), true);
+    reply->setProperty("last_sync", state.cursor.lastModified());
+    reply->setProperty("resync", true);
+    connect(reply, SIGNAL(pageReceived(SugarReply*)), this, SLOT(updatePageReceived(SugarReply*)));
+    connect(reply, SIGNAL(finished(SugarReply*)), this, SLOT(updateEntriesReceived(SugarReply*)));
+    state.pending++;
+  }
+  finishUpdateStep(mod);
+}
+
+/*!
+ * Applies a page of the entries of a module being fetched again and
+ * keeps their ids.
+ * \param[in] reply Reply to the getEntryPages() request issued by resyncItemsFetched().
+ */
+void SugarCrmResource::updatePageReceived(SugarReply *reply)
+{
+  QString mod = reply->module();
+  if ((!resource_collections.contains(mod)) || (resource_collections[mod].cursor.isNull()))
+    return;
+  QVector<SugarRecord> entries = reply->entries();
+  QVector<QString> &listed = updates[mod].listed;
+  listed.reserve(listed.count() + entries.count());
+  for (int i=0; i<entries.count(); i++)
+    listed.append(entries.at(i)[SugarSchema::Id]);
+  applyUpdatedEntries(mod, entries, reply->property("last_sync").toString());
+}
+
+/*!
+ * Receives the entries of a module that changed since last synchronization
+ * and converts them to Akonadi items. Entries that no longer match the
+ * filter and, once the module has been fetched again, items that were
+ * not listed are removed from the collection instead.
+ * \param[in] reply Reply to a getEntries() request issued by update() or
+ * checkUnlistedItems(), or to the getEntryPages() request issued by
+ * resyncItemsFetched().
+ */
+void SugarCrmResource::updateEntriesReceived(SugarReply *reply)
+{
+  reply->deleteLater();
+  QString mod = reply->module();
+  module_update &state = updates[mod];
+  if (reply->hasError())
+    state.failed = true;
+  else if ((resource_collections.contains(mod)) && (!resource_collections[mod].cursor.isNull()))
+  {
+    if (reply->property("resync").toBool())
+      checkUnlistedItems(mod);
+    else if (reply->property("check").toBool())
+    {
+      QVector<SugarRecord> entries = reply->entries();
+      for (int i=0; i<entries.count(); i++)
+        state.stale.remove(entries.at(i)[SugarSchema::Id]);
+      if ((--state.pending_checks == 0) && (!state.failed))
+        removeUpdatedItems(mod, state.stale.values().toVector());
+    }
+    else if (reply->property("excluded").toBool())
+    {
+      // Only their ids are needed, and only the items of the collection
+      // that have one of them are removed
+      QVector<SugarRecord> entries = reply->entries();
+      for (int i=0; i<entries.count(); i++)
+        state.excluded.append(entries.at(i)[SugarSchema::Id]);
+      if (!state.excluded.isEmpty())
       {
-        // The item may be already in Akonadi if SugarCRM is telling us
-        // about a item that has been created by Akonadi
-        if (!itemFound)
-        {
-          // Addition
-          QHash<QString, QString> *soapItem = soap.getEntry(rc.key(), entry["id"]);
-          Item newItem = (this->*SugarCrmResource::Modules[rc.key()].payload_function)(*soapItem, item);
-          delete soapItem;
-          newItem.setRemoteId(item.remoteId());
-          newItem.setParentCollection(item.parentCollection());
-          ItemCreateJob *itemJob = new ItemCreateJob(newItem, c, this);
-          QEventLoop loop;
-          connect(itemJob, SIGNAL(finished(KJob*)), &loop, SLOT(quit()));
-          loop.exec();
-          if (itemJob->error() != 0)
-            qDebug("Unable to add item %s: %s", entry["id"].toLatin1().constData(), itemJob->errorString().toLatin1().constData());
-          delete itemJob;
-        }
+        ItemFetchJob *job = new ItemFetchJob(Collection(resource_collections[mod].id), this);
+        job->setProperty("module", mod);
+        connect(job, SIGNAL(result(KJob*)), this, SLOT(excludedItemsFetched(KJob*)));
+        state.pending++;
       }
-      last_sync = new QDateTime(QDateTime::fromString(entry["date_modified"], Qt::ISODate));
     }
-    delete entries;
-    if (*last_sync > *(rc.value().last_sync))
+    else
+      applyUpdatedEntries(mod, reply->entries(), reply->property("last_sync").toString());
+  }
+  finishUpdateStep(mod);
+}
+
+/*!
+ * Removes the items of the entries that no longer match the filter of a
+ * module once the items of its collection are known.
+ * \param[in] job Job that fetched the items of the module collection.
+ */
+void SugarCrmResource::excludedItemsFetched(KJob *job)
+{
+  QString mod = job->property("module").toString();
+  module_update &state = updates[mod];
+  if (job->error() != 0)
+  {
+    qDebug("Unable to remove excluded items: %s", job->errorString().toLatin1().constData());
+    state.failed = true;
+  }
+  else
+  {
+    qSort(state.excluded);
+    Item::List items = qobject_cast<ItemFetchJob*>(job)->items();
+    Item::List removed;
+    for (int i=0; i<items.count(); i++)
     {
-      delete resource_collections[rc.key()].last_sync;
-      resource_collections[rc.key()].last_sync = last_sync;
-      updateCollectionSyncTime(Collection(rc.value().id), *last_sync);
+      SugarRemoteId remoteId = SugarRemoteId::decode(items.at(i).remoteId());
+      if ((remoteId.isValid()) &&
+          (qBinaryFind(state.excluded.constBegin(), state.excluded.constEnd(), remoteId.id()) != state.excluded.constEnd()))
+        removed << items.at(i);
     }
+    removeUpdatedItems(mod, removed);
   }
-  QTimer::singleShot(Settings::self()->updateInterval()*1000, this, SLOT(update()));
+  state.excluded.clear();
+  finishUpdateStep(mod);
+}
+
+/*!
+ * Converts entries of a module that changed since last synchronization
+ * to Akonadi items on the thread pool.
+ * \param[in] module Module the entries belong to.
+ * \param[in] entries Entries, sorted as SugarCRM returns them.
+ * \param[in] last_sync Time of the last synchronization, entries created
+ * later are new.
+ */
+void SugarCrmResource::applyUpdatedEntries(const QString &module, const QVector<SugarRecord> &entries, const QString &last_sync)
+{
+  if (entries.isEmpty())
+    return;
+
+  // Entries entered after the last synchronization are new to us
+  module_update &state = updates[module];
+  QDateTime since = SugarDateTime::toQDateTime(last_sync);
+  QStringList ids;
+  QVariantList created, deleted;
+  for (int i=0; i<entries.count(); i++)
+  {
+    const SugarRecord &entry = entries.at(i);
+    ids << entry[SugarSchema::Id];
+    deleted << (entry[SugarSchema::Deleted] == "1");
+    created << (SugarDateTime::toQDateTime(entry[SugarSchema::DateEntered]) > since);
+  }
+
+  // Entries come sorted, so the last one is where the next pass
+  // starts unless the cursor is already past it
+  const SugarRecord &last = entries.last();
+  if (state.cursor.isBefore(last[SugarSchema::DateModified], last[SugarSchema::Id]))
+    state.cursor = SyncCursorAttribute(last[SugarSchema::DateModified], last[SugarSchema::Id], clock_offset, state.hash);
+
+  // The whole block is converted at once on the thread pool, and its
+  // items are looked up afterwards
+  QFutureWatcher<Item> *watcher = new QFutureWatcher<Item>(this);
+  watcher->setProperty("module", module);
+  watcher->setProperty("ids", ids);
+  watcher->setProperty("created", created);
+  watcher->setProperty("deleted", deleted);
+  connect(watcher, SIGNAL(finished()), this, SLOT(updatePayloadsReady()));
+  watcher->setFuture(payloads(module, entries, Collection(resource_collections[module].id)));
+  state.pending++;
+}
+
+/*!
+ * Compares the items of a module that has been fetched again with the
+ * ids it listed and checks again the ones that were not listed.
+ * \param[in] module Module whose listing finished.
+ */
+void SugarCrmResource::checkUnlistedItems(const QString &module)
+{
+  module_update &state = updates[module];
+  qSort(state.listed);
+  for (int i=0; i<state.local.count(); i++)
+  {
+    // Items still being added to SugarCRM have no remoteId yet
+    SugarRemoteId remoteId = SugarRemoteId::decode(state.local.at(i).remoteId());
+    if ((remoteId.isValid()) &&
+        (qBinaryFind(state.listed.constBegin(), state.listed.constEnd(), remoteId.id()) == state.listed.constEnd()))
+      state.stale.insert(remoteId.id(), state.local.at(i));
+  }
+  state.local.clear();
+  state.listed.clear();
+
+  // Entries changing while they were listed may have been skipped, so
+  // only the ones SugarCRM does not return by id either are removed
+  QString filter = moduleFilter(module);
+  QStringList ids = state.stale.keys();
+  const int chunk = 100;
+  for (int first=0; first<ids.count(); first+=chunk)
+  {
+    QStringList quoted;
+    foreach (QString id, ids.mid(first, chunk))
+      quoted << "'" + id.replace("'", "''") + "'";
+    QString query = "id IN (" + quoted.join(", ") + ")";
+    if (!filter.isEmpty())
+      query = "(" + filter + ") AND " + query;
+    SugarReply *check = soap->getEntries(module, QString(), QString(), false, query);
+    check->setProperty("check", true);
+    connect(check, SIGNAL(finished(SugarReply*)), this, SLOT(updateEntriesReceived(SugarReply*)));
+    state.pending_checks++;
+    state.pending++;
+  }
+}
+
+/*!
+ * Removes items of a module collection in a single batch.
+ * \param[in] module Module the items belong to.
+ * \param[in] items Items to remove.
+ */
+void SugarCrmResource::removeUpdatedItems(const QString &module, const Item::List &items)
+{
+  if (items.isEmpty())
+    return;
+
+  qDebug("Removing %d items from %s", items.count(), module.toLatin1().constData());
+  ItemDeleteJob *job = new ItemDeleteJob(items, this);
+  job->setProperty("module", module);
+  connect(job, SIGNAL(result(KJob*)), this, SLOT(updateItemsRemoved(KJob*)));
+  updates[module].pending++;
+}
+
+/*!
+ * Reports errors removing the items of entries that no longer match the
+ * filter of a module.
+ * \param[in] job Job started by removeUpdatedItems().
+ */
+void SugarCrmResource::updateItemsRemoved(KJob *job)
+{
+  QString mod = job->property("module").toString();
+  if (job->error() != 0)
+  {
+    qDebug("Unable to remove items: %s", job->errorString().toLatin1().constData());
+    updates[mod].failed = true;
+  }
+  finishUpdateStep(mod);
+}
+
+/*!
+ * Looks for each of the items converted by applyUpdatedEntries() in
+ * Akonadi, in the order SugarCRM returned them.
+ */
+void SugarCrmResource::updatePayloadsReady()
+{
+  QFutureWatcher<Item> *watcher = static_cast<QFutureWatcher<Item>*>(sender());
+  watcher->deleteLater();
+  QString mod = watcher->property("module").toString();
+  QStringList ids = watcher->property("ids").toStringList();
+  QVariantList created = watcher->property("created").toList();
+  QVariantList deleted = watcher->property("deleted").toList();
+  QFuture<Item> items = watcher->future();
+  int num_items = ids.count();
+  for (int i=0; i<num_items; i++)
+  {
+    Item item = items.resultAt(i);
+
+    // We need to check first if item actually exists in Akonadi
+    Item lookup(item.mimeType());
+    lookup.setRemoteId(item.remoteId());
+    ItemFetchJob *itemJob = new ItemFetchJob(lookup, this);
+    itemJob->setCollection(item.parentCollection());
+    itemJob->setProperty("item", QVariant::fromValue(item));
+    itemJob->setProperty("module", mod);
+    itemJob->setProperty("id", ids.at(i));
+    itemJob->setProperty("deleted", deleted.at(i));
+    itemJob->setProperty("created", created.at(i));
+    connect(itemJob, SIGNAL(result(KJob*)), this, SLOT(updateItemFetched(KJob*)));
+  }
+  updates[mod].pending += num_items;
+  finishUpdateStep(mod);
+}
+
+/*!
+ * Decides whether a changed SugarCRM entry has to be deleted, modified
+ * or added in Akonadi once we know if it is already there.
+ * \param[in] job Finished ItemFetchJob started by updatePayloadsReady().
+ */
+void SugarCrmResource::updateItemFetched(KJob *job)
+{
+  ItemFetchJob *fetchJob = qobject_cast<ItemFetchJob*>(job);
+  QString mod = job->property("module").toString();
+  QString id = job->property("id").toString();
+  Item newItem = job->property("item").value<Item>();
+  Item item;
+  bool itemFound = false;
+  if ((fetchJob->error() == 0) && (fetchJob->items().count() == 1))
+  {
+    itemFound = true;
+    item = fetchJob->items().first();
+  }
+
+  KJob *itemJob;
+  if (job->property("deleted").toBool())
+  {
+    // Nothing to do for entries we never had
+    if (!itemFound)
+    {
+      finishUpdateStep(mod);
+      return;
+    }
+    itemJob = new ItemDeleteJob(item, this);
+    // TODO If it can't find item, error should probably be ignored.
+    itemJob->setProperty("action", "delete");
+  }
+  else if (!itemFound)
+  {
+    // Entries we don't have are added whenever they were created, since
+    // an entry that matches a filter again was removed from Akonadi when
+    // it stopped matching it
+    itemJob = new ItemCreateJob(newItem, newItem.parentCollection(), this);
+    itemJob->setProperty("action", "add");
+  }
+  else if (!job->property("created").toBool())
+  {
+    // Modification of an item we have. A new entry may be already in
+    // Akonadi if SugarCRM is telling us about an item that has been
+    // created by Akonadi
+    newItem.setId(item.id());
+    newItem.setRevision(item.revision());
+    itemJob = new ItemModifyJob(newItem, this);
+    itemJob->setProperty("action", "modify");
+  }
+  else
+  {
+    finishUpdateStep(mod);
+    return;
+  }
+  itemJob->setProperty("module", mod);
+  itemJob->setProperty("id", id);
+  connect(itemJob, SIGNAL(result(KJob*)), this, SLOT(updateItemDone(KJob*)));
+}
+
+/*!
+ * Reports errors of the Akonadi jobs started to apply SugarCRM changes.
+ * \param[in] job Finished ItemCreateJob, ItemModifyJob or ItemDeleteJob.
+ */
+void SugarCrmResource::updateItemDone(KJob *job)
+{
+  QString mod = job->property("module").toString();
+  if (job->error() != 0)
+  {
+    qDebug("Unable to %s item %s: %s", job->property("action").toByteArray().constData(), job->property("id").toString().toLatin1().constData(), job->errorString().toLatin1().constData());
+    updates[mod].failed = true;
+  }
+  finishUpdateStep(mod);
+}
+
+/*!
+ * Counts down the requests, conversions and Akonadi jobs of the update of
+ * a module. Once they are all done, the cursor moves past the changes
+ * they applied unless any of them failed, so they are tried again in the
+ * next pass, and the next pass is scheduled once every module is done.
+ * \param[in] module Module whose update went one step further.
+ */
+void SugarCrmResource::finishUpdateStep(const QString &module)
+{
+  module_update &state = updates[module];
+  if (--state.pending > 0)
+    return;
+
+  // The cursor takes the current hash too once the fields have been
+  // fetched again, even if no entry matched
+  if ((!state.failed) && (resource_collections.contains(module)))
+  {
+    SyncCursorAttribute &cursor = resource_collections[module].cursor;
+    bool advanced = cursor.isBefore(state.cursor.lastModified(), state.cursor.lastId());
+    if ((advanced) || (cursor.schemaHash() != state.hash))
+    {
+      const SyncCursorAttribute &next = advanced? state.cursor : cursor;
+      cursor = SyncCursorAttribute(next.lastModified(), next.lastId(), clock_offset, state.hash);
+      updateCollectionCursor(Collection(resource_collections[module].id), cursor);
+    }
+  }
+  updates.remove(module);
+
+  if (--pending_updates == 0)
+    QTimer::singleShot(Settings::self()->updateInterval()*1000, this, SLOT(update()));
 }
 
 /*!
@@ -283,15 +618,74 @@ void SugarCrmResource::retrieveCollections()
   root.setParentCollection(Collection::root());
   // TODO root.setRights()
 
+  // Available modules rarely change, so they are usually known already
+  if ((metadata.hasModules()) && (metadata.isFresh()))
+  {
+    reportCollections(root, metadata.modules());
+    return;
+  }
+
+  // The server version tells whether they changed without logging in
+  SugarReply *reply = soap->getServerVersion();
+  reply->setProperty("root", QVariant::fromValue(root));
+  connect(reply, SIGNAL(finished(SugarReply*)), this, SLOT(serverVersionReceived(SugarReply*)));
+}
+
+/*!
+ * Reports the cached modules if SugarCRM did not change since they were
+ * stored, or requests them otherwise.
+ * \param[in] reply Reply to the getServerVersion() request issued by retrieveCollections().
+ */
+void SugarCrmResource::serverVersionReceived(SugarReply *reply)
+{
+  reply->deleteLater();
+  Collection root = reply->property("root").value<Collection>();
+  if ((!reply->hasError()) && (metadata.hasModules()) && (reply->version() == metadata.serverVersion()))
+  {
+    metadata.revalidate();
+    reportCollections(root, metadata.modules());
+    return;
+  }
+
+  SugarReply *modulesReply = soap->getModules();
+  modulesReply->setProperty("root", QVariant::fromValue(root));
+  modulesReply->setProperty("version", reply->version());
+  connect(modulesReply, SIGNAL(finished(SugarReply*)), this, SLOT(modulesReceived(SugarReply*)));
+}
+
+/*!
+ * Stores the modules available at SugarCRM and reports them to Akonadi.
+ * \param[in] reply Reply to the getModules() request issued by serverVersionReceived().
+ */
+void SugarCrmResource::modulesReceived(SugarReply *reply)
+{
+  reply->deleteLater();
+  if (reply->hasError())
+  {
+    cancelTask(reply->errorString());
+    return;
+  }
+
+  metadata.setModules(reply->modules(), reply->property("version").toString());
+  reportCollections(reply->property("root").value<Collection>(), reply->modules());
+}
+
+/*!
+ * Reports to Akonadi a collection for each module available at SugarCRM.
+ * \param[in] root Collection of the resource, parent of the module collections.
+ * \param[in] modules Modules available at SugarCRM.
+ */
+void SugarCrmResource::reportCollections(const Collection &root, const QStringList &modules)
+{
   Collection::List collections;
   collections << root;
 
-  SugarSoap soap(Settings::self()->url().url());
-  QStringList modules = soap.getModules();
-
-  // Add a collection for each available module
+  // Add a collection for each available module, the cache may still
+  // list modules that are no longer supported
   foreach (QString module, modules)
   {
+    if (!Modules.contains(module))
+      continue;
     Collection c;
     c.setParentCollection(root);
     c.setRemoteId(module);
@@ -304,6 +698,82 @@ void SugarCrmResource::retrieveCollections()
   QTimer::singleShot(Settings::self()->updateInterval()*1000, this, SLOT(update()));
 }
 
+/*!
+ * Narrows the fields requested for each module to the configured ones and
+ * checks them against the fields the module has at SugarCRM.
+ */
+void SugarCrmResource::selectFields()
+{
+  foreach (const QString &entry, Settings::self()->moduleFields())
+  {
+    int separator = entry.indexOf('=');
+    QString mod = entry.left(separator);
+    if ((separator <= 0) || (!Modules.contains(mod)))
+      continue;
+
+    QStringList selection;
+    foreach (QString field, entry.mid(separator + 1).split(',', QString::SkipEmptyParts))
+    {
+      field = field.trimmed();
+      if (Modules[mod].fields.contains(field))
+        selection << field;
+      else
+        qDebug("Field %s is not supported in module %s", field.toLatin1().constData(), mod.toLatin1().constData());
+    }
+    if (selection.isEmpty())
+      continue;
+
+    if ((metadata.hasFields(mod)) && (metadata.isFresh()))
+    {
+      selectFields(mod, selection, metadata.fields(mod));
+      continue;
+    }
+
+    // Applied right away, the check only narrows it further
+    soap->setFields(mod, selection);
+    SugarReply *reply = soap->getModuleFields(mod);
+    reply->setProperty("selection", selection);
+    connect(reply, SIGNAL(finished(SugarReply*)), this, SLOT(moduleFieldsReceived(SugarReply*)));
+  }
+}
+
+/*!
+ * Drops from the fields selected for a module the ones SugarCRM does not have.
+ * \param[in] reply Reply to the getModuleFields() request issued by selectFields().
+ */
+void SugarCrmResource::moduleFieldsReceived(SugarReply *reply)
+{
+  reply->deleteLater();
+  // Configuration may have replaced the SugarSoap object meanwhile
+  if ((reply->hasError()) || (reply->parent() != soap))
+    return;
+
+  metadata.setFields(reply->module(), reply->fields());
+  selectFields(reply->module(), reply->property("selection").toStringList(), reply->fields());
+}
+
+/*!
+ * Narrows the fields requested for a module to the selected ones it has at SugarCRM.
+ * \param[in] module Module whose fields are selected.
+ * \param[in] selection Configured fields of \a module.
+ * \param[in] available Fields \a module has at SugarCRM.
+ */
+void SugarCrmResource::selectFields(const QString &module, const QStringList &selection, const QStringList &available)
+{
+  QStringList fields;
+  foreach (const QString &field, selection)
+  {
+    if (available.contains(field))
+      fields << field;
+    else
+      qDebug("Field %s is not available in module %s", field.toLatin1().constData(), module.toLatin1().constData());
+  }
+  // None of them is available, so request the common fields only
+  if (fields.isEmpty())
+    fields << "id";
+  soap->setFields(module, fields);
+}
+
 /*!
  * Called by Akonadi to retrieve items from a collection
  * \param[in] collection Collection which requested items belong to.
@@ -313,6 +783,7 @@ void SugarCrmResource::retrieveItems( const Akonadi::Collection &collection )
   if (collection.parentCollection() == Collection::root())
   {
     itemsRetrieved(Item::List());
+    itemsRetrievalDone();
     return;
   }
   QString mod = collection.remoteId();
@@ -320,53 +791,259 @@ void SugarCrmResource::retrieveItems( const Akonadi::Collection &collection )
   if (!SugarCrmResource::Modules.contains(mod))
     return;
 
-  // Request items to SugarSoap
-  SugarSoap soap(Settings::self()->url().url());
-  QVector <QMap<QString, QString> > *soapItems = soap.getEntries(mod);
+  // Resume an interrupted listing from its checkpoint, as long as it was
+  // split in the same partitions
+  listing &state = listings[mod];
+  state = listing();
+  state.collection = collection;
+  state.partitions = listingPartitions();
+  state.running = 0;
+  state.unsaved = false;
+  const SyncCheckpointAttribute *checkpoint = collection.attribute<SyncCheckpointAttribute>();
+  state.resumed = (checkpoint != NULL) && (checkpoint->module() == mod) && (!checkpoint->started().isEmpty()) &&
+                  (checkpoint->orderBy() == SugarSoap::entriesOrder()) && (!checkpoint->partitions().isEmpty());
+  if (state.resumed)
+  {
+    foreach (const QString &partition, checkpoint->partitions())
+      state.resumed = state.resumed && state.partitions.contains(partition);
+  }
+  state.checkpoint = state.resumed? *checkpoint : SyncCheckpointAttribute(mod, SugarSoap::entriesOrder());
+  foreach (const QString &partition, state.partitions)
+    if (!state.checkpoint.isFinished(partition))
+      state.pending << partition;
+
+  if (state.resumed)
+  {
+    startPartitions(mod);
+    return;
+  }
+
+  // The listing covers every entry modified before it starts, so that is
+  // where the next update goes on from
+  SugarReply *reply = soap->getServerTime();
+  reply->setProperty("module", mod);
+  connect(reply, SIGNAL(finished(SugarReply*)), this, SLOT(listingTimeReceived(SugarReply*)));
+}
+
+/*!
+ * Records when a listing started at SugarCRM and starts its partitions.
+ * \param[in] reply Reply to the getServerTime() request issued by retrieveItems().
+ */
+void SugarCrmResource::listingTimeReceived(SugarReply *reply)
+{
+  reply->deleteLater();
+  QString mod = reply->property("module").toString();
+  if (!listings.contains(mod))
+    return;
+
+  // Without the time at SugarCRM, the local one is corrected by the last known offset
+  QDateTime started = reply->time();
+  if ((reply->hasError()) || (!started.isValid()))
+    started = QDateTime::currentDateTime().toUTC().addSecs(clock_offset);
+  listings[mod].checkpoint.setStarted(started.toString("yyyy-MM-dd hh:mm:ss"));
+  startPartitions(mod);
+}
+
+/*!
+ * \return Lower bounds of the ids of the partitions initial listings are
+ * split in. The first bound is empty and the rest split the hexadecimal
+ * digits ids start with evenly, so ids in any other form are listed too.
+ */
+QStringList SugarCrmResource::listingPartitions() const
+{
+  int count = qBound(1, (int)Settings::self()->initialLoadPartitions(), 256);
+  QStringList partitions;
+  partitions << QString();
+  for (int i=1; i<count; i++)
+    partitions << QString("%1").arg(i * 256 / count, 2, 16, QChar('0'));
+  return partitions;
+}
+
+/*!
+ * Queues the listing of the pending partitions of a module, or finishes
+ * the listing if nothing is left. They are listed in parallel on the
+ * background connections, making way for more urgent requests.
+ * \param[in] module Module being listed.
+ */
+void SugarCrmResource::startPartitions(const QString &module)
+{
+  listing &state = listings[module];
+  while ((!state.pending.isEmpty()) && (state.error.isEmpty()))
+  {
+    QString partition = state.pending.takeFirst();
+    QString next = state.partitions.value(state.partitions.indexOf(partition) + 1);
+
+    QStringList conditions;
+    QString filter = moduleFilter(module);
+    if (!filter.isEmpty())
+      conditions << "(" + filter + ")";
+    if (!partition.isEmpty())
+      conditions << QString("id >= '%1'").arg(partition);
+    if (!next.isEmpty())
+      conditions << QString("id < '%1'").arg(next);
+
+    // Entries are sorted by modification time and id, so those after the
+    // last one the partition reached are left. Unlike skipping an offset,
+    // this does not miss any when listed ones are modified in the meantime,
+    // those just come again and are matched by their remote id
+    if (!state.checkpoint.lastModified(partition).isEmpty())
+    {
+      QString last_id = state.checkpoint.lastId(partition);
+      last_id.replace("'", "''");
+      conditions << QString("(date_modified > '%1' OR (date_modified = '%1' AND id > '%2'))").arg(state.checkpoint.lastModified(partition), last_id);
+    }
+
+    SugarReply *reply = soap->getEntryPages(module, conditions.join(" AND "));
+    reply->setProperty("partition", partition);
+    connect(reply, SIGNAL(pageReceived(SugarReply*)), this, SLOT(entryPageReceived(SugarReply*)));
+    connect(reply, SIGNAL(finished(SugarReply*)), this, SLOT(entriesReceived(SugarReply*)));
+    state.running++;
+  }
+  if (state.running == 0)
+    finishListing(module);
+}
+
+/*!
+ * Hands a page of a module listing to Akonadi and records how far its
+ * partition got. It is stored once the page is committed, so the
+ * listing can be resumed from there.
+ * \param[in] reply Reply to a getEntryPages() request issued by startPartitions().
+ */
+void SugarCrmResource::entryPageReceived(SugarReply *reply)
+{
+  QString mod = reply->module();
+  listing &state = listings[mod];
+  QString partition = reply->property("partition").toString();
+  QVector<SugarRecord> soapItems = reply->entries();
+  QString last_modified = state.checkpoint.lastModified(partition);
+  QString last_id = state.checkpoint.lastId(partition);
 
   // At this step, we only need their remoteIds.
   Item::List items;
-  QString last_sync;
   for (
-    QVector<QMap<QString, QString> >::iterator soapItem = soapItems->begin();
-    soapItem != soapItems->end();
+    QVector<SugarRecord>::const_iterator soapItem = soapItems.constBegin();
+    soapItem != soapItems.constEnd();
     soapItem++
   )
   {
     Item item(Modules[mod].mimes[0]);
-    item.setRemoteId((*soapItem)["id"] + "@" + mod);
-    item.setParentCollection(collection);
-    last_sync = (*soapItem)["date_modified"];
+    item.setRemoteId(SugarRemoteId::encode((*soapItem)[SugarSchema::Id], mod));
+    item.setParentCollection(state.collection);
     items << item;
+    last_modified = (*soapItem)[SugarSchema::DateModified];
+    last_id = (*soapItem)[SugarSchema::Id];
   }
-  delete soapItems;
 
-  itemsRetrieved( items );
-  resource_collection* rc = new resource_collection;
-  rc->id = collection.id();
-  rc->last_sync = NULL;
-  resource_collections[mod] = *rc;
-  delete rc;
-  if (!last_sync.isEmpty())
+  // Items listed before resuming must not be removed, so a resumed
+  // listing only adds items
+  if (state.resumed)
+    itemsRetrievedIncremental(items, Item::List());
+  else
+    itemsRetrieved(items);
+
+  state.checkpoint.setPosition(partition, last_modified, last_id);
+  state.unsaved = true;
+}
+
+/*!
+ * Finishes the listing of a partition, and the whole listing after the
+ * last one.
+ * \param[in] reply Reply to a getEntryPages() request issued by startPartitions().
+ */
+void SugarCrmResource::entriesReceived(SugarReply *reply)
+{
+  reply->deleteLater();
+  QString mod = reply->module();
+  listing &state = listings[mod];
+  if (reply->hasError())
   {
-    resource_collections[mod].last_sync = new QDateTime(QDateTime::fromString(last_sync, Qt::ISODate));
-    updateCollectionSyncTime(collection, *(resource_collections[mod].last_sync));
+    if (state.error.isEmpty())
+      state.error = reply->errorString();
   }
+  else
+  {
+    state.checkpoint.setFinished(reply->property("partition").toString());
+    state.unsaved = true;
+  }
+
+  state.running--;
+  startPartitions(mod);
+}
+
+/*!
+ * Reports to Akonadi the end of the listing of a module and records its
+ * synchronization position, which is the time the listing started.
+ * \param[in] module Module whose partitions are all finished or failed.
+ */
+void SugarCrmResource::finishListing(const QString &module)
+{
+  listing state = listings.take(module);
+  if (!state.error.isEmpty())
+  {
+    cancelTask(state.error);
+    return;
+  }
+
+  itemsRetrievalDone();
+  // Partitions finish at different positions, and entries modified after
+  // a partition finished may sort before where another one got. None of
+  // them is missed from the time the listing started on
+  resource_collection rc;
+  rc.id = state.collection.id();
+  rc.cursor = SyncCursorAttribute(state.checkpoint.started(), QString(), clock_offset, schemaHash(module));
+  updateCollectionCursor(state.collection, rc.cursor);
+  resource_collections[module] = rc;
+  scheduleReconcile();
+}
+
+/*!
+ * Used to update the position of last synchronization recorded in collection.
+ * \param[in] collection Collection to update.
+ * \param[in] cursor Position of the last synchronization to set in collection.
+ */
+void SugarCrmResource::updateCollectionCursor(Collection collection, const SyncCursorAttribute &cursor)
+{
+  *(collection.attribute<SyncCursorAttribute>(Collection::AddIfMissing)) = cursor;
+  // The cursor supersedes the plain time stored by earlier versions and
+  // the listing is complete, so nothing is left to resume. Attributes are
+  // only removed from Akonadi if the collection object has them
+  collection.attribute<DateTimeAttribute>(Collection::AddIfMissing);
+  collection.removeAttribute<DateTimeAttribute>();
+  collection.attribute<SyncCheckpointAttribute>(Collection::AddIfMissing);
+  collection.removeAttribute<SyncCheckpointAttribute>();
+  Akonadi::CollectionModifyJob *job = new Akonadi::CollectionModifyJob( collection );
+  connect( job, SIGNAL(result(KJob*)), this, SLOT(finishUpdateCollection(KJob*)) );
 }
 
 /*!
- * Used to update last synchronization time recorded in collection.
+ * Used to record in a collection how far its listing got.
  * \param[in] collection Collection to update.
- * \param[in,out] time Last synchronization time to set in collection.
+ * \param[in] checkpoint Position of every partition of the listing.
  */
-void SugarCrmResource::updateCollectionSyncTime(Collection collection, QDateTime time)
+void SugarCrmResource::updateCollectionCheckpoint(Collection collection, const SyncCheckpointAttribute &checkpoint)
 {
-  *(collection.attribute<DateTimeAttribute>(Collection::AddIfMissing)) = time;
+  *(collection.attribute<SyncCheckpointAttribute>(Collection::AddIfMissing)) = checkpoint;
   Akonadi::CollectionModifyJob *job = new Akonadi::CollectionModifyJob( collection );
-  connect( job, SIGNAL(result(KJob*)), this, SLOT(finishUpdateCollectionSyncTime(KJob*)) );
+  connect( job, SIGNAL(result(KJob*)), this, SLOT(finishUpdateCollection(KJob*)) );
+}
+
+/*!
+ * Stores how far listings got once Akonadi asks for more items, which
+ * it only does after committing the ones delivered so far. Pages that
+ * were delivered but not committed are listed again on resume.
+ */
+void SugarCrmResource::itemSyncBatchCommitted()
+{
+  for (QHash<QString, listing>::iterator state = listings.begin(); state != listings.end(); state++)
+  {
+    if (!state.value().unsaved)
+      continue;
+    updateCollectionCheckpoint(state.value().collection, state.value().checkpoint);
+    state.value().unsaved = false;
+  }
 }
 
-void SugarCrmResource::finishUpdateCollectionSyncTime(KJob *job)
+void SugarCrmResource::finishUpdateCollection(KJob *job)
 {
   if (job->error() != 0)
     qDebug("%s", job->errorString().toLatin1().constData());
@@ -381,477 +1058,343 @@ bool SugarCrmResource::retrieveItem( const Akonadi::Item &item, const QSet<QByte
 {
   Q_UNUSED( parts );
 
-  QString mod = item.remoteId().replace(QRegExp(".*@"), "");
-  QString remoteId = item.remoteId().replace(QRegExp("@" + mod + "$"), "");
   // Check if the module we got is valid
-  if (!SugarCrmResource::Modules.contains(mod))
+  SugarRemoteId remoteId = SugarRemoteId::decode(item.remoteId());
+  if (!remoteId.isValid())
     return false;
 
-  SugarSoap soap(Settings::self()->url().url());
-  // TODO check returned value
-  // Call function pointer to the function that returns the appropi
-  QHash<QString, QString> *soapItem = soap.getEntry(mod, remoteId);
-  Item newItem = (this->*SugarCrmResource::Modules[mod].payload_function)(*soapItem, item);
-  delete soapItem;
-  newItem.setRemoteId(item.remoteId());
-  newItem.setParentCollection(item.parentCollection());
-  // end of code to move to retrieveItem()
-  itemRetrieved(newItem);
+  SugarReply *reply = soap->getEntry(remoteId.module(), remoteId.id());
+  reply->setProperty("item", QVariant::fromValue(item));
+  connect(reply, SIGNAL(finished(SugarReply*)), this, SLOT(entryReceived(SugarReply*)));
   return true;
 }
 
 /*!
- * Receives an an Akonadi::Item and a SOAP assocative array that
- * contains an addreess book contact to be set as item's payload.
- * \param[in] soapItem The associative array containing an address book contact.
- * \param[in] item The item whose payload will be populated.
- * \return A new Akonadi::Item with its payload.
- */
-Item SugarCrmResource::contactPayload(const QHash<QString, QString> &soapItem, const Akonadi::Item &item)
-{
-  KABC::Addressee addressee;
-  addressee.setUid(soapItem["id"]);
-  addressee.setPrefix(soapItem["salutation"]);
-  addressee.setGivenName(soapItem["first_name"]);
-  addressee.setFamilyName(soapItem["last_name"]);
-  addressee.setBirthday(QDateTime::fromString(soapItem["birthdate"], Qt::ISODate));
-
-  if ((!soapItem["primary_address_street"].trimmed().isEmpty()) ||
-      (!soapItem["primary_address_city"].trimmed().isEmpty()) ||
-      (!soapItem["primary_address_state"].trimmed().isEmpty()) ||
-      (!soapItem["primary_address_postalcode"].trimmed().isEmpty()) ||
-      (!soapItem["primary_address_country"].trimmed().isEmpty())
-     )
-  {
-    KABC::Address addr;
-    addr.setStreet(soapItem["primary_address_street"]);
-    addr.setLocality(soapItem["primary_address_city"]);
-    addr.setRegion(soapItem["primary_address_state"]);
-    addr.setPostalCode(soapItem["primary_address_postalcode"]);
-    addr.setCountry(soapItem["primary_address_country"]);
-    addr.setId("primary");
-    addressee.insertAddress(addr);
-  }
-
-  if ((!soapItem["alt_address_street"].trimmed().isEmpty()) ||
-      (!soapItem["alt_address_city"].trimmed().isEmpty()) ||
-      (!soapItem["alt_address_state"].trimmed().isEmpty()) ||
-      (!soapItem["alt_address_postalcode"].trimmed().isEmpty()) ||
-      (!soapItem["alt_address_country"].trimmed().isEmpty())
-     )
-  {
-    KABC::Address addr;
-    addr.setStreet(soapItem["alt_address_street"]);
-    addr.setLocality(soapItem["alt_address_city"]);
-    addr.setRegion(soapItem["alt_address_state"]);
-    addr.setPostalCode(soapItem["alt_address_postalcode"]);
-    addr.setCountry(soapItem["alt_address_country"]);
-    addr.setId("alt");
-    addressee.insertAddress(addr);
-  }
-
-  addressee.setOrganization(soapItem["account_name"]);
-  addressee.setTitle(soapItem["title"]);
-  addressee.setDepartment(soapItem["department"]);
-  addressee.setNote(soapItem["description"]);
-
-  for (QMap<QString, KABC::PhoneNumber::Type>::iterator phone_type = phones.begin(); phone_type != phones.end(); phone_type++)
-    if (!soapItem[phone_type.key()].trimmed().isEmpty())
-    {
-      KABC::PhoneNumber phone(soapItem[phone_type.key()], phone_type.value());
-      addressee.insertPhoneNumber(phone);
-    }
-
-  if (!soapItem["phone_other"].trimmed().isEmpty())
+ * Reports to Akonadi the whole data of an item.
+ * \param[in] reply Reply to the getEntry() request issued by retrieveItem().
+ */
+void SugarCrmResource::entryReceived(SugarReply *reply)
+{
+  reply->deleteLater();
+  if (reply->hasError())
   {
-    KABC::PhoneNumber phone(soapItem["phone_other"]);
-    phone.setId("other");
-    addressee.insertPhoneNumber(phone);
+    cancelTask(reply->errorString());
+    return;
   }
 
-  QStringList emails;
-  if (!soapItem["email1"].trimmed().isEmpty())
-    emails << soapItem["email1"];
-  if (!soapItem["email2"].trimmed().isEmpty())
-    emails << soapItem["email2"];
-  addressee.setEmails(emails);
-
-  Item newItem(item);
-  newItem.setPayload<KABC::Addressee>( addressee );
-  return newItem;
+  QFutureWatcher<Item> *watcher = new QFutureWatcher<Item>(this);
+  connect(watcher, SIGNAL(finished()), this, SLOT(payloadReady()));
+  watcher->setFuture(QtConcurrent::run(this, &SugarCrmResource::payload, reply->module(), reply->entry(), reply->property("item").value<Item>()));
 }
 
 /*!
- * Receives an Akonadi::Item containing KABC::Addressee payload and
- * converts this payload to a SOAP assocative array to be stored
- * in SugarCRM.
- * \param[in] item The item whose payload will be converted.
- * \return A new QHash dictionary with item attributes.
+ * Reports to Akonadi an item converted by entryReceived().
  */
-QHash<QString, QString> SugarCrmResource::contactSoap(const Akonadi::Item &item)
+void SugarCrmResource::payloadReady()
 {
-  const KABC::Addressee &payload = item.payload<KABC::Addressee>();
-
-  QHash<QString, QString> soapItem;
-
-  soapItem["salutation"] = payload.prefix();
-  soapItem["first_name"] = payload.givenName();
-  soapItem["last_name"] = payload.familyName();
-  soapItem["birthdate"] = payload.birthday().toString(Qt::ISODate);
-  if (payload.emails().length() >= 1)
-    soapItem["email1"] = payload.emails().at(0);
-  if (payload.emails().length() >= 2)
-    soapItem["email1"] = payload.emails().at(1);
+  QFutureWatcher<Item> *watcher = static_cast<QFutureWatcher<Item>*>(sender());
+  watcher->deleteLater();
+  itemRetrieved(watcher->result());
+}
 
-  for (QMap<QString, KABC::PhoneNumber::Type>::iterator phone_type = phones.begin(); phone_type != phones.end(); phone_type++)
-    if (!payload.phoneNumber(phone_type.value()).isEmpty())
-      soapItem[phone_type.key()] = payload.phoneNumber(phone_type.value()).toString();
+/*!
+ * Converts a SugarCRM entry into an Akonadi::Item. It is run on the global
+ * thread pool, so it must only read shared state.
+ * \param[in] module Module the entry belongs to.
+ * \param[in] soapItem The associative array containing the entry.
+ * \param[in] item The item whose payload will be populated.
+ * \return A new Akonadi::Item with its payload, remoteId and parent collection.
+ */
+Item SugarCrmResource::payload(const QString &module, const SugarRecord &soapItem, const Akonadi::Item &item)
+{
+  // The module mapping builds the appropiate payload
+  Item newItem = SugarCrmResource::Modules.value(module).mapping->payload(soapItem, item);
+  newItem.setRemoteId(item.remoteId());
+  newItem.setParentCollection(item.parentCollection());
+  return newItem;
+}
 
-  if (!payload.findPhoneNumber("other").isEmpty())
-    soapItem["phone_other"] = payload.findPhoneNumber("other").toString();
+/*!
+ * Converts one of the entries of a block, used by payloads() to map the
+ * whole block on the thread pool.
+ */
+struct SugarCrmResource::PayloadMapper
+{
+  typedef Item result_type;
 
-  KABC::Address addr = payload.findAddress("primary");
-  if (!addr.isEmpty())
+  PayloadMapper(SugarCrmResource *resource, const QString &module, const Collection &collection)
+    : resource(resource), module(module), collection(collection)
   {
-    soapItem["primary_address_street"]     = addr.street();
-    soapItem["primary_address_city"]       = addr.locality();
-    soapItem["primary_address_state"]      = addr.region();
-    soapItem["primary_address_postalcode"] = addr.postalCode();
-    soapItem["primary_address_country"]    = addr.country();
   }
 
-  addr = payload.findAddress("alt");
-  if (!addr.isEmpty())
+  Item operator()(const SugarRecord &entry) const
   {
-    soapItem["alt_address_street"]     = addr.street();
-    soapItem["alt_address_city"]       = addr.locality();
-    soapItem["alt_address_state"]      = addr.region();
-    soapItem["alt_address_postalcode"] = addr.postalCode();
-    soapItem["alt_address_country"]    = addr.country();
+    Item item(SugarCrmResource::Modules.value(module).mimes.first());
+    item.setRemoteId(SugarRemoteId::encode(entry[SugarSchema::Id], module));
+    item.setParentCollection(collection);
+    return resource->payload(module, entry, item);
   }
 
-  soapItem["account_name"] = payload.organization();
-  soapItem["title"]        = payload.title();
-  soapItem["department"]   = payload.department();
-  soapItem["description"]  = payload.note();
+  SugarCrmResource *resource;
+  QString module;
+  Collection collection;
+};
 
-  return soapItem;
+/*!
+ * Converts a whole block of SugarCRM entries into Akonadi items
+ * concurrently. The number of threads used is the ConversionThreads
+ * setting.
+ * \param[in] module Module the entries belong to.
+ * \param[in] entries Entries as received from getEntries(), with every field the module requires.
+ * \param[in] collection Collection the items will be stored in.
+ * \return Future whose results are the converted items, in the same order as \a entries.
+ */
+QFuture<Item> SugarCrmResource::payloads(const QString &module, const QVector<SugarRecord> &entries, const Collection &collection)
+{
+  return QtConcurrent::mapped(entries, PayloadMapper(this, module, collection));
 }
 
 /*!
- * Receives an Akonadi::Item and a SOAP assocative array that
- * contains a calendar task to be set as item's payload.
- * \param[in] soapItem The associative array containing a calendar task.
- * \param[in] item The item whose payload will be populated.
- * \return A new Akonadi::Item with its payload.
+ * \param[in] module Module whose filter is requested.
+ * \return Server-side filter configured for \a module as it was written,
+ * or an empty string if it has no filter.
  */
-Item SugarCrmResource::taskPayload(const QHash<QString, QString> &soapItem, const Akonadi::Item &item)
+QString SugarCrmResource::configuredFilter(const QString &module) const
 {
-  KCalCore::Todo::Ptr event(new KCalCore::Todo);
-  event->setUid(soapItem["id"]);
-  event->setSummary(soapItem["name"]);
-  event->setDescription(soapItem["description"]);
-  event->setCreated(KDateTime::fromString(soapItem["date_entered"], KDateTime::ISODate));
-  if (!soapItem["date_start"].isEmpty())
-  {
-    event->setDtStart(KDateTime::fromString(soapItem["date_start"], KDateTime::ISODate));
-    event->setDateTime(KDateTime::fromString(soapItem["date_start"], KDateTime::ISODate), KCalCore::IncidenceBase::RoleDisplayStart);
-  }
-  if (!soapItem["date_due"].isEmpty())
-  {
-    event->setDtDue(KDateTime::fromString(soapItem["date_due"], KDateTime::ISODate));
-    event->setDateTime(KDateTime::fromString(soapItem["date_due"], KDateTime::ISODate), KCalCore::IncidenceBase::RoleDisplayEnd);
-  }
-  if (!soapItem["case_number"].isEmpty())
-    event->setCustomProperty("SugarCRM", "X-CaseNumber", soapItem["case_number"]);
-
-  // TODO percentcomplete
-  if (!soapItem["status"].isEmpty())
-  {
-    if (soapItem["status"] == "Assigned")
-      event->setStatus(KCalCore::Incidence::StatusConfirmed);
-    else if (soapItem["status"] == "Pending Input")
-      event->setStatus(KCalCore::Incidence::StatusInProcess);
-    else if (soapItem["status"] ==  "Closed")
-      event->setStatus(KCalCore::Incidence::StatusCompleted);
-    else if (soapItem["status"] == "Rejected")
-      event->setStatus(KCalCore::Incidence::StatusCanceled);
-    else
-      event->setCustomStatus(soapItem["status"]);
-    event->setCustomProperty("SugarCRM", "X-Status", soapItem["status"]);
-  }
-  if (!soapItem["priority"].isEmpty())
-  {
-    if (soapItem["priority"] == "High")
-      event->setPriority(1);
-    else if (soapItem["priority"] == "Medium")
-      event->setPriority(5);
-    else if (soapItem["priority"] == "Low")
-      event->setPriority(9);
-  }
-
-  Item newItem(item);
-  newItem.setPayload<KCalCore::Todo::Ptr>(event);
-  return newItem;
+  QString prefix = module + "=";
+  QString filter;
+  foreach (const QString &entry, Settings::self()->moduleFilters())
+    if (entry.startsWith(prefix))
+      filter = entry.mid(prefix.length()).trimmed();
+  return filter;
 }
 
 /*!
- * Receives an Akonadi::Item containing KCalCore::Todo payload and
- * converts this payload to a SOAP assocative array to be stored
- * in SugarCRM.
- * \param[in] item The item whose payload will be converted.
- * \return A new QHash dictionary with item attributes.
+ * Builds the server-side filter configured for a module.
+ * \param[in] module Module whose filter is requested.
+ * \return SQL condition entries of \a module must match or an empty string if it has no filter.
  */
-QHash<QString, QString> SugarCrmResource::taskSoap(const Akonadi::Item &item)
+QString SugarCrmResource::moduleFilter(const QString &module) const
 {
-  const KCalCore::Todo::Ptr &payload = item.payload<KCalCore::Todo::Ptr>();
-
-  QHash<QString, QString> soapItem;
-
-  soapItem["name"] = payload->summary();
-  soapItem["description"] = payload->description();
-  soapItem["date_entered"] = payload->created().toString(KDateTime::ISODate);
-  if (payload->hasStartDate())
+  QString filter = configuredFilter(module);
+  if (filter.isEmpty())
+    return filter;
+
+  QString username = Settings::self()->username();
+  username.replace("'", "''");
+  filter.replace("%username", "'" + username + "'");
+
+  // %days(N) is the time N days ago, as SugarCRM stores it
+  QRegExp days("%days\\((\\d+)\\)");
+  int pos;
+  while ((pos = days.indexIn(filter)) != -1)
   {
-    soapItem["date_start"] = payload->dtStart().toString(KDateTime::ISODate);
-    soapItem["date_start_flag"] = "1";
+    QDateTime since = QDateTime::currentDateTime().toUTC().addSecs(clock_offset).addDays(-days.cap(1).toInt());
+    filter.replace(pos, days.matchedLength(), "'" + since.toString("yyyy-MM-dd hh:mm:ss") + "'");
   }
-  if (payload->hasDueDate())
-  {
-    soapItem["date_due"] = payload->dtDue().toString(KDateTime::ISODate);
-    soapItem["date_due_flag"] = "1";
-  }
-  if (!payload->customProperty("SugarCRM", "X-CaseNumber").isEmpty())
-    soapItem["case_number"] = payload->customProperty("SugarCRM", "X-CaseNumber");
+  return filter;
+}
 
-  if (!payload->customProperty("SugarCRM", "X-Status").isEmpty())
-    soapItem["status"] = payload->customProperty("SugarCRM", "X-Status");
-  else
-    switch (payload->status())
-    {
-      case KCalCore::Incidence::StatusConfirmed:
-        soapItem["status"] = "Assigned";
-        break;
-      case KCalCore::Incidence::StatusInProcess:
-        soapItem["status"] = "Pending Input";
-        break;
-      case KCalCore::Incidence::StatusCompleted:
-        soapItem["status"] = "Closed";
-        break;
-      case KCalCore::Incidence::StatusCanceled:
-        soapItem["status"] = "Rejected";
-        break;
-      case KCalCore::Incidence::StatusX:
-        soapItem["status"] = payload->customStatus();
-        break;
-      default:
-        // Just to avoid warnings
-        break;
-    }
-  if ((payload->priority() >= 1) && (payload->priority() <= 3))
-    soapItem["priority"] = "High";
-  else if ((payload->priority() >=4) && (payload->priority() <=6))
-    soapItem["priority"] = "Medium";
-  else if (payload->priority() >= 7)
-    soapItem["priority"] = "Low";
-  return soapItem;
+/*!
+ * Schedules the next reconciliation, unless it is disabled or already scheduled.
+ */
+void SugarCrmResource::scheduleReconcile()
+{
+  if ((reconcile_scheduled) || (Settings::self()->reconcileInterval() == 0))
+    return;
+  reconcile_scheduled = true;
+  QTimer::singleShot(Settings::self()->reconcileInterval()*1000, this, SLOT(reconcile()));
 }
 
 /*!
- * Receives an Akonadi::Item and a SOAP assocative array that
- * contains a calendar event to be set as item's payload.
- * \param[in] soapItem The associative array containing a calendar event.
- * \param[in] item The item whose payload will be populated.
- * \return A new Akonadi::Item with its payload.
+ * This method is executed periodically to remove from Akonadi the items
+ * whose entries are gone from SugarCRM without a trace, because they were
+ * purged or the user is no longer allowed to see them. Only ids are listed,
+ * which costs a fraction of a full synchronization.
  */
-Item SugarCrmResource::bookingPayload(const QHash<QString, QString> &soapItem, const Akonadi::Item &item)
+void SugarCrmResource::reconcile()
 {
-  KCalCore::Event::Ptr event(new KCalCore::Event);
-  event->setUid(soapItem["id"]);
-  event->setSummary(soapItem["name"]);
-  event->setCreated(KDateTime::fromString(soapItem["date_entered"], KDateTime::ISODate));
-  if (!soapItem["date_start"].isEmpty())
-  {
-    event->setDtStart(KDateTime::fromString(soapItem["date_start"], KDateTime::ISODate));
-    event->setDateTime(KDateTime::fromString(soapItem["date_start"], KDateTime::ISODate), KCalCore::IncidenceBase::RoleDisplayStart);
-  }
-  if (!soapItem["quantity"].isEmpty())
-  {
-    event->setDuration(soapItem["quantity"].toUInt()*60);
-    event->setDtEnd(KDateTime::fromString(soapItem["date_start"], KDateTime::ISODate).addSecs(soapItem["quantity"].toUInt()*60));
-    event->setDateTime(KDateTime::fromString(soapItem["date_start"], KDateTime::ISODate).addSecs(soapItem["quantity"].toUInt()*60), KCalCore::IncidenceBase::RoleDisplayEnd);
-    event->setDateTime(KDateTime::fromString(soapItem["date_start"], KDateTime::ISODate).addSecs(soapItem["quantity"].toUInt()*60), KCalCore::IncidenceBase::RoleEnd);
-  }
+  reconcile_scheduled = false;
+  // Previous pass is still running, it will schedule the next one
+  if (pending_reconciles > 0)
+    return;
 
-  // TODO percentcomplete
-  if (!soapItem["status"].isEmpty())
+  QMapIterator<QString, resource_collection> rc(resource_collections);
+  while (rc.hasNext())
   {
-    if (soapItem["status"] == "draft")
-      event->setStatus(KCalCore::Incidence::StatusDraft);
-    else if (soapItem["status"] == "approved")
-      event->setStatus(KCalCore::Incidence::StatusConfirmed);
-    else if (soapItem["status"] ==  "rejected")
-      event->setStatus(KCalCore::Incidence::StatusCanceled);
-    else if (soapItem["status"] == "pending")
-      event->setStatus(KCalCore::Incidence::StatusNeedsAction);
-    else
-      event->setCustomStatus(soapItem["status"]);
-    event->setCustomProperty("SugarCRM", "X-Status", soapItem["status"]);
+    rc.next();
+    if (rc.value().cursor.isNull()) continue;
+
+    // Items are taken first, so any item SugarCRM does not list
+    // afterwards was already there
+    ItemFetchJob *job = new ItemFetchJob(Collection(rc.value().id), this);
+    job->setProperty("module", rc.key());
+    connect(job, SIGNAL(result(KJob*)), this, SLOT(reconcileItemsFetched(KJob*)));
+    reconciliations[rc.key()] = reconciliation();
+    pending_reconciles++;
   }
+  if (pending_reconciles == 0)
+    scheduleReconcile();
+}
 
-  if (!soapItem["related_type"].isEmpty())
+/*!
+ * Lists the ids of the entries of a module once its items are known.
+ * \param[in] job Job that fetched the items of the module collection.
+ */
+void SugarCrmResource::reconcileItemsFetched(KJob *job)
+{
+  QString mod = job->property("module").toString();
+  if (job->error() != 0)
   {
-    event->setCustomProperty("SugarCRM", "X-RelatedType", soapItem["related_type"]);
-    if (!soapItem["related_id"].isEmpty())
-    {
-      event->setCustomProperty("SugarCRM", "X-RelatedId", soapItem["related_id"]);
-      if (soapItem["related_type"] == "Cases")
-        event->setRelatedTo(soapItem["related_id"]);
-    }
+    qDebug("Unable to reconcile %s: %s", mod.toLatin1().constData(), job->errorString().toLatin1().constData());
+    finishReconcile(mod);
+    return;
   }
+  reconciliations[mod].local = qobject_cast<ItemFetchJob*>(job)->items();
 
-  Item newItem(item);
-  newItem.setPayload<KCalCore::Event::Ptr>(event);
-  return newItem;
+  SugarReply *reply = soap->getEntryPages(mod, moduleFilter(mod));
+  connect(reply, SIGNAL(pageReceived(SugarReply*)), this, SLOT(reconcilePageReceived(SugarReply*)));
+  connect(reply, SIGNAL(finished(SugarReply*)), this, SLOT(reconcileEntriesReceived(SugarReply*)));
 }
 
 /*!
- * Receives an Akonadi::Item containing KCalCore::Event payload and
- * converts this payload to a SOAP assocative array to be stored
- * in SugarCRM.
- * \param[in] item The item whose payload will be converted.
- * \return A new QHash dictionary with item attributes.
+ * Collects the ids of a page of entries.
+ * \param[in] reply Reply to the getEntryPages() request issued by reconcileItemsFetched().
  */
-QHash<QString, QString> SugarCrmResource::bookingSoap(const Akonadi::Item &item)
+void SugarCrmResource::reconcilePageReceived(SugarReply *reply)
 {
-  const KCalCore::Event::Ptr &payload = item.payload<KCalCore::Event::Ptr>();
-
-  QHash<QString, QString> soapItem;
-
-  soapItem["name"] = payload->summary();
-  soapItem["date_entered"] = payload->created().toString(KDateTime::ISODate);
-  soapItem["date_start"] = payload->dtStart().toString(KDateTime::ISODate);
-  if (payload->hasDuration())
-    soapItem["quantity"] = QString::number(payload->duration().asSeconds()/60);
-
-  if (!payload->customProperty("SugarCRM", "X-Status").isEmpty())
-    soapItem["status"] = payload->customProperty("SugarCRM", "X-Status");
-  else
-    switch (payload->status())
-    {
-      case KCalCore::Incidence::StatusDraft:
-        soapItem["status"] = "draft";
-        break;
-      case KCalCore::Incidence::StatusConfirmed:
-        soapItem["status"] = "approved";
-        break;
-      case KCalCore::Incidence::StatusCanceled:
-        soapItem["status"] = "rejected";
-        break;
-      case KCalCore::Incidence::StatusNeedsAction:
-        soapItem["status"] = "pending";
-        break;
-      case KCalCore::Incidence::StatusX:
-        soapItem["status"] = payload->customStatus();
-        break;
-      default:
-        // Just to avoid warnings
-        break;
-    }
-  return soapItem;
+  QVector<QString> &remote = reconciliations[reply->module()].remote;
+  QVector<SugarRecord> entries = reply->entries();
+  remote.reserve(remote.count() + entries.count());
+  for (int i=0; i<entries.count(); i++)
+    remote.append(entries.at(i)[SugarSchema::Id]);
 }
 
 /*!
- * Receives an Akonadi::Item and a SOAP assocative array that
- * contains a project to be set as item's payload.
- * \param[in] soapItem The associative array containing a calendar task.
- * \param[in] item The item whom payload will be populated.
- * \return A new Akonadi::Item with its payload.
+ * Compares the items of a module with the ids listed by SugarCRM and
+ * checks again the ones that were not listed.
+ * \param[in] reply Reply to the getEntryPages() request issued by reconcileItemsFetched().
  */
-Item SugarCrmResource::projectPayload(const QHash<QString, QString> &soapItem, const Akonadi::Item &item)
+void SugarCrmResource::reconcileEntriesReceived(SugarReply *reply)
 {
-  KCalCore::Todo::Ptr project(new KCalCore::Todo);
-  project->setUid(soapItem["id"]);
-  project->setSummary(soapItem["name"]);
-  project->setDescription(soapItem["description"]);
-  project->setCreated(KDateTime::fromString(soapItem["date_entered"], KDateTime::ISODate));
-  if (!soapItem["date_starting"].isEmpty())
+  reply->deleteLater();
+  QString mod = reply->module();
+  if (reply->hasError())
+  {
+    finishReconcile(mod);
+    return;
+  }
+
+  // Both sides are sorted by id, so a single merge walk finds the items
+  // SugarCRM did not list
+  reconciliation &state = reconciliations[mod];
+  QVector<QPair<QString, int> > local;
+  local.reserve(state.local.count());
+  for (int i=0; i<state.local.count(); i++)
   {
-    project->setDtStart(KDateTime::fromString(soapItem["date_starting"], KDateTime::ISODate));
-    project->setDateTime(KDateTime::fromString(soapItem["date_starting"], KDateTime::ISODate), KCalCore::IncidenceBase::RoleDisplayStart);
+    // Items still being added to SugarCRM have no remoteId yet
+    SugarRemoteId remoteId = SugarRemoteId::decode(state.local.at(i).remoteId());
+    if (remoteId.isValid())
+      local.append(qMakePair(remoteId.id(), i));
   }
-  if (!soapItem["date_ending"].isEmpty())
+  qSort(local);
+  qSort(state.remote);
+  QVector<QString>::const_iterator remote = state.remote.constBegin();
+  for (int i=0; i<local.count(); i++)
   {
-    project->setDtDue(KDateTime::fromString(soapItem["date_ending"], KDateTime::ISODate));
-    project->setDateTime(KDateTime::fromString(soapItem["date_ending"], KDateTime::ISODate), KCalCore::IncidenceBase::RoleDisplayEnd);
+    while ((remote != state.remote.constEnd()) && (*remote < local.at(i).first))
+      remote++;
+    if ((remote == state.remote.constEnd()) || (*remote != local.at(i).first))
+      state.stale.insert(local.at(i).first, state.local.at(local.at(i).second));
+  }
+  state.local.clear();
+  state.remote.clear();
+  if (state.stale.isEmpty())
+  {
+    finishReconcile(mod);
+    return;
   }
 
-  if (!soapItem["project_phase"].isEmpty())
+  // Entries changing while they were listed may have been skipped, so
+  // only the ones SugarCRM does not return by id either are stale
+  QString filter = moduleFilter(mod);
+  QStringList ids = state.stale.keys();
+  const int chunk = 100;
+  for (int first=0; first<ids.count(); first+=chunk)
   {
-    if (soapItem["project_phase"] == "Active - Starting Soon")
-      project->setStatus(KCalCore::Incidence::StatusConfirmed);
-    else if (soapItem["project_phase"] == "Active - In Progress")
-      project->setStatus(KCalCore::Incidence::StatusInProcess);
-    else if (soapItem["project_phase"] == "Closed - Complete")
-      project->setStatus(KCalCore::Incidence::StatusCompleted);
-    else if (soapItem["project_phase"] == "Closed - Terminated")
-      project->setStatus(KCalCore::Incidence::StatusCompleted);
-    else
-      project->setCustomStatus(soapItem["project_phase"]);
-    project->setCustomProperty("SugarCRM", "X-Status", soapItem["project_phase"]);
+    QStringList quoted;
+    foreach (QString id, ids.mid(first, chunk))
+      quoted << "'" + id.replace("'", "''") + "'";
+    QString query = "id IN (" + quoted.join(", ") + ")";
+    if (!filter.isEmpty())
+      query = "(" + filter + ") AND " + query;
+    SugarReply *check = soap->getEntries(mod, QString(), QString(), false, query);
+    connect(check, SIGNAL(finished(SugarReply*)), this, SLOT(reconcileCandidatesReceived(SugarReply*)));
+    state.pending_checks++;
   }
+}
 
-  project->setPercentComplete(soapItem["percent_complete"].toInt());
+/*!
+ * Keeps the items whose entries SugarCRM returned by id and, once every
+ * check is done, removes the rest in a single batch.
+ * \param[in] reply Reply to a getEntries() request issued by reconcileEntriesReceived().
+ */
+void SugarCrmResource::reconcileCandidatesReceived(SugarReply *reply)
+{
+  reply->deleteLater();
+  QString mod = reply->module();
+  reconciliation &state = reconciliations[mod];
+  if (reply->hasError())
+    state.failed = true;
+  QVector<SugarRecord> entries = reply->entries();
+  for (int i=0; i<entries.count(); i++)
+    state.stale.remove(entries.at(i)[SugarSchema::Id]);
+  if (--state.pending_checks > 0)
+    return;
 
-  Item newItem(item);
-  newItem.setPayload<KCalCore::Todo::Ptr>(project);
-  return newItem;
+  if ((!state.failed) && (!state.stale.isEmpty()))
+  {
+    qDebug("Removing %d stale items from %s", state.stale.count(), mod.toLatin1().constData());
+    ItemDeleteJob *job = new ItemDeleteJob(state.stale.values().toVector(), this);
+    job->setProperty("module", mod);
+    connect(job, SIGNAL(result(KJob*)), this, SLOT(reconcileItemsRemoved(KJob*)));
+    return;
+  }
+  finishReconcile(mod);
 }
 
 /*!
- * Receives an Akonadi::Item containing KCalCore::Todo payload and
- * converts this payload to a SOAP assocative array to be stored
- * in SugarCRM as a project.
- * \param[in] item The item whose payload will be converted.
- * \return A new QHash dictionary with item attributes.
+ * Finishes the reconciliation of a module once its stale items are removed.
+ * \param[in] job Job that removed the stale items.
  */
-QHash<QString, QString> SugarCrmResource::projectSoap(const Akonadi::Item &item)
+void SugarCrmResource::reconcileItemsRemoved(KJob *job)
 {
-  const KCalCore::Todo::Ptr &payload = item.payload<KCalCore::Todo::Ptr>();
-  QHash<QString, QString> soapItem;
-
-  soapItem["name"] = payload->summary();
-  soapItem["description"] = payload->description();
-  soapItem["date_entered"] = payload->created().toString(KDateTime::ISODate);
-  if (payload->hasStartDate())
-    soapItem["date_starting"] = payload->dtStart().toString(KDateTime::ISODate);
-  if (payload->hasDueDate())
-    soapItem["date_ending"] = payload->dtDue().toString(KDateTime::ISODate);
-  soapItem["percent_complete"] = QString::number(payload->percentComplete());
+  if (job->error() != 0)
+    qDebug("Unable to remove stale items: %s", job->errorString().toLatin1().constData());
+  finishReconcile(job->property("module").toString());
+}
 
-  if (!payload->customProperty("SugarCRM", "X-Status").isEmpty())
-    soapItem["project_phase"] = payload->customProperty("SugarCRM", "X-Status");
-  else
-    switch (payload->status())
-    {
-      case KCalCore::Incidence::StatusConfirmed:
-        soapItem["project_phase"] = "Active - Starting Soon";
-        break;
-      case KCalCore::Incidence::StatusInProcess:
-        soapItem["project_phase"] = "Active - In Progress";
-        break;
-      case KCalCore::Incidence::StatusCompleted:
-        soapItem["project_phase"] = "Closed - Complete";
-        break;
-      case KCalCore::Incidence::StatusX:
-        soapItem["project_phase"] = payload->customStatus();
-        break;
-      default:
-        // Just to avoid warnings
-        break;
-    }
+/*!
+ * Drops the state of the reconciliation of a module and schedules the
+ * next reconciliation once every module is done.
+ * \param[in] module Module whose reconciliation is over.
+ */
+void SugarCrmResource::finishReconcile(const QString &module)
+{
+  reconciliations.remove(module);
+  if (--pending_reconciles == 0)
+    scheduleReconcile();
+}
 
-  return soapItem;
+/*!
+ * \param[in] module Module whose fields and filter are hashed.
+ * \return Hash of the fields requested for \a module and of its filter as
+ * configured, so %days() does not change it every day. Never 0.
+ */
+uint SugarCrmResource::schemaHash(const QString &module) const
+{
+  uint hash = qHash(soap->fields(module).join(",") + '\n' + configuredFilter(module));
+  return (hash == 0)? 1 : hash;
 }
 
 void SugarCrmResource::aboutToQuit()
@@ -883,34 +1426,127 @@ void SugarCrmResource::configure(const WId windowId)
       configDlg.setUpdateInterval(Settings::self()->updateInterval());
     }
   }
+  QMap<QString, QString> filters;
+  foreach (const QString &module, SugarCrmResource::Modules.keys())
+    filters[module] = QString();
+  foreach (const QString &filter, Settings::self()->moduleFilters())
+  {
+    int separator = filter.indexOf('=');
+    if (separator > 0)
+      filters[filter.left(separator)] = filter.mid(separator + 1);
+  }
+  configDlg.setFilters(filters);
+  QMap<QString, QString> fields;
+  foreach (const QString &entry, Settings::self()->moduleFields())
+  {
+    int separator = entry.indexOf('=');
+    if (separator > 0)
+      fields[entry.left(separator)] = entry.mid(separator + 1);
+  }
+  configDlg.setFields(fields);
+
+  showConfigDialog();
+}
 
-  do
+/*!
+ * Creates a connection to the configured SugarCRM server, which lists
+ * entries with the page sizes remembered from previous runs.
+ * \return The new connection, owned by the resource.
+ */
+SugarSoap *SugarCrmResource::newSoap()
+{
+  SugarSoap *connection = new SugarSoap(Settings::self()->url().url(), QString(), this);
+  connection->setBackgroundConnections(Settings::self()->initialLoadConnections());
+  foreach (const QString &module, Modules.keys())
   {
-    if (configDlg.exec() == QDialog::Rejected)
-      break;
-    // Test if supplied data is correct
-    SugarSoap soap(configDlg.url());
-    // TODO timeout
-    Settings::self()->setSessionId(soap.login(configDlg.username(), configDlg.password()));
-    if (Settings::self()->sessionId().isEmpty())
-      QMessageBox::critical(&configDlg, "Invalid login", "Cannot login with provided data");
-  } while (Settings::self()->sessionId().isEmpty());
+    for (int full_entries=0; full_entries<2; full_entries++)
+    {
+      int size = metadata.pageSize(module, full_entries);
+      if (size > 0)
+        connection->setPageSize(module, full_entries, size);
+    }
+  }
+  connect(connection, SIGNAL(pageSizeChanged(QString,bool,int)), this, SLOT(pageSizeChanged(QString,bool,int)));
+  return connection;
+}
 
-  if (Settings::self()->sessionId().isEmpty())
+/*!
+ * Remembers the page size a connection adapted to for the next runs.
+ * \param[in] module Module whose entries are listed.
+ * \param[in] full_entries Whether the listing gets every field or ids and timestamps only.
+ * \param[in] size Number of entries in every page.
+ */
+void SugarCrmResource::pageSizeChanged(const QString &module, bool full_entries, int size)
+{
+  metadata.setPageSize(module, full_entries, size);
+}
+
+/*!
+ * Shows the configuration dialog and, if it is accepted, tests the supplied login data.
+ */
+void SugarCrmResource::showConfigDialog()
+{
+  if (configDlg.exec() == QDialog::Rejected)
   {
     emit configurationDialogRejected();
     return;
   }
 
+  // Test if supplied data is correct
+  SugarSoap *test = new SugarSoap(configDlg.url(), QString(), this);
+  // TODO timeout
+  SugarReply *reply = test->login(configDlg.username(), configDlg.password());
+  connect(reply, SIGNAL(finished(SugarReply*)), this, SLOT(configLoginFinished(SugarReply*)));
+}
+
+/*!
+ * Stores the configuration if login with the supplied data was successful
+ * or shows the configuration dialog again otherwise.
+ * \param[in] reply Reply to the login request issued by showConfigDialog().
+ */
+void SugarCrmResource::configLoginFinished(SugarReply *reply)
+{
+  // The reply belongs to the SugarSoap object used only for this test
+  reply->parent()->deleteLater();
+  Settings::self()->setSessionId(reply->sessionId());
+  if (Settings::self()->sessionId().isEmpty())
+  {
+    QMessageBox::critical(&configDlg, "Invalid login", "Cannot login with provided data");
+    showConfigDialog();
+    return;
+  }
+
   // Sotre configuration values
   Settings::self()->setUrl(configDlg.url());
   Settings::self()->setUsername(configDlg.username());
   Settings::self()->setPassword(configDlg.password());
   Settings::self()->setUpdateInterval(configDlg.updateInterval() * (configDlg.updateUnits() == 0? 1 : 60));
+  QStringList filters;
+  QMap<QString, QString> moduleFilters = configDlg.filters();
+  for (QMap<QString, QString>::const_iterator filter = moduleFilters.constBegin(); filter != moduleFilters.constEnd(); filter++)
+    if (!filter.value().trimmed().isEmpty())
+      filters << filter.key() + "=" + filter.value().trimmed();
+  Settings::self()->setModuleFilters(filters);
+  QStringList fields;
+  QMap<QString, QString> moduleFields = configDlg.fields();
+  for (QMap<QString, QString>::const_iterator selection = moduleFields.constBegin(); selection != moduleFields.constEnd(); selection++)
+    if (!selection.value().trimmed().isEmpty())
+      fields << selection.key() + "=" + selection.value().trimmed();
+  Settings::self()->setModuleFields(fields);
 
   // And write configuration file
   Settings::self()->writeConfig();
 
+  // Further requests go to the new server with the new credentials,
+  // which may have other modules and fields. Requests still pending on
+  // the previous one fail, so the tasks and passes waiting for them end
+  metadata.clear();
+  SugarSoap *previous = soap;
+  soap = newSoap();
+  previous->abort(i18n("The connection settings have changed"));
+  previous->deleteLater();
+  selectFields();
+
   emit configurationDialogAccepted();
 
   // If this is first configuration, start synchronization
@@ -931,30 +1567,55 @@ void SugarCrmResource::itemAdded( const Akonadi::Item &item, const Akonadi::Coll
   if (!SugarCrmResource::Modules.contains(mod))
     return;
 
-  QString *id = new QString();
+  SugarReply *reply = soap->editEntry(mod, SugarCrmResource::Modules[mod].mapping->soap(item));
+  reply->setProperty("item", QVariant::fromValue(item));
+  connect(reply, SIGNAL(finished(SugarReply*)), this, SLOT(entryAdded(SugarReply*)));
+}
+
+/*!
+ * Commits an item added to SugarCRM by itemAdded() with its new remoteId.
+ * \param[in] reply Reply to the editEntry() request issued by itemAdded().
+ */
+void SugarCrmResource::entryAdded(SugarReply *reply)
+{
+  reply->deleteLater();
+  if (reply->hasError())
+  {
+    cancelTask(reply->errorString());
+    return;
+  }
+
+  QString mod = reply->module();
+  Item newItem = reply->property("item").value<Item>();
+  newItem.setRemoteId(SugarRemoteId::encode(reply->id(), mod));
+  if (mod == "Cases")
+  {
+    // Refetch payload to get case name, still part of replaying the
+    // addition, so it does not take the interactive connection
+    SugarReply *entryReply = soap->getEntry(mod, reply->id(), SugarReply::ChangeReplay);
+    entryReply->setProperty("item", QVariant::fromValue(newItem));
+    connect(entryReply, SIGNAL(finished(SugarReply*)), this, SLOT(addedEntryReceived(SugarReply*)));
+    return;
+  }
+  changeCommitted(newItem);
+}
 
-  SugarSoap soap(Settings::self()->url().url());
-  if (soap.editEntry(
-    mod,
-    (this->*SugarCrmResource::Modules[mod].soap_function)(item),
-    id
-  ))
+/*!
+ * Commits a case added to SugarCRM once its data has been fetched again.
+ * \param[in] reply Reply to the getEntry() request issued by entryAdded().
+ */
+void SugarCrmResource::addedEntryReceived(SugarReply *reply)
+{
+  reply->deleteLater();
+  Item newItem = reply->property("item").value<Item>();
+  if (!reply->hasError())
   {
-    Item newItem(item);
-    newItem.setRemoteId(*id + "@" + mod);
-    if (mod == "Cases")
-    {
-      // Refetch payload to get case name
-      QHash<QString, QString> *soapItem = soap.getEntry(mod, *id);
-      Item tmpItem = taskPayload(*soapItem, newItem);
-      delete soapItem;
-      KCalCore::Todo::Ptr payload = tmpItem.payload<KCalCore::Todo::Ptr>();
-      // FIXME this doesn't work
-      newItem.payload<KCalCore::Todo::Ptr>().swap(payload);
-    }
-    changeCommitted(newItem);
+    Item tmpItem = SugarCrmResource::Modules[reply->module()].mapping->payload(reply->entry(), newItem);
+    KCalCore::Todo::Ptr payload = tmpItem.payload<KCalCore::Todo::Ptr>();
+    // FIXME this doesn't work
+    newItem.payload<KCalCore::Todo::Ptr>().swap(payload);
   }
-  delete id;
+  changeCommitted(newItem);
 }
 
 /*!
@@ -967,21 +1628,15 @@ void SugarCrmResource::itemChanged( const Akonadi::Item &item, const QSet<QByteA
 {
   Q_UNUSED(parts);
 
-  QString mod = item.remoteId().replace(QRegExp(".*@"), "");
-  QString *remoteId = new QString(item.remoteId().replace(QRegExp("@" + mod + "$"), ""));
   // Check if the module we got is valid
-  if (!SugarCrmResource::Modules.contains(mod))
+  SugarRemoteId remoteId = SugarRemoteId::decode(item.remoteId());
+  if (!remoteId.isValid())
     return;
 
-  SugarSoap soap(Settings::self()->url().url());
-
-  if (soap.editEntry(
-    mod,
-    (this->*SugarCrmResource::Modules[mod].soap_function)(item),
-    remoteId
-  ))
-    changeCommitted(Item(item));
-  delete remoteId;
+  QString mod = remoteId.module();
+  SugarReply *reply = soap->editEntry(mod, SugarCrmResource::Modules[mod].mapping->soap(item), remoteId.id());
+  reply->setProperty("item", QVariant::fromValue(item));
+  connect(reply, SIGNAL(finished(SugarReply*)), this, SLOT(changeReplied(SugarReply*)));
 }
 
 /*!
@@ -991,23 +1646,33 @@ void SugarCrmResource::itemChanged( const Akonadi::Item &item, const QSet<QByteA
  */
 void SugarCrmResource::itemRemoved( const Akonadi::Item &item )
 {
-  QString mod = item.remoteId().replace(QRegExp(".*@"), "");
-  QString *remoteId = new QString(item.remoteId().replace(QRegExp("@" + mod + "$"), ""));
   // Check if the module we got is valid
-  if (!SugarCrmResource::Modules.contains(mod))
+  SugarRemoteId remoteId = SugarRemoteId::decode(item.remoteId());
+  if (!remoteId.isValid())
     return;
-  SugarSoap soap(Settings::self()->url().url());
 
-  QHash<QString, QString> soapItem;
-  soapItem["deleted"] = "1";
+  QString mod = remoteId.module();
+  SugarRecord soapItem(SugarCrmResource::Modules[mod].schema);
+  soapItem.set(SugarSchema::Deleted, "1");
+
+  SugarReply *reply = soap->editEntry(mod, soapItem, remoteId.id());
+  reply->setProperty("item", QVariant::fromValue(item));
+  connect(reply, SIGNAL(finished(SugarReply*)), this, SLOT(changeReplied(SugarReply*)));
+}
 
-  if (soap.editEntry(
-    mod,
-    soapItem,
-    remoteId
-  ))
-    changeCommitted(Item(item));
-  delete remoteId;
+/*!
+ * Commits a change that has been replayed to SugarCRM.
+ * \param[in] reply Reply to the editEntry() request issued by itemChanged() or itemRemoved().
+ */
+void SugarCrmResource::changeReplied(SugarReply *reply)
+{
+  reply->deleteLater();
+  if (reply->hasError())
+  {
+    cancelTask(reply->errorString());
+    return;
+  }
+  changeCommitted(reply->property("item").value<Item>());
 }
 
 AKONADI_RESOURCE_MAIN( SugarCrmResource );
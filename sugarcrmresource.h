@@ -22,12 +22,20 @@
 #define SUGARCRMRESOURCE_H
 
 #include <Akonadi/ResourceBase>
-#include <KABC/PhoneNumber>
+#include <QFuture>
 #include "sugarsoap.h"
+#include "sugarrecord.h"
+#include "sugarmapping.h"
+#include "sugarmetadata.h"
+#include "synccursorattribute.h"
+#include "synccheckpointattribute.h"
 #include "sugarconfig.h"
 
 struct module;
 struct resource_collection;
+struct module_update;
+struct reconciliation;
+struct listing;
 
 class SugarCrmResource : public Akonadi::ResourceBase,
                            public Akonadi::AgentBase::Observer
@@ -39,14 +47,110 @@ class SugarCrmResource : public Akonadi::ResourceBase,
     ~SugarCrmResource();
     static QHash<QString, module> Modules;
 
+    /*! Slots of the records of Contacts and Leads. */
+    enum ContactField
+    {
+      ContactSalutation = SugarSchema::FirstModuleField,
+      ContactFirstName,
+      ContactLastName,
+      ContactBirthdate,
+      ContactEmail1,
+      ContactEmail2,
+      ContactPhoneHome,
+      ContactPhoneMobile,
+      ContactPhoneWork,
+      ContactPhoneFax,
+      ContactPhoneOther,
+      ContactPrimaryStreet,
+      ContactPrimaryCity,
+      ContactPrimaryState,
+      ContactPrimaryPostalCode,
+      ContactPrimaryCountry,
+      ContactAltStreet,
+      ContactAltCity,
+      ContactAltState,
+      ContactAltPostalCode,
+      ContactAltCountry,
+      ContactAccountName,
+      ContactTitle,
+      ContactDepartment,
+      ContactDescription,
+      ContactFieldCount
+    };
+    /*! Slots of the records of Tasks and Cases. */
+    enum TaskField
+    {
+      TaskName = SugarSchema::FirstModuleField,
+      TaskDescription,
+      TaskStatus,
+      TaskPriority,
+      TaskDateDueFlag,
+      TaskDateDue,
+      TaskDateStartFlag,
+      TaskDateStart,
+      TaskCaseNumber,
+      TaskFieldCount
+    };
+    /*! Slots of the records of Project. */
+    enum ProjectField
+    {
+      ProjectName = SugarSchema::FirstModuleField,
+      ProjectDescription,
+      ProjectPercentComplete,
+      ProjectPhase,
+      ProjectDateEnding,
+      ProjectDateStarting,
+      ProjectFieldCount
+    };
+    /*! Slots of the records of Booking. */
+    enum BookingField
+    {
+      BookingName = SugarSchema::FirstModuleField,
+      BookingStatus,
+      BookingQuantity,
+      BookingDateStart,
+      BookingRelatedType,
+      BookingRelatedId,
+      BookingFieldCount
+    };
+
   private Q_SLOTS:
     virtual void configure(const WId windowId);
     void retrieveCollections();
     void retrieveItems(const Akonadi::Collection &col);
     bool retrieveItem(const Akonadi::Item &item, const QSet<QByteArray> &parts);
     void resourceCollectionsRetrieved(KJob *job);
-    void finishUpdateCollectionSyncTime(KJob *job);
+    void finishUpdateCollection(KJob *job);
+    void itemSyncBatchCommitted();
     void update();
+    void serverTimeReceived(SugarReply *reply);
+    void resyncItemsFetched(KJob *job);
+    void updatePageReceived(SugarReply *reply);
+    void updateEntriesReceived(SugarReply *reply);
+    void excludedItemsFetched(KJob *job);
+    void updateItemsRemoved(KJob *job);
+    void updatePayloadsReady();
+    void updateItemFetched(KJob *job);
+    void updateItemDone(KJob *job);
+    void serverVersionReceived(SugarReply *reply);
+    void modulesReceived(SugarReply *reply);
+    void moduleFieldsReceived(SugarReply *reply);
+    void listingTimeReceived(SugarReply *reply);
+    void entryPageReceived(SugarReply *reply);
+    void entriesReceived(SugarReply *reply);
+    void entryReceived(SugarReply *reply);
+    void payloadReady();
+    void configLoginFinished(SugarReply *reply);
+    void entryAdded(SugarReply *reply);
+    void addedEntryReceived(SugarReply *reply);
+    void changeReplied(SugarReply *reply);
+    void pageSizeChanged(const QString &module, bool full_entries, int size);
+    void reconcile();
+    void reconcileItemsFetched(KJob *job);
+    void reconcilePageReceived(SugarReply *reply);
+    void reconcileEntriesReceived(SugarReply *reply);
+    void reconcileCandidatesReceived(SugarReply *reply);
+    void reconcileItemsRemoved(KJob *job);
 
   private:
     virtual void aboutToQuit();
@@ -54,17 +158,39 @@ class SugarCrmResource : public Akonadi::ResourceBase,
     virtual void itemChanged(const Akonadi::Item &item, const QSet<QByteArray> &parts);
     virtual void itemRemoved(const Akonadi::Item &item);
     SugarConfig configDlg;
-    Akonadi::Item contactPayload(const QHash<QString, QString> &soapItem, const Akonadi::Item &item);
-    Akonadi::Item taskPayload(const QHash<QString, QString> &soapItem, const Akonadi::Item &item);
-    Akonadi::Item bookingPayload(const QHash<QString, QString> &soapItem, const Akonadi::Item &item);
-    Akonadi::Item projectPayload(const QHash<QString, QString> &soapItem, const Akonadi::Item &item);
-    QHash<QString, QString> contactSoap(const Akonadi::Item &item);
-    QHash<QString, QString> taskSoap(const Akonadi::Item &item);
-    QHash<QString, QString> bookingSoap(const Akonadi::Item &item);
-    QHash<QString, QString> projectSoap(const Akonadi::Item &item);
-    QMap<QString, KABC::PhoneNumber::Type> phones;
+    SugarSoap *soap;
+    int pending_updates;
+    int clock_offset;
+    int pending_reconciles;
+    bool reconcile_scheduled;
+    SugarMetadata metadata;
+    void showConfigDialog();
+    SugarSoap *newSoap();
+    QString configuredFilter(const QString &module) const;
+    QString moduleFilter(const QString &module) const;
+    void selectFields();
+    void selectFields(const QString &module, const QStringList &selection, const QStringList &available);
+    void reportCollections(const Akonadi::Collection &root, const QStringList &modules);
+    static void registerModules();
+    struct PayloadMapper;
+    Akonadi::Item payload(const QString &module, const SugarRecord &soapItem, const Akonadi::Item &item);
+    QFuture<Akonadi::Item> payloads(const QString &module, const QVector<SugarRecord> &entries, const Akonadi::Collection &collection);
     QMap<QString, resource_collection> resource_collections;
-    void updateCollectionSyncTime(Akonadi::Collection collection, QDateTime time);
+    QHash<QString, module_update> updates;
+    QHash<QString, reconciliation> reconciliations;
+    QHash<QString, listing> listings;
+    QStringList listingPartitions() const;
+    void startPartitions(const QString &module);
+    void finishListing(const QString &module);
+    void applyUpdatedEntries(const QString &module, const QVector<SugarRecord> &entries, const QString &last_sync);
+    void checkUnlistedItems(const QString &module);
+    void removeUpdatedItems(const QString &module, const Akonadi::Item::List &items);
+    void finishUpdateStep(const QString &module);
+    void scheduleReconcile();
+    void finishReconcile(const QString &module);
+    void updateCollectionCursor(Akonadi::Collection collection, const Akonadi::SyncCursorAttribute &cursor);
+    uint schemaHash(const QString &module) const;
+    void updateCollectionCheckpoint(Akonadi::Collection collection, const Akonadi::SyncCheckpointAttribute &checkpoint);
 };
 
 /*! Structure containing module-dependent information. */
@@ -72,21 +198,80 @@ struct module
 {
   /*! List of strings containing the fields this module requires. */
   QStringList fields;
+  /*! Layout of the records of this module. */
+  SugarSchema schema;
   /*! List of media types implemented by this module. */
   QStringList mimes;
-  /*! Pointer to the module-dependent method to convert from a SugarCRM SOAP struct to a kdepimlibs object. */
-  Akonadi::Item (SugarCrmResource::*payload_function)(const QHash<QString, QString> &, const Akonadi::Item &);
-  /*! Pointer to the module-dependent method to convert from a kdepimlibs object to a SOAP struct. */
-  QHash<QString, QString> (SugarCrmResource::*soap_function)(const Akonadi::Item &);
+  /*! Field mapping to convert between SugarCRM records and kdepimlibs objects. */
+  QSharedPointer<SugarMappingBase> mapping;
 };
 
-/*! Structure used to store Akonadi id and time of last synchronization for each SugarCRM module. */
+/*! Structure used to store Akonadi id and position of last synchronization for each SugarCRM module. */
 struct resource_collection
 {
   /*! Identifier of the collection in Akonadi. */
   Akonadi::Collection::Id id;
-  /*! Last time this collection was synchronized. */
-  QDateTime *last_sync;
+  /*! Position of the last synchronization, null if this collection was never synchronized. */
+  Akonadi::SyncCursorAttribute cursor;
+};
+
+/*! Structure used to store the state of the update of a SugarCRM module. */
+struct module_update
+{
+  /*! Position of the last change received, where the cursor moves once every change has been applied. */
+  Akonadi::SyncCursorAttribute cursor;
+  /*! Hash of the fields requested when the update started. */
+  uint hash;
+  /*! Number of requests, conversions and Akonadi jobs still running. */
+  int pending;
+  /*! Whether any of them failed, so the cursor must stay where it was. */
+  bool failed;
+  /*! Items of the collection in Akonadi, while the module is fetched again. */
+  Akonadi::Item::List local;
+  /*! Identifiers of the entries listed while the module is fetched again. */
+  QVector<QString> listed;
+  /*! Identifiers of the entries that stopped matching the filter. */
+  QVector<QString> excluded;
+  /*! Items whose entries were not listed, by entry identifier. */
+  QHash<QString, Akonadi::Item> stale;
+  /*! Number of checks of stale items still running. */
+  int pending_checks;
+};
+
+/*! Structure used to store the state of the initial listing of a SugarCRM module. */
+struct listing
+{
+  /*! Collection being listed. */
+  Akonadi::Collection collection;
+  /*! Whether the listing resumes an interrupted one, so it only adds items. */
+  bool resumed;
+  /*! Lower bounds of the ids of every partition, sorted. */
+  QStringList partitions;
+  /*! Partitions not started yet. */
+  QStringList pending;
+  /*! Number of partitions being listed. */
+  int running;
+  /*! How far each partition got. */
+  Akonadi::SyncCheckpointAttribute checkpoint;
+  /*! Whether the checkpoint moved since it was last stored. */
+  bool unsaved;
+  /*! Error of the first partition that failed, if any. */
+  QString error;
+};
+
+/*! Structure used to store the state of the reconciliation of a SugarCRM module. */
+struct reconciliation
+{
+  /*! Items of the collection in Akonadi. */
+  Akonadi::Item::List local;
+  /*! Identifiers of the entries listed by SugarCRM. */
+  QVector<QString> remote;
+  /*! Items whose entries were not listed by SugarCRM, by entry identifier. */
+  QHash<QString, Akonadi::Item> stale;
+  /*! Number of checks of stale items still running. */
+  int pending_checks;
+  /*! Whether a check failed, so nothing can be removed safely. */
+  bool failed;
 };
 
 #endif
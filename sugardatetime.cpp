@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2013, 2014 Jesús Pérez (a) Chuso <kde at chuso dot net>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Library General Public License as published
+ * by the Free Software Foundation; either version 2 of the License or
+ * ( at your option ) version 3 or, at the discretion of KDE e.V.
+ * ( which shall act as a proxy as in section 14 of the GPLv3 ), any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "sugardatetime.h"
+
+namespace
+{
+  // Built before the thread pool is ever used, so it can be shared by
+  // every payload conversion
+  const KDateTime::Spec utcSpec(KDateTime::UTC);
+
+  /*
+   * Reads exactly count decimal digits from p, advancing it.
+   */
+  inline bool digits(const QChar *&p, const QChar *end, int count, int *value)
+  {
+    if (end - p < count)
+      return false;
+    int v = 0;
+    for (int i=0; i<count; i++, p++)
+    {
+      ushort c = p->unicode() - '0';
+      if (c > 9)
+        return false;
+      v = v*10 + c;
+    }
+    *value = v;
+    return true;
+  }
+}
+
+/*!
+ * \class SugarDateTime
+ * \brief The SugarDateTime class parses the timestamps used by SugarCRM.
+ *
+ * SugarCRM sends dates as <code>YYYY-MM-DD</code> and times as
+ * <code>YYYY-MM-DD HH:MM:SS</code>, in GMT. Values written back by us are in
+ * ISO 8601, so a <code>T</code> separator, fractions of second and a UTC
+ * offset are accepted as well. Parsing works on the string data directly,
+ * without allocating, which makes it much cheaper than
+ * KDateTime::fromString() for the several timestamps every entry has.
+ */
+
+/*!
+ * Splits a timestamp into its parts.
+ * \param[in] text Date or date and time to parse.
+ * \param[out] date Date read from \a text.
+ * \param[out] time Time read from \a text, or an invalid QTime if it only has a date.
+ * \param[out] offset Offset from UTC in seconds, or NoOffset if \a text has none.
+ * \return Whether \a text is a valid timestamp.
+ */
+bool SugarDateTime::parse(const QString &text, QDate *date, QTime *time, int *offset)
+{
+  const QChar *p = text.constData();
+  const QChar *end = p + text.size();
+  int year, month, day, hour, minute, second = 0, msec = 0;
+  *offset = NoOffset;
+  *time = QTime();
+
+  if ((!digits(p, end, 4, &year)) || (p == end) || (*p++ != '-') ||
+      (!digits(p, end, 2, &month)) || (p == end) || (*p++ != '-') ||
+      (!digits(p, end, 2, &day)))
+    return false;
+  *date = QDate(year, month, day);
+  if (!date->isValid())
+    return false;
+  if (p == end)
+    return true;
+
+  if ((*p != ' ') && (*p != 'T'))
+    return false;
+  p++;
+  if ((!digits(p, end, 2, &hour)) || (p == end) || (*p++ != ':') ||
+      (!digits(p, end, 2, &minute)))
+    return false;
+  if ((p != end) && (*p == ':'))
+  {
+    p++;
+    if (!digits(p, end, 2, &second))
+      return false;
+    if ((p != end) && ((*p == '.') || (*p == ',')))
+    {
+      // Only milliseconds are kept
+      p++;
+      int scale = 100;
+      if ((p == end) || (!p->isDigit()))
+        return false;
+      for (; (p != end) && (p->isDigit()); p++, scale /= 10)
+        msec += p->digitValue() * scale;
+    }
+  }
+  *time = QTime(hour, minute, second, msec);
+  if (!time->isValid())
+    return false;
+  if (p == end)
+    return true;
+
+  if (*p == 'Z')
+  {
+    *offset = 0;
+    return (++p == end);
+  }
+  if ((*p != '+') && (*p != '-'))
+    return false;
+  int sign = (*p++ == '-')? -1 : 1;
+  int offset_hours, offset_minutes = 0;
+  if (!digits(p, end, 2, &offset_hours))
+    return false;
+  if ((p != end) && (*p == ':'))
+    p++;
+  if ((p != end) && (!digits(p, end, 2, &offset_minutes)))
+    return false;
+  *offset = sign * (offset_hours*3600 + offset_minutes*60);
+  return (p == end);
+}
+
+/*!
+ * Converts a SugarCRM timestamp into a QDateTime. As QDateTime::fromString(),
+ * timestamps without UTC offset are taken as local time.
+ * \param[in] text Date or date and time to convert.
+ * \return The timestamp, or an invalid QDateTime if \a text is not valid.
+ */
+QDateTime SugarDateTime::toQDateTime(const QString &text)
+{
+  QDate date;
+  QTime time;
+  int offset;
+  if (!parse(text, &date, &time, &offset))
+    return QDateTime();
+  if (!time.isValid())
+    return QDateTime(date);
+  if (offset == NoOffset)
+    return QDateTime(date, time);
+  return QDateTime(date, time, Qt::UTC).addSecs(-offset);
+}
+
+/*!
+ * Converts a SugarCRM timestamp into a KDateTime. Timestamps without UTC
+ * offset are taken as UTC, as the server sends them.
+ * \param[in] text Date or date and time to convert.
+ * \return The timestamp, date-only if \a text has no time, or an invalid KDateTime if \a text is not valid.
+ */
+KDateTime SugarDateTime::toKDateTime(const QString &text)
+{
+  QDate date;
+  QTime time;
+  int offset;
+  if (!parse(text, &date, &time, &offset))
+    return KDateTime();
+  if (!time.isValid())
+    return KDateTime(date, utcSpec);
+  if ((offset == NoOffset) || (offset == 0))
+    return KDateTime(date, time, utcSpec);
+  return KDateTime(date, time, KDateTime::Spec::OffsetFromUTC(offset));
+}
+
+/*!
+ * \return The UTC time specification, shared by every KDateTime this class builds.
+ */
+const KDateTime::Spec &SugarDateTime::utc()
+{
+  return utcSpec;
+}
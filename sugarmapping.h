@@ -0,0 +1,358 @@
+/*
+ * Copyright (c) 2013, 2014 Jesús Pérez (a) Chuso <kde at chuso dot net>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Library General Public License as published
+ * by the Free Software Foundation; either version 2 of the License or
+ * ( at your option ) version 3 or, at the discretion of KDE e.V.
+ * ( which shall act as a proxy as in section 14 of the GPLv3 ), any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef SUGARMAPPING_H
+#define SUGARMAPPING_H
+
+#include <QHash>
+#include <QVector>
+#include <QSharedPointer>
+#include <Akonadi/Item>
+#include "sugarrecord.h"
+#include "sugardatetime.h"
+
+/*!
+ * \class SugarPayloadTraits
+ * \brief Describes how a payload type is created and where its properties are.
+ *
+ * Value payloads such as KABC::Addressee are their own object, shared
+ * pointer payloads such as KCalCore::Todo::Ptr point to it.
+ */
+template <class P>
+struct SugarPayloadTraits
+{
+  typedef P Object;
+  static P create() { return P(); }
+  static Object &object(P &payload) { return payload; }
+};
+
+template <class T>
+struct SugarPayloadTraits<QSharedPointer<T> >
+{
+  typedef T Object;
+  static QSharedPointer<T> create() { return QSharedPointer<T>(new T); }
+  static Object &object(QSharedPointer<T> &payload) { return *payload; }
+};
+
+/*! A SugarCRM value and the payload value it maps to. */
+struct SugarEnumValue
+{
+  const char *sugar;
+  int value;
+};
+
+/*!
+ * \class SugarMappingBase
+ * \brief The SugarMappingBase class converts between SugarCRM records and Akonadi items of a module.
+ */
+class SugarMappingBase
+{
+  public:
+    virtual ~SugarMappingBase() {}
+    /*!
+     * Converts a record to an item payload.
+     * \param[in] record Record of the module.
+     * \param[in] item The item whose payload will be populated.
+     * \return A new Akonadi::Item with its payload.
+     */
+    virtual Akonadi::Item payload(const SugarRecord &record, const Akonadi::Item &item) const = 0;
+    /*!
+     * Converts an item payload to a record.
+     * \param[in] item The item whose payload will be converted.
+     * \return A new SugarRecord with the item attributes.
+     */
+    virtual SugarRecord soap(const Akonadi::Item &item) const = 0;
+};
+
+/*!
+ * \class SugarMapping
+ * \brief The SugarMapping class is a declarative field mapping between a SugarCRM module and a payload type.
+ *
+ * Rules are added once, when the module is registered, and are applied in
+ * the order they were added in both directions. Every rule addresses its
+ * field by slot, enumeration rules keep precomputed lookup tables, so a
+ * conversion is a single pass over the rules. Fields spanning several
+ * slots or properties are handled by custom rules.
+ *
+ * A null setter or getter makes a rule one-way.
+ */
+template <class P>
+class SugarMapping : public SugarMappingBase
+{
+  public:
+    typedef typename SugarPayloadTraits<P>::Object Object;
+    typedef void (*TextSetter)(Object &, const QString &);
+    typedef QString (*TextGetter)(const Object &);
+    typedef void (*DateSetter)(Object &, const KDateTime &);
+    typedef void (*EnumSetter)(Object &, int);
+    typedef int (*EnumGetter)(const Object &);
+    typedef void (*RecordReader)(const SugarRecord &, Object &);
+    typedef void (*RecordWriter)(const Object &, SugarRecord &);
+
+    enum Option
+    {
+      /*! Empty values are neither read nor written. */
+      OmitEmpty = 1
+    };
+
+    /*!
+     * Constructs an empty mapping.
+     * \param[in] schema Layout of the records of the module.
+     */
+    explicit SugarMapping(const SugarSchema &schema)
+      : s(schema)
+    {
+    }
+
+    /*!
+     * Maps a field to a text property.
+     * \param[in] slot Slot of the field.
+     * \param[in] set Sets the property from the field value.
+     * \param[in] get Returns the property as field value.
+     * \param[in] options Combination of Option values.
+     * \return This mapping.
+     */
+    SugarMapping &text(int slot, TextSetter set, TextGetter get, int options = 0)
+    {
+      Rule rule(Text, slot);
+      rule.options = options;
+      rule.setText = set;
+      rule.getText = get;
+      rules.append(rule);
+      return *this;
+    }
+
+    /*!
+     * Maps a field to a date property. Empty fields are not read, null
+     * values returned by \a get are not written.
+     * \param[in] slot Slot of the field.
+     * \param[in] set Sets the property from the parsed field value.
+     * \param[in] get Returns the property as field value.
+     * \param[in] flag Slot of a field set to 1 when the date is written, if any.
+     * \return This mapping.
+     */
+    SugarMapping &date(int slot, DateSetter set, TextGetter get, int flag = -1)
+    {
+      Rule rule(Date, slot);
+      rule.flag = flag;
+      rule.setDate = set;
+      rule.getText = get;
+      rules.append(rule);
+      return *this;
+    }
+
+    /*!
+     * Maps a field to an enumerated property. When a payload value appears
+     * more than once in \a values, the first SugarCRM value is written.
+     * \param[in] slot Slot of the field.
+     * \param[in] values Table of SugarCRM values and their payload values.
+     * \param[in] count Number of entries in \a values.
+     * \param[in] set Sets the property.
+     * \param[in] get Returns the property.
+     * \param[in] fallbackSet Sets field values missing from \a values, if any.
+     * \param[in] fallbackGet Returns the field value for payload values missing from \a values, if any.
+     * \return This mapping.
+     */
+    SugarMapping &enumeration(int slot, const SugarEnumValue *values, int count, EnumSetter set, EnumGetter get, TextSetter fallbackSet = 0, TextGetter fallbackGet = 0)
+    {
+      Rule rule(Enum, slot);
+      rule.setEnum = set;
+      rule.getEnum = get;
+      rule.setText = fallbackSet;
+      rule.getText = fallbackGet;
+      for (int i=0; i<count; i++)
+      {
+        QString sugar = QString::fromLatin1(values[i].sugar);
+        rule.toValue.insert(sugar, values[i].value);
+        if (!rule.toSugar.contains(values[i].value))
+          rule.toSugar.insert(values[i].value, sugar);
+      }
+      rules.append(rule);
+      return *this;
+    }
+
+    /*!
+     * Adds a hand-written conversion for fields that are not one to one.
+     * \param[in] read Reads the fields from the record.
+     * \param[in] write Writes the fields to the record.
+     * \return This mapping.
+     */
+    SugarMapping &custom(RecordReader read, RecordWriter write)
+    {
+      Rule rule(Custom, -1);
+      rule.read = read;
+      rule.write = write;
+      rules.append(rule);
+      return *this;
+    }
+
+    /*!
+     * Sets the properties of a payload object from a record.
+     * \param[in] record Record of the module.
+     * \param[in,out] object Payload object to populate.
+     */
+    void read(const SugarRecord &record, Object &object) const
+    {
+      for (typename QVector<Rule>::const_iterator rule = rules.constBegin(); rule != rules.constEnd(); rule++)
+      {
+        if (rule->kind == Custom)
+        {
+          if (rule->read)
+            rule->read(record, object);
+          continue;
+        }
+        const QString &value = record[rule->slot];
+        switch (rule->kind)
+        {
+          case Text:
+            if ((rule->setText) && ((!(rule->options & OmitEmpty)) || (!value.isEmpty())))
+              rule->setText(object, value);
+            break;
+          case Date:
+            if ((rule->setDate) && (!value.isEmpty()))
+              rule->setDate(object, SugarDateTime::toKDateTime(value));
+            break;
+          case Enum:
+            if (!value.isEmpty())
+            {
+              QHash<QString, int>::const_iterator mapped = rule->toValue.constFind(value);
+              if (mapped != rule->toValue.constEnd())
+              {
+                if (rule->setEnum)
+                  rule->setEnum(object, mapped.value());
+              }
+              else if (rule->setText)
+                rule->setText(object, value);
+            }
+            break;
+          default:
+            break;
+        }
+      }
+    }
+
+    /*!
+     * Sets the fields of a record from a payload object.
+     * \param[in] object Payload object.
+     * \param[in,out] record Record of the module to populate.
+     */
+    void write(const Object &object, SugarRecord &record) const
+    {
+      for (typename QVector<Rule>::const_iterator rule = rules.constBegin(); rule != rules.constEnd(); rule++)
+      {
+        QString value;
+        switch (rule->kind)
+        {
+          case Text:
+            if (!rule->getText)
+              break;
+            value = rule->getText(object);
+            if ((!(rule->options & OmitEmpty)) || (!value.isEmpty()))
+              record.set(rule->slot, value);
+            break;
+          case Date:
+            if (!rule->getText)
+              break;
+            value = rule->getText(object);
+            if (value.isNull())
+              break;
+            record.set(rule->slot, value);
+            if (rule->flag >= 0)
+              record.set(rule->flag, "1");
+            break;
+          case Enum:
+            if (rule->getEnum)
+            {
+              QHash<int, QString>::const_iterator mapped = rule->toSugar.constFind(rule->getEnum(object));
+              if (mapped != rule->toSugar.constEnd())
+              {
+                record.set(rule->slot, mapped.value());
+                break;
+              }
+            }
+            if (rule->getText)
+            {
+              value = rule->getText(object);
+              if (!value.isEmpty())
+                record.set(rule->slot, value);
+            }
+            break;
+          case Custom:
+            if (rule->write)
+              rule->write(object, record);
+            break;
+        }
+      }
+    }
+
+    Akonadi::Item payload(const SugarRecord &record, const Akonadi::Item &item) const
+    {
+      P payload = SugarPayloadTraits<P>::create();
+      read(record, SugarPayloadTraits<P>::object(payload));
+      Akonadi::Item newItem(item);
+      newItem.setPayload<P>(payload);
+      return newItem;
+    }
+
+    SugarRecord soap(const Akonadi::Item &item) const
+    {
+      P payload = item.payload<P>();
+      SugarRecord record(s);
+      write(SugarPayloadTraits<P>::object(payload), record);
+      return record;
+    }
+
+  private:
+    enum Kind
+    {
+      Text,
+      Date,
+      Enum,
+      Custom
+    };
+
+    struct Rule
+    {
+      Rule(Kind kind = Custom, int slot = -1)
+        : kind(kind), slot(slot), flag(-1), options(0), setText(0), getText(0),
+          setDate(0), setEnum(0), getEnum(0), read(0), write(0)
+      {
+      }
+
+      Kind kind;
+      int slot;
+      int flag;
+      int options;
+      TextSetter setText;
+      TextGetter getText;
+      DateSetter setDate;
+      EnumSetter setEnum;
+      EnumGetter getEnum;
+      RecordReader read;
+      RecordWriter write;
+      QHash<QString, int> toValue;
+      QHash<int, QString> toSugar;
+    };
+
+    SugarSchema s;
+    QVector<Rule> rules;
+};
+
+#endif /* SUGARMAPPING_H */
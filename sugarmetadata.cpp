@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2013, 2014 Jesús Pérez (a) Chuso <kde at chuso dot net>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Library General Public License as published
+ * by the Free Software Foundation; either version 2 of the License or
+ * ( at your option ) version 3 or, at the discretion of KDE e.V.
+ * ( which shall act as a proxy as in section 14 of the GPLv3 ), any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "sugarmetadata.h"
+#include "settings.h"
+
+#include <KConfigGroup>
+#include <QDateTime>
+
+/*!
+ * \class SugarMetadata
+ * \brief The SugarMetadata class caches on disk what SugarCRM reports about its modules.
+ *
+ * The modules available at SugarCRM and the fields each of them has rarely
+ * change, so they are kept in the cache directory of each resource instance.
+ * The page sizes listings adapted to are kept there too, as they only
+ * depend on the server.
+ * Once the cache is older than Settings::metadataCacheTtl() it has to be
+ * revalidated: it is still right if the server version did not change.
+ */
+
+/*!
+ * Opens the metadata cache of a resource.
+ * \param[in] resource Identifier of the resource instance.
+ */
+SugarMetadata::SugarMetadata(const QString &resource)
+  : config("sugarcrmresource_" + resource + "_metadata", KConfig::SimpleConfig, "cache")
+{
+}
+
+/*!
+ * \return Whether the cache was stored or revalidated within its time to live.
+ */
+bool SugarMetadata::isFresh() const
+{
+  uint validated = config.group("General").readEntry("Validated", 0u);
+  uint now = QDateTime::currentDateTime().toTime_t();
+  return (validated > 0) && (validated <= now) && (now - validated < Settings::self()->metadataCacheTtl());
+}
+
+/*!
+ * \return Version of SugarCRM the cache belongs to.
+ */
+QString SugarMetadata::serverVersion() const
+{
+  return config.group("General").readEntry("ServerVersion", QString());
+}
+
+/*!
+ * \return Whether the list of available modules is cached.
+ */
+bool SugarMetadata::hasModules() const
+{
+  return config.group("General").hasKey("Modules");
+}
+
+/*!
+ * \return Cached list of modules available at SugarCRM.
+ */
+QStringList SugarMetadata::modules() const
+{
+  return config.group("General").readEntry("Modules", QStringList());
+}
+
+/*!
+ * Stores the list of available modules. If the server version changed,
+ * every cached field list is dropped too.
+ * \param[in] modules Modules available at SugarCRM.
+ * \param[in] version Version of SugarCRM the modules belong to.
+ */
+void SugarMetadata::setModules(const QStringList &modules, const QString &version)
+{
+  if (version != serverVersion())
+    config.deleteGroup("Fields");
+
+  KConfigGroup general = config.group("General");
+  general.writeEntry("Modules", modules);
+  general.writeEntry("ServerVersion", version);
+  general.writeEntry("Validated", QDateTime::currentDateTime().toTime_t());
+  config.sync();
+}
+
+/*!
+ * Marks the cache as fresh again, after checking the server did not change.
+ */
+void SugarMetadata::revalidate()
+{
+  config.group("General").writeEntry("Validated", QDateTime::currentDateTime().toTime_t());
+  config.sync();
+}
+
+/*!
+ * \param[in] module Module whose fields are checked.
+ * \return Whether the fields of \a module are cached.
+ */
+bool SugarMetadata::hasFields(const QString &module) const
+{
+  return config.group("Fields").hasKey(module);
+}
+
+/*!
+ * \param[in] module Module whose fields are requested.
+ * \return Cached fields \a module has at SugarCRM.
+ */
+QStringList SugarMetadata::fields(const QString &module) const
+{
+  return config.group("Fields").readEntry(module, QStringList());
+}
+
+/*!
+ * Stores the fields a module has at SugarCRM.
+ * \param[in] module Module the fields belong to.
+ * \param[in] fields Names of the fields.
+ */
+void SugarMetadata::setFields(const QString &module, const QStringList &fields)
+{
+  config.group("Fields").writeEntry(module, fields);
+  config.sync();
+}
+
+/*!
+ * \param[in] module Module whose entries are listed.
+ * \param[in] full_entries Whether the listing gets every field or ids and timestamps only.
+ * \return Page size listings of \a module adapted to, or 0 if unknown.
+ */
+int SugarMetadata::pageSize(const QString &module, bool full_entries) const
+{
+  return config.group("PageSizes").readEntry(module + (full_entries? "+full" : ""), 0);
+}
+
+/*!
+ * Stores the page size listings of a module adapted to.
+ * \param[in] module Module whose entries are listed.
+ * \param[in] full_entries Whether the listing gets every field or ids and timestamps only.
+ * \param[in] size Number of entries in every page.
+ */
+void SugarMetadata::setPageSize(const QString &module, bool full_entries, int size)
+{
+  config.group("PageSizes").writeEntry(module + (full_entries? "+full" : ""), size);
+  config.sync();
+}
+
+/*!
+ * Drops everything cached, so it is queried again from SugarCRM.
+ */
+void SugarMetadata::clear()
+{
+  config.deleteGroup("General");
+  config.deleteGroup("Fields");
+  config.deleteGroup("PageSizes");
+  config.sync();
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2013, 2014 Jesús Pérez (a) Chuso <kde at chuso dot net>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Library General Public License as published
+ * by the Free Software Foundation; either version 2 of the License or
+ * ( at your option ) version 3 or, at the discretion of KDE e.V.
+ * ( which shall act as a proxy as in section 14 of the GPLv3 ), any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef SUGARMETADATA_H
+#define SUGARMETADATA_H
+
+#include <KConfig>
+#include <QStringList>
+
+class SugarMetadata
+{
+  public:
+    SugarMetadata(const QString &resource);
+    bool isFresh() const;
+    QString serverVersion() const;
+    bool hasModules() const;
+    QStringList modules() const;
+    void setModules(const QStringList &modules, const QString &version);
+    void revalidate();
+    bool hasFields(const QString &module) const;
+    QStringList fields(const QString &module) const;
+    void setFields(const QString &module, const QStringList &fields);
+    int pageSize(const QString &module, bool full_entries) const;
+    void setPageSize(const QString &module, bool full_entries, int size);
+    void clear();
+
+  private:
+    KConfig config;
+};
+
+#endif /* SUGARMETADATA_H */
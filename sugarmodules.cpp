@@ -0,0 +1,399 @@
+/*
+ * Copyright (c) 2013, 2014 Jesús Pérez (a) Chuso <kde at chuso dot net>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Library General Public License as published
+ * by the Free Software Foundation; either version 2 of the License or
+ * ( at your option ) version 3 or, at the discretion of KDE e.V.
+ * ( which shall act as a proxy as in section 14 of the GPLv3 ), any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "sugarcrmresource.h"
+#include "sugarmapping.h"
+#include "sugardatetime.h"
+#include <KABC/Addressee>
+#include <KCalCore/Todo>
+#include <KCalCore/Event>
+
+typedef SugarCrmResource R;
+typedef SugarMapping<KABC::Addressee> ContactMapping;
+typedef SugarMapping<KCalCore::Todo::Ptr> TodoMapping;
+typedef SugarMapping<KCalCore::Event::Ptr> EventMapping;
+
+namespace
+{
+  // Module fields of each record layout, in the order of the enums in
+  // sugarcrmresource.h
+  const char * const contactFields[] = {
+    "salutation", "first_name", "last_name", "birthdate",
+    "email1", "email2",
+    "phone_home", "phone_mobile", "phone_work", "phone_fax", "phone_other",
+    "primary_address_street", "primary_address_city", "primary_address_state", "primary_address_postalcode", "primary_address_country",
+    "alt_address_street", "alt_address_city", "alt_address_state", "alt_address_postalcode", "alt_address_country",
+    "account_name", "title", "department", "description"
+  };
+  const char * const taskFields[] = {
+    "name", "description", "status", "priority", "date_due_flag", "date_due", "date_start_flag", "date_start", "case_number"
+  };
+  const char * const projectFields[] = {
+    "name", "description", "percent_complete", "project_phase", "date_ending", "date_starting"
+  };
+  const char * const bookingFields[] = {
+    "name", "status", "quantity", "date_start", "related_type", "related_id"
+  };
+
+  const SugarEnumValue taskStatuses[] = {
+    { "Assigned",      KCalCore::Incidence::StatusConfirmed },
+    { "Pending Input", KCalCore::Incidence::StatusInProcess },
+    { "Closed",        KCalCore::Incidence::StatusCompleted },
+    { "Rejected",      KCalCore::Incidence::StatusCanceled }
+  };
+  const SugarEnumValue projectPhases[] = {
+    { "Active - Starting Soon", KCalCore::Incidence::StatusConfirmed },
+    { "Active - In Progress",   KCalCore::Incidence::StatusInProcess },
+    { "Closed - Complete",      KCalCore::Incidence::StatusCompleted },
+    { "Closed - Terminated",    KCalCore::Incidence::StatusCompleted }
+  };
+  const SugarEnumValue bookingStatuses[] = {
+    { "draft",    KCalCore::Incidence::StatusDraft },
+    { "approved", KCalCore::Incidence::StatusConfirmed },
+    { "rejected", KCalCore::Incidence::StatusCanceled },
+    { "pending",  KCalCore::Incidence::StatusNeedsAction }
+  };
+  const SugarEnumValue priorities[] = {
+    { "High",   1 },
+    { "Medium", 5 },
+    { "Low",    9 }
+  };
+
+  /* Phone fields and their KABC types, phone_other is stored by id */
+  struct PhoneField
+  {
+    int slot;
+    KABC::PhoneNumber::Type type;
+  };
+  const PhoneField phoneTypes[] = {
+    { R::ContactPhoneHome,   KABC::PhoneNumber::Home },
+    { R::ContactPhoneMobile, KABC::PhoneNumber::Cell },
+    { R::ContactPhoneWork,   KABC::PhoneNumber::Work },
+    { R::ContactPhoneFax,    KABC::PhoneNumber::Fax }
+  };
+
+  /* Address fields, each group is street, city, state, postal code and country */
+  struct AddressGroup
+  {
+    int first;
+    const char *id;
+  };
+  const AddressGroup addressGroups[] = {
+    { R::ContactPrimaryStreet, "primary" },
+    { R::ContactAltStreet,     "alt" }
+  };
+
+  template <class T> int count(const T &table) { return sizeof(table)/sizeof(*table); }
+
+  /*
+   * Contact properties
+   */
+  void setAddresseeUid(KABC::Addressee &a, const QString &v) { a.setUid(v); }
+  void setPrefix(KABC::Addressee &a, const QString &v) { a.setPrefix(v); }
+  QString prefix(const KABC::Addressee &a) { return a.prefix(); }
+  void setGivenName(KABC::Addressee &a, const QString &v) { a.setGivenName(v); }
+  QString givenName(const KABC::Addressee &a) { return a.givenName(); }
+  void setFamilyName(KABC::Addressee &a, const QString &v) { a.setFamilyName(v); }
+  QString familyName(const KABC::Addressee &a) { return a.familyName(); }
+  void setBirthday(KABC::Addressee &a, const QString &v) { a.setBirthday(SugarDateTime::toQDateTime(v)); }
+  QString birthday(const KABC::Addressee &a) { return a.birthday().toString(Qt::ISODate); }
+  void setOrganization(KABC::Addressee &a, const QString &v) { a.setOrganization(v); }
+  QString organization(const KABC::Addressee &a) { return a.organization(); }
+  void setTitle(KABC::Addressee &a, const QString &v) { a.setTitle(v); }
+  QString title(const KABC::Addressee &a) { return a.title(); }
+  void setDepartment(KABC::Addressee &a, const QString &v) { a.setDepartment(v); }
+  QString department(const KABC::Addressee &a) { return a.department(); }
+  void setNote(KABC::Addressee &a, const QString &v) { a.setNote(v); }
+  QString note(const KABC::Addressee &a) { return a.note(); }
+
+  void readAddresses(const SugarRecord &r, KABC::Addressee &a)
+  {
+    for (int group=0; group<count(addressGroups); group++)
+    {
+      int first = addressGroups[group].first;
+      bool empty = true;
+      for (int slot=first; (empty) && (slot<first+5); slot++)
+        empty = r[slot].trimmed().isEmpty();
+      if (empty)
+        continue;
+      KABC::Address addr;
+      addr.setStreet(r[first]);
+      addr.setLocality(r[first+1]);
+      addr.setRegion(r[first+2]);
+      addr.setPostalCode(r[first+3]);
+      addr.setCountry(r[first+4]);
+      addr.setId(addressGroups[group].id);
+      a.insertAddress(addr);
+    }
+  }
+
+  void writeAddresses(const KABC::Addressee &a, SugarRecord &r)
+  {
+    for (int group=0; group<count(addressGroups); group++)
+    {
+      KABC::Address addr = a.findAddress(addressGroups[group].id);
+      if (addr.isEmpty())
+        continue;
+      int first = addressGroups[group].first;
+      r.set(first,   addr.street());
+      r.set(first+1, addr.locality());
+      r.set(first+2, addr.region());
+      r.set(first+3, addr.postalCode());
+      r.set(first+4, addr.country());
+    }
+  }
+
+  void readPhones(const SugarRecord &r, KABC::Addressee &a)
+  {
+    for (int i=0; i<count(phoneTypes); i++)
+      if (!r[phoneTypes[i].slot].trimmed().isEmpty())
+        a.insertPhoneNumber(KABC::PhoneNumber(r[phoneTypes[i].slot], phoneTypes[i].type));
+    if (!r[R::ContactPhoneOther].trimmed().isEmpty())
+    {
+      KABC::PhoneNumber phone(r[R::ContactPhoneOther]);
+      phone.setId("other");
+      a.insertPhoneNumber(phone);
+    }
+  }
+
+  void writePhones(const KABC::Addressee &a, SugarRecord &r)
+  {
+    for (int i=0; i<count(phoneTypes); i++)
+      if (!a.phoneNumber(phoneTypes[i].type).isEmpty())
+        r.set(phoneTypes[i].slot, a.phoneNumber(phoneTypes[i].type).toString());
+    if (!a.findPhoneNumber("other").isEmpty())
+      r.set(R::ContactPhoneOther, a.findPhoneNumber("other").toString());
+  }
+
+  void readEmails(const SugarRecord &r, KABC::Addressee &a)
+  {
+    QStringList emails;
+    if (!r[R::ContactEmail1].trimmed().isEmpty())
+      emails << r[R::ContactEmail1];
+    if (!r[R::ContactEmail2].trimmed().isEmpty())
+      emails << r[R::ContactEmail2];
+    a.setEmails(emails);
+  }
+
+  void writeEmails(const KABC::Addressee &a, SugarRecord &r)
+  {
+    QStringList emails = a.emails();
+    if (emails.count() >= 1)
+      r.set(R::ContactEmail1, emails.at(0));
+    if (emails.count() >= 2)
+      r.set(R::ContactEmail2, emails.at(1));
+  }
+
+  /*
+   * Properties shared by every incidence
+   */
+  template <class T> void setUid(T &i, const QString &v) { i.setUid(v); }
+  template <class T> void setSummary(T &i, const QString &v) { i.setSummary(v); }
+  template <class T> QString summary(const T &i) { return i.summary(); }
+  template <class T> void setDescription(T &i, const QString &v) { i.setDescription(v); }
+  template <class T> QString description(const T &i) { return i.description(); }
+  template <class T> void setCreated(T &i, const KDateTime &v) { i.setCreated(v); }
+  template <class T> QString created(const T &i) { return i.created().toString(KDateTime::ISODate); }
+  template <class T> void setStart(T &i, const KDateTime &v)
+  {
+    i.setDtStart(v);
+    i.setDateTime(v, KCalCore::IncidenceBase::RoleDisplayStart);
+  }
+  template <class T> void setStatus(T &i, int v) { i.setStatus(static_cast<KCalCore::Incidence::Status>(v)); }
+  template <class T> int status(const T &i) { return i.status(); }
+  template <class T> void setCustomStatus(T &i, const QString &v) { i.setCustomStatus(v); }
+  template <class T> QString customStatus(const T &i) { return (i.status() == KCalCore::Incidence::StatusX)? i.customStatus() : QString(); }
+  template <class T> void setSugarStatus(T &i, const QString &v) { i.setCustomProperty("SugarCRM", "X-Status", v); }
+  template <class T> QString sugarStatus(const T &i) { return i.customProperty("SugarCRM", "X-Status"); }
+
+  /*
+   * Task and project properties
+   */
+  QString todoStart(const KCalCore::Todo &t) { return t.hasStartDate()? t.dtStart().toString(KDateTime::ISODate) : QString(); }
+  void setTodoDue(KCalCore::Todo &t, const KDateTime &v)
+  {
+    t.setDtDue(v);
+    t.setDateTime(v, KCalCore::IncidenceBase::RoleDisplayEnd);
+  }
+  QString todoDue(const KCalCore::Todo &t) { return t.hasDueDate()? t.dtDue().toString(KDateTime::ISODate) : QString(); }
+  void setCaseNumber(KCalCore::Todo &t, const QString &v) { t.setCustomProperty("SugarCRM", "X-CaseNumber", v); }
+  QString caseNumber(const KCalCore::Todo &t) { return t.customProperty("SugarCRM", "X-CaseNumber"); }
+  void setPriority(KCalCore::Todo &t, int v) { t.setPriority(v); }
+  int priorityClass(const KCalCore::Todo &t)
+  {
+    // Priorities are written back by range
+    if ((t.priority() >= 1) && (t.priority() <= 3))
+      return 1;
+    if ((t.priority() >= 4) && (t.priority() <= 6))
+      return 5;
+    if (t.priority() >= 7)
+      return 9;
+    return 0;
+  }
+  void setPercentComplete(KCalCore::Todo &t, const QString &v) { t.setPercentComplete(v.toInt()); }
+  QString percentComplete(const KCalCore::Todo &t) { return QString::number(t.percentComplete()); }
+
+  /*
+   * Booking properties
+   */
+  QString eventStart(const KCalCore::Event &e) { return e.dtStart().toString(KDateTime::ISODate); }
+
+  void readDuration(const SugarRecord &r, KCalCore::Event &e)
+  {
+    if (r[R::BookingQuantity].isEmpty())
+      return;
+    unsigned int duration = r[R::BookingQuantity].toUInt()*60;
+    KDateTime end = e.dtStart().addSecs(duration);
+    e.setDuration(duration);
+    e.setDtEnd(end);
+    e.setDateTime(end, KCalCore::IncidenceBase::RoleDisplayEnd);
+    e.setDateTime(end, KCalCore::IncidenceBase::RoleEnd);
+  }
+
+  void writeDuration(const KCalCore::Event &e, SugarRecord &r)
+  {
+    if (e.hasDuration())
+      r.set(R::BookingQuantity, QString::number(e.duration().asSeconds()/60));
+  }
+
+  void readRelation(const SugarRecord &r, KCalCore::Event &e)
+  {
+    const QString &type = r[R::BookingRelatedType];
+    const QString &id = r[R::BookingRelatedId];
+    if (type.isEmpty())
+      return;
+    e.setCustomProperty("SugarCRM", "X-RelatedType", type);
+    if (id.isEmpty())
+      return;
+    e.setCustomProperty("SugarCRM", "X-RelatedId", id);
+    if (type == "Cases")
+      e.setRelatedTo(id);
+  }
+}
+
+/*!
+ * Populates Modules with the modules this resource supports: their record
+ * layouts, the fields requested to SugarCRM and the mappings to convert
+ * their records. New modules are added here.
+ */
+void SugarCrmResource::registerModules()
+{
+  using KCalCore::Todo;
+  using KCalCore::Event;
+
+  SugarSchema contactSchema(contactFields, count(contactFields));
+  SugarSchema taskSchema(taskFields, count(taskFields));
+  SugarSchema projectSchema(projectFields, count(projectFields));
+  SugarSchema bookingSchema(bookingFields, count(bookingFields));
+  Q_ASSERT(contactSchema.count() == ContactFieldCount);
+  Q_ASSERT(taskSchema.count() == TaskFieldCount);
+  Q_ASSERT(projectSchema.count() == ProjectFieldCount);
+  Q_ASSERT(bookingSchema.count() == BookingFieldCount);
+
+  ContactMapping *contact = new ContactMapping(contactSchema);
+  (*contact)
+    .text(SugarSchema::Id, setAddresseeUid, 0)
+    .text(ContactSalutation, setPrefix, prefix)
+    .text(ContactFirstName, setGivenName, givenName)
+    .text(ContactLastName, setFamilyName, familyName)
+    .text(ContactBirthdate, setBirthday, birthday)
+    .custom(readAddresses, writeAddresses)
+    .text(ContactAccountName, setOrganization, organization)
+    .text(ContactTitle, setTitle, title)
+    .text(ContactDepartment, setDepartment, department)
+    .text(ContactDescription, setNote, note)
+    .custom(readPhones, writePhones)
+    .custom(readEmails, writeEmails);
+
+  TodoMapping *task = new TodoMapping(taskSchema);
+  (*task)
+    .text(SugarSchema::Id, setUid<Todo>, 0)
+    .text(TaskName, setSummary<Todo>, summary<Todo>)
+    .text(TaskDescription, setDescription<Todo>, description<Todo>)
+    .date(SugarSchema::DateEntered, setCreated<Todo>, created<Todo>)
+    .date(TaskDateStart, setStart<Todo>, todoStart, TaskDateStartFlag)
+    .date(TaskDateDue, setTodoDue, todoDue, TaskDateDueFlag)
+    .text(TaskCaseNumber, setCaseNumber, caseNumber, TodoMapping::OmitEmpty)
+    .enumeration(TaskStatus, taskStatuses, count(taskStatuses), setStatus<Todo>, status<Todo>, setCustomStatus<Todo>, customStatus<Todo>)
+    .text(TaskStatus, setSugarStatus<Todo>, sugarStatus<Todo>, TodoMapping::OmitEmpty)
+    .enumeration(TaskPriority, priorities, count(priorities), setPriority, priorityClass);
+
+  TodoMapping *project = new TodoMapping(projectSchema);
+  (*project)
+    .text(SugarSchema::Id, setUid<Todo>, 0)
+    .text(ProjectName, setSummary<Todo>, summary<Todo>)
+    .text(ProjectDescription, setDescription<Todo>, description<Todo>)
+    .date(SugarSchema::DateEntered, setCreated<Todo>, created<Todo>)
+    .date(ProjectDateStarting, setStart<Todo>, todoStart)
+    .date(ProjectDateEnding, setTodoDue, todoDue)
+    .enumeration(ProjectPhase, projectPhases, count(projectPhases), setStatus<Todo>, status<Todo>, setCustomStatus<Todo>, customStatus<Todo>)
+    .text(ProjectPhase, setSugarStatus<Todo>, sugarStatus<Todo>, TodoMapping::OmitEmpty)
+    .text(ProjectPercentComplete, setPercentComplete, percentComplete);
+
+  EventMapping *booking = new EventMapping(bookingSchema);
+  (*booking)
+    .text(SugarSchema::Id, setUid<Event>, 0)
+    .text(BookingName, setSummary<Event>, summary<Event>)
+    .date(SugarSchema::DateEntered, setCreated<Event>, created<Event>)
+    .date(BookingDateStart, setStart<Event>, eventStart)
+    .custom(readDuration, writeDuration)
+    .enumeration(BookingStatus, bookingStatuses, count(bookingStatuses), setStatus<Event>, status<Event>, setCustomStatus<Event>, customStatus<Event>)
+    .text(BookingStatus, setSugarStatus<Event>, sugarStatus<Event>, EventMapping::OmitEmpty)
+    .custom(readRelation, 0);
+
+  module modinfo;
+  modinfo.schema = contactSchema;
+  modinfo.fields = contactSchema.names();
+  // Remaining available fields:
+  // modified_user_id, modified_by_name,
+  // created_by, created_by_name, assigned_user_id,
+  // assigned_user_name, do_not_call, assistant, assistant_phone,
+  // lead_source, account_id, opportunity_role_fields, reports_to_id
+  // report_to_name, campaign_id, campaign_name, c_accept_status_fields
+  // m_accept_status_fields
+  modinfo.mimes = QStringList() << "text/directory";
+  modinfo.mapping = QSharedPointer<SugarMappingBase>(contact);
+  Modules["Contacts"] = Modules["Leads"] = modinfo;
+
+  modinfo.schema = taskSchema;
+  modinfo.fields = taskSchema.names();
+  // Only cases have a number
+  modinfo.fields.removeOne("case_number");
+  modinfo.mimes = QStringList() << KCalCore::Todo::todoMimeType();
+  modinfo.mapping = QSharedPointer<SugarMappingBase>(task);
+  Modules["Tasks"] = modinfo;
+
+  modinfo.fields = taskSchema.names();
+  // TODO: where status is active
+  Modules["Cases"] = modinfo;
+
+  modinfo.schema = projectSchema;
+  modinfo.fields = projectSchema.names();
+  // TODO: where status is active
+  modinfo.mapping = QSharedPointer<SugarMappingBase>(project);
+  Modules["Project"] = modinfo;
+
+  modinfo.schema = bookingSchema;
+  modinfo.fields = bookingSchema.names();
+  modinfo.mimes = QStringList() << KCalCore::Event::eventMimeType();
+  // TODO: where status is active
+  modinfo.mapping = QSharedPointer<SugarMappingBase>(booking);
+  Modules["Booking"] = modinfo;
+}
@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2013, 2014 Jesús Pérez (a) Chuso <kde at chuso dot net>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Library General Public License as published
+ * by the Free Software Foundation; either version 2 of the License or
+ * ( at your option ) version 3 or, at the discretion of KDE e.V.
+ * ( which shall act as a proxy as in section 14 of the GPLv3 ), any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "sugarrecord.h"
+
+namespace
+{
+  const char * const commonFields[] = { "id", "date_entered", "date_modified", "deleted" };
+  const QString emptyValue;
+}
+
+/*!
+ * \class SugarSchema
+ * \brief The SugarSchema class describes the layout of the records of a SugarCRM module.
+ *
+ * A schema assigns every field a slot. The common fields listed in
+ * CommonField come first and the module fields follow in the order they were
+ * given, so they can be addressed with a per-module enum starting at
+ * FirstModuleField. Copies share the same data, so every record of a module
+ * refers to a single schema.
+ */
+
+/*!
+ * Constructs a null schema.
+ */
+SugarSchema::SugarSchema()
+{
+}
+
+/*!
+ * Constructs a new schema.
+ * \param[in] fields Names of the module fields, in slot order, without the common fields.
+ * \param[in] count Number of names in \a fields.
+ */
+SugarSchema::SugarSchema(const char * const fields[], int count)
+  : d(new Data)
+{
+  for (int i=0; i<FirstModuleField; i++)
+    d->names << QString::fromLatin1(commonFields[i]);
+  for (int i=0; i<count; i++)
+    d->names << QString::fromLatin1(fields[i]);
+  d->index.reserve(d->names.count());
+  for (int i=0; i<d->names.count(); i++)
+    d->index.insert(d->names.at(i), i);
+}
+
+/*!
+ * \return Whether this is a null schema.
+ */
+bool SugarSchema::isNull() const
+{
+  return !d;
+}
+
+/*!
+ * \return Number of fields, common fields included.
+ */
+int SugarSchema::count() const
+{
+  return d? d->names.count() : 0;
+}
+
+/*!
+ * \param[in] field Name of a field.
+ * \return Slot of \a field or -1 if this schema does not have it.
+ */
+int SugarSchema::indexOf(const QString &field) const
+{
+  return d? d->index.value(field, -1) : -1;
+}
+
+/*!
+ * \param[in] index Slot of a field.
+ * \return Name of the field at \a index.
+ */
+QString SugarSchema::name(int index) const
+{
+  return d->names.at(index);
+}
+
+/*!
+ * \return Names of every field, in slot order.
+ */
+QStringList SugarSchema::names() const
+{
+  return d? d->names : QStringList();
+}
+
+/*!
+ * \class SugarRecord
+ * \brief The SugarRecord class holds the field values of a SugarCRM entry.
+ *
+ * Values are stored in the slots of the record's schema, so fields are
+ * addressed by index instead of being looked up by name. A record also
+ * knows which fields have been set, so only those are sent to SugarCRM.
+ */
+
+/*!
+ * Constructs a null record.
+ */
+SugarRecord::SugarRecord()
+{
+}
+
+/*!
+ * Constructs an empty record.
+ * \param[in] schema Layout of the record.
+ */
+SugarRecord::SugarRecord(const SugarSchema &schema)
+  : s(schema), values(schema.count()), present(schema.count())
+{
+}
+
+/*!
+ * \return Whether this is a null record.
+ */
+bool SugarRecord::isNull() const
+{
+  return s.isNull();
+}
+
+/*!
+ * \return Layout of the record.
+ */
+const SugarSchema &SugarRecord::schema() const
+{
+  return s;
+}
+
+/*!
+ * \return Number of slots of the record.
+ */
+int SugarRecord::count() const
+{
+  return values.count();
+}
+
+/*!
+ * \param[in] index Slot of a field.
+ * \return Whether the field at \a index has been set.
+ */
+bool SugarRecord::contains(int index) const
+{
+  return (index >= 0) && (index < present.size()) && present.testBit(index);
+}
+
+/*!
+ * \param[in] index Slot of a field.
+ * \return Value of the field at \a index, an empty string if it has not been set.
+ */
+const QString &SugarRecord::operator[](int index) const
+{
+  if ((index < 0) || (index >= values.count()))
+    return emptyValue;
+  return values.at(index);
+}
+
+/*!
+ * \param[in] field Name of a field.
+ * \return Value of \a field, an empty string if it has not been set or the schema does not have it.
+ */
+QString SugarRecord::value(const QString &field) const
+{
+  return (*this)[s.indexOf(field)];
+}
+
+/*!
+ * Sets the value of a field.
+ * \param[in] index Slot of the field.
+ * \param[in] value New value.
+ */
+void SugarRecord::set(int index, const QString &value)
+{
+  values[index] = value;
+  present.setBit(index);
+}
+
+/*!
+ * Sets the value of a field given its name.
+ * \param[in] field Name of the field.
+ * \param[in] value New value.
+ * \return Whether the schema has \a field, the value is dropped otherwise.
+ */
+bool SugarRecord::set(const QString &field, const QString &value)
+{
+  int index = s.indexOf(field);
+  if (index < 0)
+    return false;
+  set(index, value);
+  return true;
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2013, 2014 Jesús Pérez (a) Chuso <kde at chuso dot net>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Library General Public License as published
+ * by the Free Software Foundation; either version 2 of the License or
+ * ( at your option ) version 3 or, at the discretion of KDE e.V.
+ * ( which shall act as a proxy as in section 14 of the GPLv3 ), any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef SUGARRECORD_H
+#define SUGARRECORD_H
+
+#include <QString>
+#include <QStringList>
+#include <QHash>
+#include <QVector>
+#include <QBitArray>
+#include <QSharedData>
+
+class SugarSchema
+{
+  public:
+    /*! Fields every schema has, module-specific fields follow them. */
+    enum CommonField
+    {
+      Id,
+      DateEntered,
+      DateModified,
+      Deleted,
+      FirstModuleField
+    };
+
+    SugarSchema();
+    SugarSchema(const char * const fields[], int count);
+    bool isNull() const;
+    int count() const;
+    int indexOf(const QString &field) const;
+    QString name(int index) const;
+    QStringList names() const;
+
+  private:
+    struct Data : public QSharedData
+    {
+      QStringList names;
+      QHash<QString, int> index;
+    };
+    QExplicitlySharedDataPointer<Data> d;
+};
+
+class SugarRecord
+{
+  public:
+    SugarRecord();
+    explicit SugarRecord(const SugarSchema &schema);
+    bool isNull() const;
+    const SugarSchema &schema() const;
+    int count() const;
+    bool contains(int index) const;
+    const QString &operator[](int index) const;
+    QString value(const QString &field) const;
+    void set(int index, const QString &value);
+    bool set(const QString &field, const QString &value);
+
+  private:
+    SugarSchema s;
+    QVector<QString> values;
+    QBitArray present;
+};
+
+#endif /* SUGARRECORD_H */
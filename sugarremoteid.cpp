@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2013, 2014 Jesús Pérez (a) Chuso <kde at chuso dot net>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Library General Public License as published
+ * by the Free Software Foundation; either version 2 of the License or
+ * ( at your option ) version 3 or, at the discretion of KDE e.V.
+ * ( which shall act as a proxy as in section 14 of the GPLv3 ), any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "sugarremoteid.h"
+#include "sugarcrmresource.h"
+
+/*!
+ * \class SugarRemoteId
+ * \brief The SugarRemoteId class encodes and decodes the remoteIds of SugarCRM items.
+ *
+ * Items are identified in Akonadi by <code>id\@module</code>, where id is
+ * the SugarCRM entry identifier and module the SugarCRM module it belongs
+ * to. A remoteId is only valid if its module is one of
+ * SugarCrmResource::Modules.
+ */
+
+/*!
+ * Constructs an invalid remoteId.
+ */
+SugarRemoteId::SugarRemoteId()
+{
+}
+
+/*!
+ * Constructs a new remoteId.
+ * \param[in] id Identifier of the SugarCRM entry.
+ * \param[in] module Module the entry belongs to.
+ */
+SugarRemoteId::SugarRemoteId(const QString &id, const QString &module)
+  : entryId(id), mod(module)
+{
+}
+
+/*!
+ * Splits a remoteId at its last <code>\@</code>.
+ * \param[in] remoteId RemoteId of an item.
+ * \return The decoded remoteId, invalid if \a remoteId does not have a module or it is not supported.
+ */
+SugarRemoteId SugarRemoteId::decode(const QString &remoteId)
+{
+  int at = remoteId.lastIndexOf(QLatin1Char('@'));
+  if (at <= 0)
+    return SugarRemoteId();
+  SugarRemoteId decoded(remoteId.left(at), remoteId.mid(at + 1));
+  if (!SugarCrmResource::Modules.contains(decoded.mod))
+    return SugarRemoteId();
+  return decoded;
+}
+
+/*!
+ * Builds a remoteId.
+ * \param[in] id Identifier of the SugarCRM entry.
+ * \param[in] module Module the entry belongs to.
+ * \return The remoteId of the entry.
+ */
+QString SugarRemoteId::encode(const QString &id, const QString &module)
+{
+  QString remoteId;
+  remoteId.reserve(id.size() + 1 + module.size());
+  remoteId.append(id).append(QLatin1Char('@')).append(module);
+  return remoteId;
+}
+
+/*!
+ * \return The remoteId of this entry.
+ */
+QString SugarRemoteId::encode() const
+{
+  return encode(entryId, mod);
+}
+
+/*!
+ * \return Whether this remoteId has an identifier and a supported module.
+ */
+bool SugarRemoteId::isValid() const
+{
+  return !mod.isEmpty();
+}
+
+/*!
+ * \return Identifier of the SugarCRM entry.
+ */
+QString SugarRemoteId::id() const
+{
+  return entryId;
+}
+
+/*!
+ * \return Module the entry belongs to.
+ */
+QString SugarRemoteId::module() const
+{
+  return mod;
+}
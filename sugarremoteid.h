@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2013, 2014 Jesús Pérez (a) Chuso <kde at chuso dot net>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Library General Public License as published
+ * by the Free Software Foundation; either version 2 of the License or
+ * ( at your option ) version 3 or, at the discretion of KDE e.V.
+ * ( which shall act as a proxy as in section 14 of the GPLv3 ), any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef SUGARREMOTEID_H
+#define SUGARREMOTEID_H
+
+#include <QString>
+
+class SugarRemoteId
+{
+  public:
+    SugarRemoteId();
+    SugarRemoteId(const QString &id, const QString &module);
+    static SugarRemoteId decode(const QString &remoteId);
+    static QString encode(const QString &id, const QString &module);
+    QString encode() const;
+    bool isValid() const;
+    QString id() const;
+    QString module() const;
+
+  private:
+    QString entryId;
+    QString mod;
+};
+
+#endif /* SUGARREMOTEID_H */
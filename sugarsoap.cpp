@@ -22,48 +22,821 @@
 #include "sugarsoap.h"
 #include "sugarcrmresource.h"
 #include "settings.h"
+#include "sugardatetime.h"
 #include <iostream>
 #include <QDomElement>
+#include <QtConcurrentRun>
 
-// These typedefs are not used, they are needed just because compiler macros
-// can't use arguments containing commas...
-typedef QVector<QMap<QString, QString > > QVectorQMapQStringQString;
-typedef QHash<QString, QString> QHashQStringQString;
-// ...here
-Q_DECLARE_METATYPE(QVectorQMapQStringQString);
-Q_DECLARE_METATYPE(QHashQStringQString);
+namespace
+{
+  /*
+   * Error number SugarCRM answers with when the session of a request is
+   * unknown, usually because it expired.
+   */
+  const char InvalidSessionError[] = "11";
+
+  /*
+   * Extracts the name->value pairs of every entry in a
+   * <code>get_entry_list</code> response into records of the module
+   * schema. It runs on the global thread pool on a copy of the message
+   * that shares its values, which are decoded when the response is
+   * parsed and never written to afterwards.
+   */
+  QVector<SugarRecord> extractEntries(const QtSoapMessage &message, const SugarSchema &schema)
+  {
+    QVector<SugarRecord> entries;
+    const QtSoapType &entry_list = message.method()["return"]["entry_list"];
+    entries.reserve(entry_list.count());
+    for (int i=0; i<entry_list.count(); i++)
+    {
+      SugarRecord entry(schema);
+      const QtSoapType &name_value_list = entry_list[i]["name_value_list"];
+      for (int j=0; j<name_value_list.count(); j++)
+        entry.set(name_value_list[j]["name"].toString(), name_value_list[j]["value"].toString());
+      entries.append(entry);
+    }
+    return entries;
+  }
+}
+
+/*!
+ * \class SugarReply
+ * \brief The SugarReply class holds the state and result of a request queued in SugarSoap.
+ *
+ * Every SugarSoap operation returns a SugarReply straight away. When the
+ * request has been answered, finished() is emitted and the result can be read
+ * from the accessor that matches the operation. The receiver owns the reply
+ * and should delete it with deleteLater(). Dynamic properties can be used to
+ * keep the context needed to resume work when the reply arrives.
+ *
+ * Its priority() decides which requests go first. It depends on the
+ * operation: entries are Interactive, since somebody is waiting for them,
+ * modifications are ChangeReplay, listings since a known modification
+ * time are IncrementalPoll and whole listings are FullResync. Short
+ * requests like logins and module metadata are Interactive as well.
+ */
+
+/*!
+ * Constructs a new reply.
+ * \param[in] operation Operation this reply belongs to.
+ * \param[in] module SugarCRM module the operation works on, if any.
+ * \param[in] parent SugarSoap object that processes the request.
+ */
+SugarReply::SugarReply(Operation operation, const QString &module, QObject *parent)
+  : QObject(parent), op(operation), prio(Interactive), lane(-1), mod(module), done(false), implicit(false), fullEntries(false), streamed(false), offset(0), lastPage(false), retried(false)
+{
+  if (op == EditEntry)
+    prio = ChangeReplay;
+  else if (op == GetEntries)
+    prio = FullResync;
+}
+
+/*!
+ * \return Operation this reply belongs to.
+ */
+SugarReply::Operation SugarReply::operation() const
+{
+  return op;
+}
+
+/*!
+ * \return Scheduling class of the request.
+ */
+SugarReply::Priority SugarReply::priority() const
+{
+  return prio;
+}
+
+/*!
+ * \return SugarCRM module the operation works on, or an empty string.
+ */
+QString SugarReply::module() const
+{
+  return mod;
+}
+
+/*!
+ * \return true once the request has been answered or has failed.
+ */
+bool SugarReply::isFinished() const
+{
+  return done;
+}
+
+/*!
+ * \return true if the request failed.
+ */
+bool SugarReply::hasError() const
+{
+  return !error.isNull();
+}
+
+/*!
+ * \return Human readable description of the error, if any.
+ */
+QString SugarReply::errorString() const
+{
+  return error;
+}
+
+/*!
+ * \return Session identifier received after a login request.
+ */
+QString SugarReply::sessionId() const
+{
+  return session;
+}
+
+/*!
+ * \return Version of SugarCRM, after a getServerVersion() request.
+ */
+QString SugarReply::version() const
+{
+  return serverVersion;
+}
+
+/*!
+ * \return Current UTC time at SugarCRM, after a getServerTime() request.
+ */
+QDateTime SugarReply::time() const
+{
+  return serverTime;
+}
+
+/*!
+ * \return Modules supported by SugarCrmResource that are available at SugarCRM.
+ */
+QStringList SugarReply::modules() const
+{
+  return modulesList;
+}
+
+/*!
+ * \return Fields the module has at SugarCRM, after a getModuleFields() request.
+ */
+QStringList SugarReply::fields() const
+{
+  return fieldsList;
+}
+
+/*!
+ * \return Entries received after a getEntries() request, or the ones of
+ * the current page while a getEntryPages() reply emits pageReceived().
+ */
+QVector<SugarRecord> SugarReply::entries() const
+{
+  return entriesList;
+}
+
+/*!
+ * \return Key->value pairs of the entry received after a getEntry() request.
+ */
+SugarRecord SugarReply::entry() const
+{
+  return record;
+}
+
+/*!
+ * \return Identifier of the entry requested, modified or created.
+ */
+QString SugarReply::id() const
+{
+  return entryId;
+}
+
+/*!
+ * Marks the request as failed.
+ * \param[in] error Human readable description of the error.
+ */
+void SugarReply::setError(const QString &error)
+{
+  this->error = error;
+}
+
+/*!
+ * \class SugarSoap
+ * \brief The SugarSoap class handles requests by SugarCrmResource to SugarCRM SOAP API.
+ *
+ * Requests are queued by SugarReply::priority() and sent without blocking
+ * the caller, logging in first whenever there is no session yet. One
+ * connection is reserved for interactive requests, so they never wait
+ * behind background traffic, and the rest take the most urgent request of
+ * any kind. There is one of those unless setBackgroundConnections() says
+ * otherwise. Listings make way for more urgent requests between pages and
+ * go on from the same offset afterwards.
+ */
+
+/*!
+ * Constructs a new SugarSoap object.
+ * \param[in] strurl SugarCRM SOAP API URL.
+ * \param[in] sid    ID of the session to be reused.
+ * \param[in] parent Parent object.
+ */
+SugarSoap::SugarSoap(QString strurl, QString sid, QObject *parent)
+  : QObject(parent), dispatch_scheduled(false)
+{
+  // Shouldn't this be done by QUrl::fromUserInput()?
+  // QUrl::host() will fail if you don't filter extra slashes in URL scheme
+  if (strurl.startsWith("http://"))
+    strurl.replace(QRegExp("^http:/{2,}", Qt::CaseInsensitive), "http://");
+  else if (strurl.startsWith("https://"))
+    strurl.replace(QRegExp("^https:/{2,}", Qt::CaseInsensitive), "https://");
+
+  session_id = sid;
+
+  url = QUrl::fromUserInput(strurl);
+  addLane();
+  addLane();
+}
+
+/*!
+ * Opens one more connection to SugarCRM.
+ */
+void SugarSoap::addLane()
+{
+  connection lane;
+  lane.http = new QtSoapHttpTransport(this);
+  lane.current = NULL;
+  lane.http->setHost(url.host(),
+                     url.toString().startsWith("https://")? true : false,
+                     url.toString().startsWith("https://")? url.port(443) : url.port(80));
+  lane.http->setAction(url.toString());
+
+  /*
+   * Connects responseReady() event in QtSoapHttpTransport to
+   * responseReceived() method in this
+   */
+  connect(lane.http, SIGNAL(responseReady()), this, SLOT(responseReceived()));
+  lanes.append(lane);
+}
+
+/*!
+ * \return Sort order of the entries returned by getEntries() and
+ * getEntryPages(). Entries modified at the same time are sorted by id, so
+ * offsets among them are stable between requests.
+ */
+QString SugarSoap::entriesOrder()
+{
+  return "date_modified ASC, id ASC";
+}
+
+/*!
+ * \return Identifier of the current session or an empty string if not logged in.
+ */
+QString SugarSoap::sessionId() const
+{
+  return session_id;
+}
+
+/*!
+ * Performs a login action with existing SugarSoap object.
+ * \param[in] user Login user name.
+ * \param[in] pass Login password.
+ * \return Reply whose sessionId() is the session identifier if login was successful.
+ */
+SugarReply *SugarSoap::login(const QString &user, const QString &pass)
+{
+  SugarReply *reply = new SugarReply(SugarReply::Login, QString(), this);
+  reply->user = user;
+  reply->pass = pass;
+  return enqueue(reply);
+}
+
+/*!
+ * Queries the version of SugarCRM. It does not require a session, so it
+ * is a cheap way to know whether the server changed.
+ * \return Reply whose version() is the version of SugarCRM.
+ */
+SugarReply *SugarSoap::getServerVersion()
+{
+  return enqueue(new SugarReply(SugarReply::GetServerVersion, QString(), this));
+}
+
+/*!
+ * Queries the current UTC time at SugarCRM, which does not require a session either.
+ * \return Reply whose time() is the time at SugarCRM.
+ */
+SugarReply *SugarSoap::getServerTime()
+{
+  return enqueue(new SugarReply(SugarReply::GetServerTime, QString(), this));
+}
+
+/*!
+ * Queries the list of available modules from SugarCRM.
+ * \return Reply whose modules() are the ones supported by SugarCrmResource that are also available at SugarCRM.
+ */
+SugarReply *SugarSoap::getModules()
+{
+  return enqueue(new SugarReply(SugarReply::GetModules, QString(), this));
+}
+
+/*!
+ * Queries the fields a module has at SugarCRM.
+ * \param[in] module Module whose fields are requested.
+ * \return Reply whose fields() are the names of the fields of \a module.
+ */
+SugarReply *SugarSoap::getModuleFields(const QString &module)
+{
+  return enqueue(new SugarReply(SugarReply::GetModuleFields, module, this));
+}
+
+/*!
+ * Requests list of ids from entries that belong to a module.
+ * \param[in] module Module you want to get data from.
+ * \param[in] last_modified Modification time of the last entry seen, as received from SugarCRM,
+ * or an empty string to get all entries. Entries deleted since then are returned too.
+ * \param[in] last_id Identifier of the last entry seen. If empty, every entry modified
+ * at \a last_modified is returned again.
+ * \param[in] full_entries Whether to get every field the module requires too, instead of ids and timestamps only.
+ * \param[in] query SQL condition entries must match, if any. It is combined with the \a last_modified condition.
+ * \return Reply whose entries() are the entries received, in entriesOrder().
+ */
+SugarReply *SugarSoap::getEntries(const QString &module, const QString &last_modified, const QString &last_id, bool full_entries, const QString &query)
+{
+  SugarReply *reply = new SugarReply(SugarReply::GetEntries, module, this);
+  reply->lastModified = last_modified;
+  reply->lastId = last_id;
+  reply->fullEntries = full_entries;
+  reply->query = query;
+  if (!last_modified.isEmpty())
+    reply->prio = SugarReply::IncrementalPoll;
+  return enqueue(reply);
+}
+
+/*!
+ * Requests the ids and timestamps of the entries of a module, delivering
+ * them one page at a time instead of all at once.
+ * \param[in] module Module you want to get data from.
+ * \param[in] query SQL condition entries must match, if any.
+ * \param[in] full_entries Whether to get every selected field or just ids and timestamps.
+ * \return Reply that emits pageReceived() for every page, whose entries()
+ * are the ones of that page only.
+ */
+SugarReply *SugarSoap::getEntryPages(const QString &module, const QString &query, bool full_entries)
+{
+  SugarReply *reply = new SugarReply(SugarReply::GetEntries, module, this);
+  reply->query = query;
+  reply->fullEntries = full_entries;
+  reply->streamed = true;
+  return enqueue(reply);
+}
+
+/*!
+ * Requests an item from a SugarCRM module.
+ * \param[in] module Module that entry belongs to.
+ * \param[in] id Identifier of the entry that is being requested.
+ * \param[in] priority Scheduling class of the request. Entries are
+ * interactive unless they are part of replaying a change.
+ * \return Reply whose entry() contains the entry attributes.
+ */
+SugarReply *SugarSoap::getEntry(const QString &module, const QString &id, SugarReply::Priority priority)
+{
+  SugarReply *reply = new SugarReply(SugarReply::GetEntry, module, this);
+  reply->entryId = id;
+  reply->prio = priority;
+  return enqueue(reply);
+}
+
+/*!
+ * Updates a SugarCRM entry with new data or creates it if <code>id</code> is empty.
+ * \param[in] module Module that entry belongs to.
+ * \param[in] entry Record with the SugarCRM entry attributes to set.
+ * \param[in] id Identifier of the entry that is going to be modified. If empty, a new entry is created.
+ * \return Reply whose id() is the identifier of the modified or created entry.
+ */
+SugarReply *SugarSoap::editEntry(const QString &module, const SugarRecord &entry, const QString &id)
+{
+  SugarReply *reply = new SugarReply(SugarReply::EditEntry, module, this);
+  reply->record = entry;
+  reply->entryId = id;
+  return enqueue(reply);
+}
+
+/*!
+ * \param[in] module Module whose fields are requested.
+ * \return Fields requested for entries of \a module, which are all the ones
+ * it requires unless setFields() narrowed them.
+ */
+QStringList SugarSoap::fields(const QString &module) const
+{
+  if (projections.contains(module))
+    return projections.value(module);
+  return SugarCrmResource::Modules.value(module).fields;
+}
+
+/*!
+ * Narrows the fields requested for entries of a module. Modifications
+ * of existing entries leave the fields that are not requested untouched,
+ * since their values were never received.
+ * \param[in] module Module whose fields are set.
+ * \param[in] fields Fields to request, the common ones are always requested.
+ * An empty list requests every field the module requires again.
+ */
+void SugarSoap::setFields(const QString &module, const QStringList &fields)
+{
+  if (fields.isEmpty())
+    projections.remove(module);
+  else
+  {
+    QStringList projection;
+    const QStringList &required = SugarCrmResource::Modules.value(module).fields;
+    for (int i=0; i<required.count(); i++)
+      if ((i < SugarSchema::FirstModuleField) || (fields.contains(required.at(i))))
+        projection << required.at(i);
+    projections.insert(module, projection);
+  }
+
+  // Cached requests still carry the previous fields
+  templates.remove("get_entry_list@" + module);
+  templates.remove("get_entry_list@" + module + "+full");
+  templates.remove("get_entry@" + module);
+}
+
+/*!
+ * \param[in] module Module whose entries are listed.
+ * \param[in] full_entries Whether the listing gets every field or ids and timestamps only.
+ * \return Maximum number of entries requested in every page of a listing.
+ * It starts at Settings::pageSizeMin() and adapts to the time pages take.
+ */
+int SugarSoap::pageSize(const QString &module, bool full_entries) const
+{
+  int size = page_sizes.value(module + (full_entries? "+full" : ""), Settings::self()->pageSizeMin());
+  return qBound((int)Settings::self()->pageSizeMin(), size, (int)qMax(Settings::self()->pageSizeMin(), Settings::self()->pageSizeMax()));
+}
+
+/*!
+ * Sets the number of entries requested in every page of a listing, as
+ * remembered from a previous run. It keeps adapting from there.
+ * \param[in] module Module whose entries are listed.
+ * \param[in] full_entries Whether the listing gets every field or ids and timestamps only.
+ * \param[in] size Maximum number of entries in every page.
+ */
+void SugarSoap::setPageSize(const QString &module, bool full_entries, int size)
+{
+  page_sizes.insert(module + (full_entries? "+full" : ""), size);
+}
+
+/*!
+ * Sets how many requests that are not interactive may be in flight at
+ * the same time, each on its own connection. Connections in use are kept
+ * until their request is done.
+ * \param[in] count Number of connections, at least one.
+ */
+void SugarSoap::setBackgroundConnections(int count)
+{
+  count = qMax(count, 1) + GeneralLane;
+  while (lanes.count() < count)
+    addLane();
+  while ((lanes.count() > count) && (lanes.last().current == NULL))
+    delete lanes.takeLast().http;
+  scheduleDispatch();
+}
+
+/*!
+ * Fails every request that has not finished yet, queued or in flight,
+ * so whoever issued them can go on. Responses still on their way are
+ * ignored.
+ * \param[in] error Human readable description of the error.
+ */
+void SugarSoap::abort(const QString &error)
+{
+  for (int lane=0; lane<lanes.count(); lane++)
+    lanes[lane].current = NULL;
+  for (int priority=SugarReply::Interactive; priority<=SugarReply::FullResync; priority++)
+    queues[priority].clear();
+
+  // Listings whose last pages are still being extracted are neither
+  // queued nor in flight, but they are not finished either
+  foreach (SugarReply *reply, findChildren<SugarReply*>())
+  {
+    if (reply->done)
+      continue;
+    reply->setError(error);
+    finish(reply);
+  }
+}
+
+/*!
+ * Appends a request to the queue of its priority.
+ * \param[in] reply Reply of the request.
+ * \return The same reply.
+ */
+SugarReply *SugarSoap::enqueue(SugarReply *reply)
+{
+  queues[reply->prio].enqueue(reply);
+  scheduleDispatch();
+  return reply;
+}
+
+/*!
+ * Makes dispatch() run once control returns to the event loop, so
+ * replies are never finished before the caller could connect to them.
+ */
+void SugarSoap::scheduleDispatch()
+{
+  if (dispatch_scheduled)
+    return;
+  dispatch_scheduled = true;
+  QMetaObject::invokeMethod(this, "dispatch", Qt::QueuedConnection);
+}
+
+/*!
+ * Sends the most urgent queued requests on the connections that are free.
+ */
+void SugarSoap::dispatch()
+{
+  dispatch_scheduled = false;
+  for (int lane=0; lane<lanes.count(); lane++)
+  {
+    while (lanes[lane].current == NULL)
+    {
+      // Background requests never take the interactive connection
+      int last = (lane == InteractiveLane)? SugarReply::Interactive : SugarReply::FullResync;
+      int priority = SugarReply::Interactive;
+      while ((priority <= last) && (queues[priority].isEmpty()))
+        priority++;
+      if (priority > last)
+        break;
+
+      SugarReply *reply = queues[priority].head();
+      // Check that the request module is one of the ones we allow
+      if ((reply->op != SugarReply::Login) && (reply->op != SugarReply::GetServerVersion) &&
+          (reply->op != SugarReply::GetServerTime) && (reply->op != SugarReply::GetModules) &&
+          (!SugarCrmResource::Modules.contains(reply->mod)))
+      {
+        qDebug("Invalid module requested");
+        queues[priority].dequeue();
+        reply->setError("Invalid module requested");
+        complete(reply);
+        continue;
+      }
+
+      // Log in first if there is no session yet, only once for both connections
+      if ((reply->op != SugarReply::Login) && (reply->op != SugarReply::GetServerVersion) &&
+          (reply->op != SugarReply::GetServerTime) && (session_id.isEmpty()))
+      {
+        if (loggingIn())
+          break;
+        reply = new SugarReply(SugarReply::Login, QString(), this);
+        reply->implicit = true;
+        reply->user = Settings::self()->username();
+        reply->pass = Settings::self()->password();
+        queues[priority].prepend(reply);
+      }
+
+      start(lane, queues[priority].dequeue());
+    }
+  }
+}
+
+/*!
+ * Sends a request on a connection.
+ * \param[in] lane Connection the request is sent on.
+ * \param[in] reply Reply of the request.
+ */
+void SugarSoap::start(int lane, SugarReply *reply)
+{
+  lanes[lane].current = reply;
+  reply->lane = lane;
+  switch (reply->op)
+  {
+    case SugarReply::Login:
+      requestLogin(reply);
+      break;
+    case SugarReply::GetServerVersion:
+      requestServerVersion(reply);
+      break;
+    case SugarReply::GetServerTime:
+      requestServerTime(reply);
+      break;
+    case SugarReply::GetModules:
+      requestModules(reply);
+      break;
+    case SugarReply::GetModuleFields:
+      requestModuleFields(reply);
+      break;
+    case SugarReply::GetEntries:
+      requestEntries(reply);
+      break;
+    case SugarReply::GetEntry:
+      requestEntry(reply);
+      break;
+    case SugarReply::EditEntry:
+      requestEdit(reply);
+      break;
+  }
+}
+
+/*!
+ * \return true if a login is in flight on any connection.
+ */
+bool SugarSoap::loggingIn() const
+{
+  for (int lane=0; lane<lanes.count(); lane++)
+    if ((lanes[lane].current != NULL) && (lanes[lane].current->op == SugarReply::Login))
+      return true;
+  return false;
+}
+
+/*!
+ * \param[in] reply Reply of a listing between two pages.
+ * \return true if a more urgent request is waiting for the connection of the listing.
+ */
+bool SugarSoap::preempted(SugarReply *reply) const
+{
+  for (int priority=SugarReply::Interactive; priority<reply->prio; priority++)
+  {
+    if (queues[priority].isEmpty())
+      continue;
+    // It does not have to wait if another connection that takes it is free
+    bool waiting = true;
+    for (int lane=(priority == SugarReply::Interactive)? InteractiveLane : GeneralLane; lane<lanes.count(); lane++)
+      if (lanes[lane].current == NULL)
+        waiting = false;
+    if (waiting)
+      return true;
+  }
+  return false;
+}
+
+/*!
+ * Finishes a request and moves on to the next one.
+ * \param[in] reply Reply of the request.
+ */
+void SugarSoap::complete(SugarReply *reply)
+{
+  for (int lane=0; lane<lanes.count(); lane++)
+    if (lanes[lane].current == reply)
+      lanes[lane].current = NULL;
+
+  // Nothing else can go on if we couldn't log in on our own
+  if ((reply->implicit) && (reply->hasError()))
+  {
+    for (int priority=SugarReply::Interactive; priority<=SugarReply::FullResync; priority++)
+    {
+      while (!queues[priority].isEmpty())
+      {
+        SugarReply *pending = queues[priority].dequeue();
+        pending->setError(reply->errorString());
+        pending->done = true;
+        emit pending->finished(pending);
+      }
+    }
+  }
+
+  finish(reply);
+  scheduleDispatch();
+}
+
+/*!
+ * Marks a request as finished and tells whoever issued it.
+ * \param[in] reply Reply of the request.
+ */
+void SugarSoap::finish(SugarReply *reply)
+{
+  reply->done = true;
+  if (reply->implicit)
+    reply->deleteLater();
+  else
+    emit reply->finished(reply);
+}
+
+/*!
+ * Sends a request to SugarCRM on the connection it was started on.
+ * \param[in] reply Reply of the request.
+ * \param[in] request Serialized SOAP message.
+ */
+void SugarSoap::submit(SugarReply *reply, const QByteArray &request)
+{
+  lanes[reply->lane].session = session_id;
+  lanes[reply->lane].time.start();
+  lanes[reply->lane].http->submitRequest(request, url.path() == ""? "/" : url.path());
+}
+
+/*!
+ * Handles server response to the request in flight on a connection.
+ */
+void SugarSoap::responseReceived()
+{
+  int lane = 0;
+  while ((lane < lanes.count()) && (lanes[lane].http != sender()))
+    lane++;
+  if ((lane == lanes.count()) || (lanes[lane].current == NULL))
+    return;
+  SugarReply *reply = lanes[lane].current;
+
+  // Get response
+  const QtSoapMessage &message = lanes[lane].http->getResponse();
+
+  // The server drops idle sessions, log in again and retry the request
+  if (sessionExpired(reply, message))
+  {
+    qDebug("Session expired, logging in again");
+    // Another connection may have logged in again already
+    if (lanes[lane].session == session_id)
+      session_id = "";
+    reply->retried = true;
+    lanes[lane].current = NULL;
+    queues[reply->prio].prepend(reply);
+    scheduleDispatch();
+    return;
+  }
 
-/*!
- * \class SugarSoap
- * \brief The SugarSoap class handles requests by SugarCrmResource to SugarCRM SOAP API.
-*/
+  if (!checkResponse(reply, message))
+  {
+    if (reply->op == SugarReply::Login)
+      emit loginFailed();
+    complete(reply);
+    return;
+  }
+  // Listings go on with more pages, which may outlive the session again
+  reply->retried = false;
+
+  // .. then get returned data
+  const QtSoapType &response = message.method()["return"];
+  switch (reply->op)
+  {
+    case SugarReply::Login:
+      loginReady(reply, response);
+      break;
+    case SugarReply::GetServerVersion:
+      serverVersionReady(reply, response);
+      break;
+    case SugarReply::GetServerTime:
+      serverTimeReady(reply, response);
+      break;
+    case SugarReply::GetModules:
+      modulesReady(reply, response);
+      break;
+    case SugarReply::GetModuleFields:
+      moduleFieldsReady(reply, response);
+      break;
+    case SugarReply::GetEntries:
+      entriesReady(reply, response);
+      break;
+    case SugarReply::GetEntry:
+      entryReady(reply, response);
+      break;
+    case SugarReply::EditEntry:
+      editReady(reply, response);
+      break;
+  }
+}
 
 /*!
- * Constructs a new SugarSoap object.
- * \param[in] strurl SugarCRM SOAP API URL.
- * \param[in] sid    ID of the session to be reused.
+ * Checks if a SOAP request was successful and stores the error in its reply otherwise.
+ * \param[in,out] reply Reply of the request.
+ * \param[in] message Response message.
+ * \return true if SugarCRM accepted the request.
  */
-SugarSoap::SugarSoap(QString strurl, QString sid): soap_http(this)
+bool SugarSoap::checkResponse(SugarReply *reply, const QtSoapMessage &message)
 {
-  // Shouldn't this be done by QUrl::fromUserInput()?
-  // QUrl::host() will fail if you don't filter extra slashes in URL scheme
-  if (strurl.startsWith("http://"))
-    strurl.replace(QRegExp("^http:/{2,}", Qt::CaseInsensitive), "http://");
-  else if (strurl.startsWith("https://"))
-    strurl.replace(QRegExp("^https:/{2,}", Qt::CaseInsensitive), "https://");
+  // Check if everything went right..
+  if (message.isFault())
+  {
+    qDebug("Error: %s", message.faultString().value().toString().toLatin1().constData());
+    reply->setError(message.faultString().value().toString());
+    return false;
+  }
 
-  session_id = sid;
+  // Server version and time are returned as is, without an error struct
+  if ((reply->op == SugarReply::GetServerVersion) || (reply->op == SugarReply::GetServerTime))
+    return true;
 
-  url = QUrl::fromUserInput(strurl);
+  const QtSoapType &response = message.method()["return"];
+
+  // Was request rejected with error?
+  if (response["error"]["number"].value().toString() != "0")
+  {
+    qDebug("Request failed");
+    qDebug("%s", response["error"]["name"].value().toString().toLatin1().constData());
+    qDebug("%s", response["error"]["description"].value().toString().toLatin1().constData());
+    reply->setError(response["error"]["name"].value().toString() + ": " + response["error"]["description"].value().toString());
+    return false;
+  }
+  return true;
 }
 
 /*!
- * Performs a login action with existing SugarSoap object.
- * \param[in] user Login user name.
- * \param[in] pass Login password.
- * \return Session identifier if login was successful or empty string otherwise.
+ * \param[in] reply Reply of the request.
+ * \param[in] message Response message.
+ * \return true if SugarCRM rejected the request because its session
+ * expired and it has not been retried in a new one yet.
+ */
+bool SugarSoap::sessionExpired(SugarReply *reply, const QtSoapMessage &message) const
+{
+  if ((reply->retried) || (message.isFault()) ||
+      (reply->op == SugarReply::Login) || (reply->op == SugarReply::GetServerVersion) ||
+      (reply->op == SugarReply::GetServerTime))
+    return false;
+  return message.method()["return"]["error"]["number"].value().toString() == InvalidSessionError;
+}
+
+/*!
+ * Sends a login request.
+ * \param[in] reply Reply holding user name and password.
  */
-QString SugarSoap::login(const QString &user, const QString &pass)
+void SugarSoap::requestLogin(SugarReply *reply)
 {
   session_id = "";
   // Start building a SOAP request
@@ -82,328 +855,386 @@ QString SugarSoap::login(const QString &user, const QString &pass)
 
   // Build user_auth struct
   QtSoapStruct *user_auth = new QtSoapStruct(QtSoapQName("user_auth"));
-  user_auth->insert(new QtSoapSimpleType(QtSoapQName("user_name"), user));
-  user_auth->insert(new QtSoapSimpleType(QtSoapQName("password"), QString(QCryptographicHash::hash(pass.toLatin1(), QCryptographicHash::Md5).toHex())));
+  user_auth->insert(new QtSoapSimpleType(QtSoapQName("user_name"), reply->user));
+  user_auth->insert(new QtSoapSimpleType(QtSoapQName("password"), QString(QCryptographicHash::hash(reply->pass.toLatin1(), QCryptographicHash::Md5).toHex())));
   user_auth->insert(new QtSoapSimpleType(QtSoapQName("version"), "0.1"));
 
   // Add arguments
   soap_request.addMethodArgument(user_auth);
   soap_request.addMethodArgument("application_name", "", "Akonadi");
 
-  /*
-   * Connects responseReady() event in QtSoapHttpTransport to
-   * getLoginResponse() method in this
-   */
   // Finally, send the request
-  soap_http.setHost(url.host(),
-                    url.toString().startsWith("https://")? true : false,
-                    url.toString().startsWith("https://")? url.port(443) : url.port(80));
-  soap_http.setAction(url.toString());
-  QEventLoop loop;
-  connect(&soap_http, SIGNAL(responseReady()), this, SLOT(getLoginResponse()));
-  connect(&soap_http, SIGNAL(responseReady()), &loop, SLOT(quit()));
-  soap_http.submitRequest(soap_request, url.path() == ""? "/" : url.path());
-  loop.exec();
-  disconnect(&soap_http, SIGNAL(responseReady()), &loop, SLOT(quit()));
-  disconnect(&soap_http, SIGNAL(responseReady()), this, SIGNAL(getLoginResponse()));
-  return session_id;
+  submit(reply, soap_request.toXml());
 }
 
 /*!
  * Handles server response after a login request to check if login was successful.
+ * \param[in,out] reply Reply of the login request.
+ * \param[in] response Returned data.
  */
-void SugarSoap::getLoginResponse()
+void SugarSoap::loginReady(SugarReply *reply, const QtSoapType &response)
 {
-  // Get response
-  const QtSoapMessage &message = soap_http.getResponse();
-
-  // Check if everything went right..
-  if (message.isFault())
-  {
-    qDebug("Error: %s", message.faultString().value().toString().toLatin1().constData());
-    emit loginFailed();
-  }
-  else
-  {
-    // .. then get returned data
-    const QtSoapType &response = message.method()["return"];
-
-    // Was request rejected with error?
-    if (response["error"]["number"].value().toString() != "0")
-    {
-      qDebug("Login failed");
-      qDebug("%s", response["error"]["name"].value().toString().toLatin1().constData());
-      qDebug("%s", response["error"]["description"].value().toString().toLatin1().constData());
-      emit loginFailed();
-    }
-    else
-    {
-      qDebug("Login OK");
-      session_id = response["id"].value().toString();
+  qDebug("Login OK");
+  session_id = response["id"].value().toString();
+  reply->session = session_id;
 
-      /*! If login was accepted, say to parent that it can go on by emitting loggedIn() signal */
-      emit loggedIn();
-    }
-  }
+  /*! If login was accepted, say to parent that it can go on by emitting loggedIn() signal */
+  emit loggedIn();
+  complete(reply);
 }
 
 /*!
- * Queries the list of available modules from SugarCRM.
- * \return List of modules supported by SugarCrmResource that are also available at SugarCRM.
+ * Sends a request for the version of SugarCRM.
+ * \param[in] reply Reply of the request.
  */
-QStringList SugarSoap::getModules()
+void SugarSoap::requestServerVersion(SugarReply *reply)
 {
-  QStringList modules;
+  // It has no arguments at all
+  QtSoapMessage soap_request;
+  soap_request.setMethod("get_server_version");
+  submit(reply, soap_request.toXml());
+}
 
-  // TODO move this check to login method
-  // Check if we are logged in
-  if ((session_id.isNull()) || (session_id.isEmpty()))
-  {
-    this->login(Settings::self()->username(), Settings::self()->password());
-    if ((session_id.isEmpty()) || (session_id.isNull())) // login failed
-      return modules;
-  }
+/*!
+ * Stores the version of SugarCRM.
+ * \param[in,out] reply Reply of the request.
+ * \param[in] response Returned data.
+ */
+void SugarSoap::serverVersionReady(SugarReply *reply, const QtSoapType &response)
+{
+  reply->serverVersion = response.value().toString();
+  complete(reply);
+}
 
+/*!
+ * Sends a request for the current UTC time at SugarCRM.
+ * \param[in] reply Reply of the request.
+ */
+void SugarSoap::requestServerTime(SugarReply *reply)
+{
+  // It has no arguments at all
   QtSoapMessage soap_request;
-  soap_request.setMethod("get_available_modules");
-  soap_request.addMethodArgument("session", "", session_id);
-  QEventLoop loop;
-  connect(&soap_http, SIGNAL(responseReady()), &loop, SLOT(quit()));
-  soap_http.setHost(url.host(),
-                    url.toString().startsWith("https://")? true : false,
-                    url.toString().startsWith("https://")? url.port(443) : url.port(80));
-  soap_http.setAction(url.toString());
-  soap_http.submitRequest(soap_request, url.path() == ""? "/" : url.path());
-  loop.exec();
-  disconnect(&soap_http, SIGNAL(responseReady()), &loop, SLOT(quit()));
+  soap_request.setMethod("get_gmt_time");
+  submit(reply, soap_request.toXml());
+}
 
-  // Get response
-  const QtSoapMessage &message = soap_http.getResponse();
+/*!
+ * Stores the current UTC time at SugarCRM.
+ * \param[in,out] reply Reply of the request.
+ * \param[in] response Returned data.
+ */
+void SugarSoap::serverTimeReady(SugarReply *reply, const QtSoapType &response)
+{
+  reply->serverTime = SugarDateTime::toQDateTime(response.value().toString());
+  reply->serverTime.setTimeSpec(Qt::UTC);
+  complete(reply);
+}
 
-  // Check if everything went right..
-  if (message.isFault())
+/*!
+ * Sends a request for the list of available modules.
+ * \param[in] reply Reply of the request.
+ */
+void SugarSoap::requestModules(SugarReply *reply)
+{
+  // Only the session changes between calls
+  if (!templates.contains("get_available_modules"))
   {
-    qDebug("Error: %s", message.faultString().value().toString().toLatin1().constData());
-    return modules;
+    QtSoapMessage soap_request;
+    soap_request.setMethod("get_available_modules");
+    soap_request.addMethodArgument(QtSoapMessageTemplate::placeholder(QtSoapQName("session"), 0));
+    templates.insert("get_available_modules", QtSoapMessageTemplate(soap_request));
   }
-  else
+  submit(reply, templates["get_available_modules"].instantiate(QStringList() << session_id));
+}
+
+/*!
+ * Stores the modules available at SugarCRM that are supported by SugarCrmResource.
+ * \param[in,out] reply Reply of the request.
+ * \param[in] response Returned data.
+ */
+void SugarSoap::modulesReady(SugarReply *reply, const QtSoapType &response)
+{
+  const QtSoapType &modules = response["modules"];
+  for (int i=0; i<modules.count(); i++)
   {
-    // .. then get returned data
-    const QtSoapType &response = message.method()["return"];
+    QString module = modules[i].value().toString();
+    if (SugarCrmResource::Modules.contains(module))
+      reply->modulesList << module;
+  }
+  complete(reply);
+}
 
-    // Was request rejected with error?
-    if (response["error"]["number"].value().toString() != "0")
-    {
-      qDebug("%s", response["error"]["name"].value().toString().toLatin1().constData());
-      qDebug("%s", response["error"]["description"].value().toString().toLatin1().constData());
-      return modules;
-    }
-    else
-    {
-      for (int i=0; i<response["modules"].count(); i++)
-      {
-        if (SugarCrmResource::Modules.keys().contains(response["modules"][i].value().toString()))
-          modules << response["modules"][i].value().toString();
-      }
-    }
-    return modules;
+/*!
+ * Sends a request for the fields of a module.
+ * \param[in] reply Reply of the request.
+ */
+void SugarSoap::requestModuleFields(SugarReply *reply)
+{
+  // Only the session and the module change between calls
+  if (!templates.contains("get_module_fields"))
+  {
+    QtSoapMessage soap_request;
+    soap_request.setMethod("get_module_fields");
+    soap_request.addMethodArgument(QtSoapMessageTemplate::placeholder(QtSoapQName("session"), 0));
+    soap_request.addMethodArgument(QtSoapMessageTemplate::placeholder(QtSoapQName("module_name"), 1));
+    templates.insert("get_module_fields", QtSoapMessageTemplate(soap_request));
   }
+  submit(reply, templates["get_module_fields"].instantiate(QStringList() << session_id << reply->mod));
 }
 
 /*!
- * Requests list of ids from entries that belong to a module.
- * \param[in] module Module you want to get data from.
- * \param[in] last_sync Time of last synchronization or NULL to get all entries.
+ * Stores the names of the fields of a module.
+ * \param[in,out] reply Reply of the request.
+ * \param[in] response Returned data.
+ */
+void SugarSoap::moduleFieldsReady(SugarReply *reply, const QtSoapType &response)
+{
+  const QtSoapType &module_fields = response["module_fields"];
+  for (int i=0; i<module_fields.count(); i++)
+    reply->fieldsList << module_fields[i]["name"].value().toString();
+  complete(reply);
+}
+
+/*!
+ * Sends a request for the next block of entries of a module.
+ * \param[in] reply Reply of the request, holding module, last synchronization time and offset.
  */
-QVector<QMap<QString, QString > >* SugarSoap::getEntries(QString module, QDateTime* last_sync)
+void SugarSoap::requestEntries(SugarReply *reply)
 {
-  QVector<QMap<QString, QString> > entries;
-  // Check that the request module is one of the ones we allow
-  if (!SugarCrmResource::Modules.contains(module))
+  // Build the request
+  QString module = reply->mod;
+
+  // The request only differs in session, query, offset, deleted and page
+  // size between calls, so it is serialized once per module
+  QString key = "get_entry_list@" + module;
+  if (reply->fullEntries)
+    key += "+full";
+  if (!templates.contains(key))
   {
-    qDebug("Invalid module requested");
-    return new QVector<QMap<QString, QString> > (entries);
+    QtSoapMessage soap_request;
+    soap_request.setMethod("get_entry_list");
+
+    /* SOAP method arguments:
+     *   session:       session ID received in login response
+     *   module_name:   module we want to get the data from
+     *   query:         query to include in SQL statement
+     *   order_by:      results sort order
+     *   offset:        results offset
+     *   select_fields: array containing which fields we want to get in
+     *                  response (all by default)
+     *   max_results:   maximum number of results in every response
+     *   deleted:       do we want to get deleted results too?
+     */
+    QtSoapArray *select_fields = new QtSoapArray(QtSoapQName("select_fields"), QtSoapType::String, 1);
+    select_fields->insert(0, new QtSoapSimpleType(QtSoapQName("id"), "id"));
+    select_fields->insert(1, new QtSoapSimpleType(QtSoapQName("date_entered"), "date_entered"));
+    select_fields->insert(2, new QtSoapSimpleType(QtSoapQName("date_modified"), "date_modified"));
+    select_fields->insert(3, new QtSoapSimpleType(QtSoapQName("deleted"), "deleted"));
+    if (reply->fullEntries)
+    {
+      QStringList fields = this->fields(module);
+      foreach (QString field, fields)
+        if ((field != "id") && (field != "date_entered") && (field != "date_modified") && (field != "deleted"))
+          select_fields->append(new QtSoapSimpleType(QtSoapQName(field), field));
+    }
+
+    soap_request.addMethodArgument(QtSoapMessageTemplate::placeholder(QtSoapQName("session"), 0));
+    soap_request.addMethodArgument("module_name", "", QString(module));
+    soap_request.addMethodArgument(QtSoapMessageTemplate::placeholder(QtSoapQName("query"), 1));
+    soap_request.addMethodArgument("order_by", "", entriesOrder());
+    soap_request.addMethodArgument(QtSoapMessageTemplate::placeholder(QtSoapQName("offset"), 2, QtSoapType::Int));
+    soap_request.addMethodArgument(select_fields);
+    soap_request.addMethodArgument(QtSoapMessageTemplate::placeholder(QtSoapQName("max_results"), 4, QtSoapType::Int));
+    soap_request.addMethodArgument(QtSoapMessageTemplate::placeholder(QtSoapQName("deleted"), 3, QtSoapType::Int));
+    templates.insert(key, QtSoapMessageTemplate(soap_request));
   }
 
-  // TODO move this check to login method
-  // Check if we are logged in1
-  if ((session_id.isNull()) || (session_id.isEmpty()))
+  // Both conditions are parenthesized, so neither can break the other
+  QStringList conditions;
+  if (!reply->query.isEmpty())
+    conditions << "(" + reply->query + ")";
+  // Entries come in entriesOrder(), so those after the last one seen are
+  // exactly the ones modified later or at the same time with a greater id
+  if (!reply->lastModified.isEmpty())
   {
-    this->login(Settings::self()->username(), Settings::self()->password());
-    if ((session_id.isEmpty()) || (session_id.isNull())) // login failed
-      return new QVector<QMap<QString, QString> > (entries);
+    QString last_id = reply->lastId;
+    last_id.replace("'", "''");
+    if (last_id.isEmpty())
+      conditions << QString("(date_modified >= '%1')").arg(reply->lastModified);
+    else
+      conditions << QString("(date_modified > '%1' OR (date_modified = '%1' AND id > '%2'))").arg(reply->lastModified, last_id);
   }
 
-  QObject *properties = new QObject(this);
-  properties->setProperty("module", module);
-  properties->setProperty("entries", QVariant::fromValue<QVector<QMap<QString, QString > > >(entries));
-  QEventLoop loop;
-  connect(this, SIGNAL(allEntries()), &loop, SLOT(quit()));
-  this->requestEntries(properties, 0, last_sync);
-  loop.exec();
-  entries = properties->property("entries").value<QVector<QMap<QString, QString > > >();
-  delete properties;
-  return new QVector<QMap<QString, QString> > (entries);
+  QStringList arguments;
+  arguments << session_id;
+  arguments << conditions.join(" AND ");
+  arguments << QString::number(reply->offset);
+  arguments << (reply->lastModified.isEmpty()? "0" : "1");
+  arguments << QString::number(pageSize(module, reply->fullEntries));
+
+  // Finally, send the request
+  submit(reply, templates[key].instantiate(arguments));
 }
 
-void SugarSoap::requestEntries(QObject *properties, unsigned int offset, QDateTime *last_sync)
+/*!
+ * Receives a block of entries returned by <code>get_entry_list</code> SOAP request and requests next block if needed.
+ * \param[in,out] reply Reply of the request where new entries will be appended.
+ * \param[in] response Returned data.
+ */
+void SugarSoap::entriesReady(SugarReply *reply, const QtSoapType &response)
 {
-  // Build the request
-  QString module = properties->property("module").toString();
-  if (last_sync != NULL)
-    properties->setProperty("last_sync", *last_sync);
-  QtSoapMessage soap_request;
-  soap_request.setMethod("get_entry_list");
+  int result_count = response["result_count"].toInt();
+  int next_offset = response["next_offset"].toInt();
+  adaptPageSize(reply, result_count);
 
-  /* SOAP method arguments:
-   *   session:       session ID received in login response
-   *   module_name:   module we want to get the data from
-   *   query:         query to include in SQL statement
-   *   order_by:      results sort order
-   *   offset:        results offset
-   *   select_fields: array containing which fields we want to get in
-   *                  response (all by default)
-   *   max_results:   maximum number of results in every response
-   *   deleted:       do we want to get deleted results too?
-   */
-  QtSoapArray *select_fields = new QtSoapArray(QtSoapQName("select_fields"), QtSoapType::String, 1);
-  select_fields->insert(0, new QtSoapSimpleType(QtSoapQName("id"), "id"));
-  select_fields->insert(1, new QtSoapSimpleType(QtSoapQName("date_entered"), "date_entered"));
-  select_fields->insert(2, new QtSoapSimpleType(QtSoapQName("date_modified"), "date_modified"));
-  select_fields->insert(3, new QtSoapSimpleType(QtSoapQName("deleted"), "deleted"));
+  // Entries are extracted on the thread pool while the next block is
+  // being requested
+  QFutureWatcher<QVector<SugarRecord> > *page = new QFutureWatcher<QVector<SugarRecord> >(reply);
+  connect(page, SIGNAL(finished()), this, SLOT(entriesExtracted()));
+  reply->pages.enqueue(page);
+  page->setFuture(QtConcurrent::run(extractEntries, lanes[reply->lane].http->getResponse(), SugarCrmResource::Modules.value(reply->mod).schema));
 
-  soap_request.addMethodArgument("session", "", session_id);
-  soap_request.addMethodArgument("module_name", "", QString(module));
-  // TODO make this configurable
-  //soap_request.addMethodArgument("query", "", "cases.Status NOT IN ('Closed', 'Rejected', 'Duplicate')");
-  if (last_sync != NULL)
-    soap_request.addMethodArgument("query", "", QString("date_modified > '%1' OR date_entered > '%1'").arg(last_sync->toString(Qt::ISODate)));
-  else
-    soap_request.addMethodArgument("query", "", "");
-  soap_request.addMethodArgument("order_by", "", "date_modified ASC");
-  soap_request.addMethodArgument("offset", "", offset);
-  soap_request.addMethodArgument(select_fields);
-  soap_request.addMethodArgument("max_results", "", "");
-  if (last_sync != NULL)
-    soap_request.addMethodArgument("deleted", "", 1);
+  if (result_count > 0)
+  {
+    reply->offset = next_offset;
+    if (!preempted(reply))
+    {
+      requestEntries(reply);
+      return;
+    }
+    // The listing goes on from the next offset once the more urgent
+    // requests have been sent
+    queues[reply->prio].prepend(reply);
+  }
   else
-    soap_request.addMethodArgument("deleted", "", 0);
+  {
+    // Nothing else to request, but the reply only finishes once every
+    // block has been extracted
+    reply->lastPage = true;
+  }
+  lanes[reply->lane].current = NULL;
+  scheduleDispatch();
+}
 
-  /*
-   * Connects responseReady() event in QtSoapHttpTransport to
-   * getResponse() method in this
-   */
+/*!
+ * Adapts the page size of a listing so that pages take
+ * Settings::pageTargetTime() milliseconds, within the configured bounds.
+ * \param[in] reply Reply of the listing.
+ * \param[in] entries Number of entries of the page just received.
+ */
+void SugarSoap::adaptPageSize(SugarReply *reply, int entries)
+{
+  int size = pageSize(reply->mod, reply->fullEntries);
+  int elapsed = qMax(lanes[reply->lane].time.elapsed(), 1);
+  // Only full pages tell how long a page of that size takes
+  if (entries < size)
+    return;
 
-  connect(&soap_http, SIGNAL(responseReady()), &mapper, SLOT(map()));
-  mapper.setMapping(&soap_http, properties);
-  connect(&mapper, SIGNAL(mapped(QObject*)), this, SLOT(entriesReady(QObject*)));
-  // Finally, send the request
-  soap_http.setHost(url.host(),
-                    url.toString().startsWith("https://")? true : false,
-                    url.toString().startsWith("https://")? url.port(443) : url.port(80));
-  soap_http.setAction(url.toString());
-  soap_http.submitRequest(soap_request, url.path() == ""? "/" : url.path());
+  // Head for the size that would have taken the target time, but never
+  // more than double or half at once, so a single slow page is not enough
+  // to collapse it
+  qint64 next = qint64(size) * Settings::self()->pageTargetTime() / elapsed;
+  next = qBound(qint64(size / 2), next, qint64(size) * 2);
+  next = qBound(qint64(Settings::self()->pageSizeMin()), next, qint64(qMax(Settings::self()->pageSizeMin(), Settings::self()->pageSizeMax())));
+  if (next == size)
+    return;
+  qDebug("%s: %d entries, %lld bytes in %d ms, next pages of %lld entries", reply->mod.toLatin1().constData(), entries, lanes[reply->lane].http->responseSize(), elapsed, next);
+  setPageSize(reply->mod, reply->fullEntries, next);
+  emit pageSizeChanged(reply->mod, reply->fullEntries, next);
 }
 
 /*!
- * Requests an item from a SugarCRM module.
- * \param[in] module Module that entry belongs to.
- * \param[in] id Identifier of the entry that is being requested.
+ * Appends the entries extracted from each block, in the order blocks were
+ * received, and finishes the request after the last one.
  */
-QHash<QString, QString>* SugarSoap::getEntry(QString module, const QString &id)
+void SugarSoap::entriesExtracted()
 {
-  // Check that the request module is one of the ones we allow
-  if (!SugarCrmResource::Modules.contains(module))
+  SugarReply *reply = qobject_cast<SugarReply*>(sender()->parent());
+  // Aborted meanwhile
+  if (reply->done)
+    return;
+  while ((!reply->pages.isEmpty()) && (reply->pages.head()->isFinished()))
   {
-    qDebug("Invalid module requested");
-    return new QHash<QString, QString>();
+    QFutureWatcher<QVector<SugarRecord> > *page = reply->pages.dequeue();
+    if (!reply->streamed)
+      reply->entriesList += page->result();
+    else if ((!reply->hasError()) && (!page->result().isEmpty()))
+    {
+      reply->entriesList = page->result();
+      emit reply->pageReceived(reply);
+    }
+    page->deleteLater();
   }
-
-  // TODO move this check to login method
-  // Check if we are logged in
-  if ((session_id.isNull()) || (session_id.isEmpty()))
+  if ((reply->lastPage) && (reply->pages.isEmpty()))
   {
-    this->login(Settings::self()->username(), Settings::self()->password());
-    if ((session_id.isEmpty()) || (session_id.isNull())) // login failed
-      return new QHash<QString, QString>();
+    if (reply->streamed)
+      reply->entriesList.clear();
+    finish(reply);
   }
+}
 
-  // Build the request
-  QtSoapMessage soap_request;
-  soap_request.setMethod("get_entry");
+/*!
+ * Sends a request for an entry of a module.
+ * \param[in] reply Reply of the request, holding module and entry identifier.
+ */
+void SugarSoap::requestEntry(SugarReply *reply)
+{
+  QString module = reply->mod;
 
-  /* SOAP method arguments:
-   *   session:       session ID received in login response
-   *   module_name:   module we want to get the data from
-   *   query:         query to include in SQL statement
-   *   order_by:      results sort order
-   *   offset:        results offset
-   *   select_fields: array containing which fields we want to get in
-   *                  response (all by default)
-   *   max_results:   maximum number of results in every response
-   *   deleted:       do we want to get deleted results too?
-   */
-  QStringList fields = SugarCrmResource::Modules[module].fields;
-  QtSoapArray *select_fields = new QtSoapArray(QtSoapQName("select_fields"), QtSoapType::String, fields.count());
-  foreach (QString field, fields)
-    select_fields->append(new QtSoapSimpleType(QtSoapQName(field), field));
+  // Build the request, only session and id change between calls
+  QString key = "get_entry@" + module;
+  if (!templates.contains(key))
+  {
+    QtSoapMessage soap_request;
+    soap_request.setMethod("get_entry");
 
-  soap_request.addMethodArgument("session", "", session_id);
-  soap_request.addMethodArgument("module_name", "", QString(module));
-  soap_request.addMethodArgument("id", "", id);
-  soap_request.addMethodArgument(select_fields);
+    /* SOAP method arguments:
+     *   session:       session ID received in login response
+     *   module_name:   module we want to get the data from
+     *   id:            identifier of the entry
+     *   select_fields: array containing which fields we want to get in
+     *                  response (all by default)
+     */
+    QStringList fields = this->fields(module);
+    QtSoapArray *select_fields = new QtSoapArray(QtSoapQName("select_fields"), QtSoapType::String, fields.count());
+    foreach (QString field, fields)
+      select_fields->append(new QtSoapSimpleType(QtSoapQName(field), field));
+
+    soap_request.addMethodArgument(QtSoapMessageTemplate::placeholder(QtSoapQName("session"), 0));
+    soap_request.addMethodArgument("module_name", "", QString(module));
+    soap_request.addMethodArgument(QtSoapMessageTemplate::placeholder(QtSoapQName("id"), 1));
+    soap_request.addMethodArgument(select_fields);
+    templates.insert(key, QtSoapMessageTemplate(soap_request));
+  }
 
-  /*!
-   * Connects responseReady() event in QtSoapHttpTransport to
-   * getResponse() method in <code>this</code>.
-   */
-  QObject *properties = new QObject;
-  properties->setProperty("module", module);
-  connect(&soap_http, SIGNAL(responseReady()), &mapper, SLOT(map()));
-  mapper.setMapping(&soap_http, properties);
-  connect(&mapper, SIGNAL(mapped(QObject*)), this, SLOT(entryReady(QObject*)));
-  QEventLoop loop;
-  connect(&soap_http, SIGNAL(responseReady()), &loop, SLOT(quit()));
   // Finally, send the request
-  soap_http.setHost(url.host(),
-                    url.toString().startsWith("https://")? true : false,
-                    url.toString().startsWith("https://")? url.port(443) : url.port(80));
-  soap_http.setAction(url.toString());
-  soap_http.submitRequest(soap_request, url.path() == ""? "/" : url.path());
-  loop.exec();
-  QHash<QString, QString> *entry;
-  if (properties->property("entry").isValid())
-    entry = new QHash<QString, QString>(properties->property("entry").value<QHash<QString, QString> >());
-  else
-    entry = new QHash<QString, QString>();
-  delete properties;
-  return entry;
+  submit(reply, templates[key].instantiate(QStringList() << session_id << reply->entryId));
 }
 
 /*!
- * Updates a SugarCRM entry with new data or creates it if <code>id</code> is <code>NULL</code>.
- * \param[in] module Module that entry belongs to.
- * \param[in] entry Array of key->value pairs containing SugarCRM entry attributes and their values.
- * \param[in,out] id Identifier of the entry that is going to be modified. If <code>NULL</code>, a new entry is created and its identifier is stored in this parameter.
+ * Receives an entry returned by <code>get_entry</code> SOAP request.
+ * \param[in,out] reply Reply of the request where the key->value pairs containing SugarCRM entry attributes and their values are stored.
+ * \param[in] response Returned data.
  */
-bool SugarSoap::editEntry(QString module, QHash< QString, QString > entry, QString* id)
+void SugarSoap::entryReady(SugarReply *reply, const QtSoapType &response)
 {
-  // Check that the request module is one of the ones we allow
-  if (!SugarCrmResource::Modules.contains(module))
-  {
-    qDebug("Invalid module requested");
-    return false;
-  }
-
-  // TODO move this check to login method
-  // Check if we are logged in
-  if ((session_id.isNull()) || (session_id.isEmpty()))
+  const QtSoapStruct &soapEntry = (const QtSoapStruct&)(response["entry_list"][0]);
+  // Store this entry's data, fields out of the module schema are dropped
+  reply->record = SugarRecord(SugarCrmResource::Modules.value(reply->mod).schema);
+  for (int j=0; j<soapEntry["name_value_list"].count(); j++)
   {
-    this->login(Settings::self()->username(), Settings::self()->password());
-    if ((session_id.isEmpty()) || (session_id.isNull())) // login failed
-      return false;
+    const QtSoapStruct &field = (const QtSoapStruct&)(soapEntry["name_value_list"][j]);
+    reply->record.set(field["name"].value().toString(), field["value"].value().toString());
   }
+  complete(reply);
+}
 
+/*!
+ * Sends a request to update or create an entry.
+ * \param[in] reply Reply of the request, holding module, entry attributes and identifier.
+ */
+void SugarSoap::requestEdit(SugarReply *reply)
+{
   // Build the request
   QtSoapMessage soap_request;
   soap_request.setMethod("set_entry");
@@ -413,191 +1244,50 @@ bool SugarSoap::editEntry(QString module, QHash< QString, QString > entry, QStri
    *   module_name:     module we want to get the data from
    *   name_value_list: array of the fields we are going to change and their values
    */
-  QtSoapArray *name_value_list = new QtSoapArray(QtSoapQName("name_value_list"), QtSoapType::Struct, (entry.count()+1));
+  QtSoapArray *name_value_list = new QtSoapArray(QtSoapQName("name_value_list"), QtSoapType::Struct, (reply->record.count()+1));
   QtSoapStruct *soap_field;
-  if (!id->isEmpty())
+  if (!reply->entryId.isEmpty())
   {
     soap_field = new QtSoapStruct(QtSoapQName("item"));
     soap_field->insert(new QtSoapSimpleType(QtSoapQName("name"), "id"));
-    soap_field->insert(new QtSoapSimpleType(QtSoapQName("value"), (*id)));
+    soap_field->insert(new QtSoapSimpleType(QtSoapQName("value"), reply->entryId));
     name_value_list->append(soap_field);
   }
-  for (QHash<QString, QString>::iterator field = entry.begin(); field != entry.end(); field++)
+  const SugarSchema &schema = reply->record.schema();
+  // Fields that are not requested were never received, so sending them
+  // on modifications would wipe their values at SugarCRM
+  bool projected = (!reply->entryId.isEmpty()) && (projections.contains(reply->mod));
+  QStringList projection = projections.value(reply->mod);
+  for (int field=0; field<reply->record.count(); field++)
   {
+    if (!reply->record.contains(field))
+      continue;
+    if ((projected) && (field >= SugarSchema::FirstModuleField) && (!projection.contains(schema.name(field))))
+      continue;
     soap_field = new QtSoapStruct(QtSoapQName("item"));
-    soap_field->insert(new QtSoapSimpleType(QtSoapQName("name"), field.key()));
-    soap_field->insert(new QtSoapSimpleType(QtSoapQName("value"), field.value()));
+    soap_field->insert(new QtSoapSimpleType(QtSoapQName("name"), schema.name(field)));
+    soap_field->insert(new QtSoapSimpleType(QtSoapQName("value"), reply->record[field]));
     name_value_list->append(soap_field);
   }
 
   soap_request.addMethodArgument("session", "", session_id);
-  soap_request.addMethodArgument("module_name", "", QString(module));
+  soap_request.addMethodArgument("module_name", "", QString(reply->mod));
 
   soap_request.addMethodArgument(name_value_list);
 
-  /*
-   * Connects responseReady() event in QtSoapHttpTransport to
-   * getResponse() method in this
-   */
-  QObject properties(this);
-  properties.setProperty("return_value", false);
-  connect(&soap_http, SIGNAL(responseReady()), &mapper, SLOT(map()));
-  mapper.setMapping(&soap_http, &properties);
-  connect(&mapper, SIGNAL(mapped(QObject*)), this, SLOT(getResponse(QObject*)));
-  QEventLoop loop;
-  connect(&soap_http, SIGNAL(responseReady()), &loop, SLOT(quit()));
   // Finally, send the request
-  soap_http.setHost(url.host(),
-                    url.toString().startsWith("https://")? true : false,
-                    url.toString().startsWith("https://")? url.port(443) : url.port(80));
-  soap_http.setAction(url.toString());
-  soap_http.submitRequest(soap_request, url.path() == ""? "/" : url.path());
-  loop.exec();
-  disconnect(&soap_http, SIGNAL(responseReady()), this, SLOT(getResponse()));
-  disconnect(&soap_http, SIGNAL(responseReady()), &loop, SLOT(quit()));
-
-  if ((properties.property("return_value").toBool()) && (id->isEmpty()))
-    (*id) = soap_http.getResponse().method()["return"]["id"].value().toString();
-  return properties.property("return_value").toBool();
-}
-
-/*!
- * Executed when a SOAP request finishes to check its return value which is stored in <code>return_value</code> attribute of properties parameter.
- * \param[out] properties A pointer to a QObject object where SOAP return value will be stored in a <code>return_value</code> boolean attribute.
- */
-void SugarSoap::getResponse(QObject *properties)
-{
-  // Get response
-  const QtSoapMessage &message = soap_http.getResponse();
-
-  // Check if everything went right..
-  if (message.isFault())
-  {
-    qDebug("Error: %s", message.faultString().value().toString().toLatin1().constData());
-    properties->setProperty("return_value", false);
-  }
-  else
-  {
-    // .. then get returned data
-    const QtSoapType &response = message.method()["return"];
-
-    // Was request rejected with error?
-    if (response["error"]["number"].value().toString() != "0")
-    {
-      qDebug("Request failed");
-      qDebug("%s", response["error"]["name"].value().toString().toLatin1().constData());
-      qDebug("%s", response["error"]["description"].value().toString().toLatin1().constData());
-      properties->setProperty("return_value", false);
-    }
-    else
-    {
-      qDebug("Request OK");
-      properties->setProperty("return_value", true);
-    }
-  }
-}
-
-/*!
- * Receives a block of entries returned by <code>get_entry_list</code> SOAP request and return next block if needed.
- * \param[in,out] properties A pointer to a QObject object containing to properties: a QDateTime object called <code>last_sync</code> representing time of the previous sync before this one (or NULL) and a QVector\<QMap\<QString, QString\>\> object called <code>entires</code> where new entires will be appended.
- */
-void SugarSoap::entriesReady(QObject* properties)
-{
-  QVector<QMap<QString, QString > > entries = properties->property("entries").value<QVector<QMap<QString, QString > > >();
-  QDateTime *last_sync = NULL;
-  if (properties->property("last_sync").isValid())
-    last_sync = new QDateTime(properties->property("last_sync").toDateTime());
-
-  // Get response
-  const QtSoapMessage &message = soap_http.getResponse();
-
-  // TODO: check if session has expired
-
-  // Check if everything went right..
-  if (message.isFault())
-  {
-    qDebug("Error: %s", message.faultString().value().toString().toLatin1().constData());
-    delete last_sync;
-    return;
-  }
-  else
-  {
-    // .. then get returned data
-    const QtSoapType &response = message.method()["return"];
-
-    // Was request rejected with error?
-    if (response["error"]["number"].value().toString() != "0")
-    {
-      qDebug("%s", response["error"]["name"].value().toString().toLatin1().constData());
-      qDebug("%s", response["error"]["description"].value().toString().toLatin1().constData());
-      delete last_sync;
-      return;
-    }
-    else
-    {
-      // Iterate over entries to get their ids
-      for (int i=0; i<response["entry_list"].count(); i++)
-      {
-        QMap<QString, QString> entry;
-        for (int j=0; j<response["entry_list"][i]["name_value_list"].count(); j++)
-          entry[response["entry_list"][i]["name_value_list"][j]["name"].toString()] = response["entry_list"][i]["name_value_list"][j]["value"].toString();
-        entries.append(entry);
-      }
-      properties->setProperty("entries", QVariant::fromValue<QVector<QMap<QString, QString > > >(entries));
-      if (response["result_count"].toInt() > 0)
-        requestEntries(properties, response["next_offset"].toInt(), last_sync);
-      else
-        emit allEntries();
-    }
-  }
-  if (last_sync != NULL)
-    delete last_sync;
+  submit(reply, soap_request.toXml());
 }
 
 /*!
- * Receives an entry returned by <code>get_entry</code> SOAP request.
- * \param[in,out] properties A pointer to a QObject object containing a QString attribute called <code>module</code> whose value is the module this item belongs to. Another QHash\<QString, QString\> attribute called <code>entry</code> is created to store an array of key->value pairs containing SugarCRM entry attributes and their values.
+ * Receives the identifier of the entry updated or created by a <code>set_entry</code> SOAP request.
+ * \param[in,out] reply Reply of the request.
+ * \param[in] response Returned data.
  */
-void SugarSoap::entryReady(QObject* properties)
+void SugarSoap::editReady(SugarReply *reply, const QtSoapType &response)
 {
-  QString module = properties->property("module").toString();
-  // Get response
-  const QtSoapMessage &message = soap_http.getResponse();
-
-  // TODO: check if session has expired
-
-  // Check if everything went right..
-  if (message.isFault())
-  {
-    qDebug("Error: %s", message.faultString().value().toString().toLatin1().constData());
-    return;
-  }
-  else
-  {
-    // .. then get returned data
-    const QtSoapType &response = message.method()["return"];
-
-    // Was request rejected with error?
-    if (response["error"]["number"].value().toString() != "0")
-    {
-      qDebug("%s", response["error"]["name"].value().toString().toLatin1().constData());
-      qDebug("%s", response["error"]["description"].value().toString().toLatin1().constData());
-      return;
-    }
-    else
-    {
-      QHash<QString, QString> entry;
-      // Print returned data
-      QStringList fields = SugarCrmResource::Modules[module].fields;
-      const QtSoapStruct &soapEntry = (const QtSoapStruct&)(response["entry_list"][0]);
-      // Show this entry's data
-      for (int j=0; j<soapEntry["name_value_list"].count(); j++)
-      {
-        const QtSoapStruct &field = (const QtSoapStruct&)(soapEntry["name_value_list"][j]);
-        if (fields.contains(field["name"].value().toString()))
-          entry[field["name"].value().toString()] = field["value"].value().toString();
-      }
-      properties->setProperty("entry", QVariant::fromValue<QHash<QString, QString> >(entry));
-    }
-  }
+  qDebug("Request OK");
+  if (reply->entryId.isEmpty())
+    reply->entryId = response["id"].value().toString();
+  complete(reply);
 }
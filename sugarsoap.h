@@ -21,35 +21,173 @@
 #ifndef SUGARSOAP_H
 #define SUGARSOAP_H
 #include "qtsoap/qtsoap.h"
+#include "sugarrecord.h"
+#include <QQueue>
+#include <QVector>
+#include <QTime>
+#include <QFutureWatcher>
+
+class SugarReply : public QObject
+{
+  Q_OBJECT
+  friend class SugarSoap;
+  public:
+    /*! SugarCRM SOAP operation a reply belongs to. */
+    enum Operation
+    {
+      Login,
+      GetServerVersion,
+      GetServerTime,
+      GetModules,
+      GetModuleFields,
+      GetEntries,
+      GetEntry,
+      EditEntry
+    };
+
+    /*! Scheduling class of a request, from the most to the least urgent. */
+    enum Priority
+    {
+      Interactive,
+      ChangeReplay,
+      IncrementalPoll,
+      FullResync
+    };
+
+    Operation operation() const;
+    Priority priority() const;
+    QString module() const;
+    bool isFinished() const;
+    bool hasError() const;
+    QString errorString() const;
+    QString sessionId() const;
+    QString version() const;
+    QDateTime time() const;
+    QStringList modules() const;
+    QStringList fields() const;
+    QVector<SugarRecord> entries() const;
+    SugarRecord entry() const;
+    QString id() const;
+
+  Q_SIGNALS:
+    void pageReceived(SugarReply *reply);
+    void finished(SugarReply *reply);
+
+  private:
+    SugarReply(Operation operation, const QString &module, QObject *parent);
+    void setError(const QString &error);
+
+    Operation op;
+    Priority prio;
+    int lane;
+    QString mod;
+    bool done;
+    bool implicit;
+    QString error;
+    QString user;
+    QString pass;
+    QString session;
+    QString serverVersion;
+    QDateTime serverTime;
+    QStringList modulesList;
+    QStringList fieldsList;
+    QString lastModified;
+    QString lastId;
+    bool fullEntries;
+    bool streamed;
+    QString query;
+    unsigned int offset;
+    QVector<SugarRecord> entriesList;
+    SugarRecord record;
+    QString entryId;
+    QQueue<QFutureWatcher<QVector<SugarRecord> > *> pages;
+    bool lastPage;
+    bool retried;
+};
 
 class SugarSoap : public QObject
 {
   Q_OBJECT
   public:
-    SugarSoap(QString strurl, QString sid = "");
-    QString login(const QString &user, const QString &pass);
-    QStringList getModules();
-    QVector<QMap<QString, QString> >* getEntries(QString module, QDateTime *last_sync = NULL);
-    QHash<QString, QString>* getEntry(QString module, const QString& id);
-    bool editEntry(QString module, QHash< QString, QString > entry, QString* id);
+    SugarSoap(QString strurl, QString sid = "", QObject *parent = 0);
+    static QString entriesOrder();
+    QString sessionId() const;
+    SugarReply *login(const QString &user, const QString &pass);
+    SugarReply *getServerVersion();
+    SugarReply *getServerTime();
+    SugarReply *getModules();
+    SugarReply *getModuleFields(const QString &module);
+    SugarReply *getEntries(const QString &module, const QString &last_modified = QString(), const QString &last_id = QString(), bool full_entries = false, const QString &query = QString());
+    SugarReply *getEntryPages(const QString &module, const QString &query = QString(), bool full_entries = false);
+    SugarReply *getEntry(const QString &module, const QString &id, SugarReply::Priority priority = SugarReply::Interactive);
+    SugarReply *editEntry(const QString &module, const SugarRecord &entry, const QString &id = QString());
+    QStringList fields(const QString &module) const;
+    void setFields(const QString &module, const QStringList &fields);
+    int pageSize(const QString &module, bool full_entries) const;
+    void setPageSize(const QString &module, bool full_entries, int size);
+    void setBackgroundConnections(int count);
+    void abort(const QString &error);
 
   Q_SIGNALS:
     void loggedIn();
     void loginFailed();
-    void allEntries();
+    void pageSizeChanged(const QString &module, bool full_entries, int size);
 
   private Q_SLOTS:
-    void getLoginResponse();
-    void entriesReady(QObject *properties);
-    void entryReady(QObject *properties);
-    void getResponse(QObject *properties);
+    void dispatch();
+    void responseReceived();
+    void entriesExtracted();
 
   private:
-    void requestEntries(QObject* properties, unsigned int offset, QDateTime* last_sync);
-    QtSoapHttpTransport soap_http;
+    SugarReply *enqueue(SugarReply *reply);
+    void scheduleDispatch();
+    void addLane();
+    void start(int lane, SugarReply *reply);
+    bool loggingIn() const;
+    bool preempted(SugarReply *reply) const;
+    void complete(SugarReply *reply);
+    void finish(SugarReply *reply);
+    void submit(SugarReply *reply, const QByteArray &request);
+    bool checkResponse(SugarReply *reply, const QtSoapMessage &message);
+    bool sessionExpired(SugarReply *reply, const QtSoapMessage &message) const;
+    void requestLogin(SugarReply *reply);
+    void requestServerVersion(SugarReply *reply);
+    void requestServerTime(SugarReply *reply);
+    void requestModules(SugarReply *reply);
+    void requestModuleFields(SugarReply *reply);
+    void requestEntries(SugarReply *reply);
+    void requestEntry(SugarReply *reply);
+    void requestEdit(SugarReply *reply);
+    void loginReady(SugarReply *reply, const QtSoapType &response);
+    void serverVersionReady(SugarReply *reply, const QtSoapType &response);
+    void serverTimeReady(SugarReply *reply, const QtSoapType &response);
+    void modulesReady(SugarReply *reply, const QtSoapType &response);
+    void moduleFieldsReady(SugarReply *reply, const QtSoapType &response);
+    void entriesReady(SugarReply *reply, const QtSoapType &response);
+    void entryReady(SugarReply *reply, const QtSoapType &response);
+    void editReady(SugarReply *reply, const QtSoapType &response);
+    void adaptPageSize(SugarReply *reply, int entries);
+    /*! Connections to SugarCRM, the interactive one is kept for interactive requests. */
+    enum Lane
+    {
+      InteractiveLane,
+      GeneralLane
+    };
+    struct connection
+    {
+      QtSoapHttpTransport *http;
+      SugarReply *current;
+      QString session;
+      QTime time;
+    };
+    QVector<connection> lanes;
     QString session_id;
     QUrl url;
-    QSignalMapper mapper;
+    QHash<QString, QtSoapMessageTemplate> templates;
+    QHash<QString, QStringList> projections;
+    QHash<QString, int> page_sizes;
+    QQueue<SugarReply *> queues[SugarReply::FullResync + 1];
+    bool dispatch_scheduled;
 };
 
 #endif
@@ -0,0 +1,228 @@
+/*
+ * Copyright (c) 2013, 2014 Jesús Pérez (a) Chuso <kde at chuso dot net>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Library General Public License as published
+ * by the Free Software Foundation; either version 2 of the License or
+ * ( at your option ) version 3 or, at the discretion of KDE e.V.
+ * ( which shall act as a proxy as in section 14 of the GPLv3 ), any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "synccheckpointattribute.h"
+#include <QList>
+
+namespace Akonadi
+{
+
+/*!
+ * \class SyncCheckpointAttribute
+ * \brief Akonadi custom attribute storing how far the initial listing of a collection got.
+ *
+ * A listing may be split in partitions, each of them listed on its own.
+ * Entries of a partition are listed in ascending order of their last
+ * modification time and id, so a partition can resume after the last entry
+ * it reached, with the entries modified later or at the same time with a
+ * greater id. The time the listing started is kept too, every entry
+ * modified before it has been listed once all partitions are finished.
+ */
+
+/*!
+ * Constructs a new empty checkpoint.
+ */
+SyncCheckpointAttribute::SyncCheckpointAttribute()
+{
+}
+
+/*!
+ * Constructs a new checkpoint without partitions.
+ * \param[in] module SugarCRM module being listed.
+ * \param[in] orderBy Sort order of the listing.
+ */
+SyncCheckpointAttribute::SyncCheckpointAttribute(const QString &module, const QString &orderBy)
+  : mod(module), order(orderBy)
+{
+}
+
+/*!
+ * \return A QByteArray representation of the attribute.
+ */
+QByteArray SyncCheckpointAttribute::type() const
+{
+  return "SYNCCHECKPOINT";
+}
+
+/*!
+ * \return A new SyncCheckpointAttribute with the same value as the current one.
+ */
+SyncCheckpointAttribute * SyncCheckpointAttribute::clone() const
+{
+  SyncCheckpointAttribute *checkpoint = new SyncCheckpointAttribute(mod, order);
+  checkpoint->start = start;
+  checkpoint->positions = positions;
+  return checkpoint;
+}
+
+/*!
+ * \return A serialized representation of the attribute value: module, then
+ * sort order and start time separated by a tab, then a line per partition
+ * with its members separated by tabs.
+ */
+QByteArray SyncCheckpointAttribute::serialized() const
+{
+  QByteArray s = mod.toUtf8() + '\n' + order.toUtf8() + '\t' + start.toUtf8();
+  for (QMap<QString, Position>::const_iterator position = positions.constBegin(); position != positions.constEnd(); position++)
+  {
+    s += '\n' + position.key().toUtf8() + '\t' + position.value().modified.toUtf8() + '\t' + position.value().id.toUtf8() +
+         '\t' + (position.value().finished? '1' : '0');
+  }
+  return s;
+}
+
+/*!
+ * Changes stored value to the one passed as parameter.
+ * \param[in] s A serialized representation of a value as returned by SyncCheckpointAttribute::serialized().
+ */
+void SyncCheckpointAttribute::deserialize(const QByteArray &s)
+{
+  mod.clear();
+  order.clear();
+  start.clear();
+  positions.clear();
+
+  QList<QByteArray> lines = s.split('\n');
+  if (lines.count() < 2)
+    return;
+  for (int i=2; i<lines.count(); i++)
+  {
+    QList<QByteArray> members = lines[i].split('\t');
+    if (members.count() != 4)
+    {
+      positions.clear();
+      return;
+    }
+    Position position;
+    position.modified = QString::fromUtf8(members[1]);
+    position.id = QString::fromUtf8(members[2]);
+    position.finished = (members[3] == "1");
+    positions.insert(QString::fromUtf8(members[0]), position);
+  }
+  QList<QByteArray> header = lines[1].split('\t');
+  mod = QString::fromUtf8(lines[0]);
+  order = QString::fromUtf8(header[0]);
+  if (header.count() > 1)
+    start = QString::fromUtf8(header[1]);
+}
+
+/*!
+ * \return SugarCRM module being listed.
+ */
+QString SyncCheckpointAttribute::module() const
+{
+  return mod;
+}
+
+/*!
+ * \return Sort order of the listing, the checkpoint is only valid for the same one.
+ */
+QString SyncCheckpointAttribute::orderBy() const
+{
+  return order;
+}
+
+/*!
+ * \return Time at SugarCRM when the listing started, as SugarCRM stores it.
+ */
+QString SyncCheckpointAttribute::started() const
+{
+  return start;
+}
+
+/*!
+ * Records when the listing started, before any partition was listed.
+ * \param[in] started Time at SugarCRM, as SugarCRM stores it.
+ */
+void SyncCheckpointAttribute::setStarted(const QString &started)
+{
+  start = started;
+}
+
+/*!
+ * \return Partitions that have a position, sorted.
+ */
+QStringList SyncCheckpointAttribute::partitions() const
+{
+  return positions.keys();
+}
+
+/*!
+ * \param[in] partition Partition of the listing.
+ * \return Whether \a partition has a position.
+ */
+bool SyncCheckpointAttribute::contains(const QString &partition) const
+{
+  return positions.contains(partition);
+}
+
+/*!
+ * \param[in] partition Partition of the listing.
+ * \return Modification time of the last entry listed in \a partition, as received from SugarCRM.
+ */
+QString SyncCheckpointAttribute::lastModified(const QString &partition) const
+{
+  return positions.value(partition).modified;
+}
+
+/*!
+ * \param[in] partition Partition of the listing.
+ * \return Identifier of the last entry listed in \a partition.
+ */
+QString SyncCheckpointAttribute::lastId(const QString &partition) const
+{
+  return positions.value(partition).id;
+}
+
+/*!
+ * \param[in] partition Partition of the listing.
+ * \return Whether every entry of \a partition has been listed.
+ */
+bool SyncCheckpointAttribute::isFinished(const QString &partition) const
+{
+  return positions.contains(partition) && positions[partition].finished;
+}
+
+/*!
+ * Records how far the listing of a partition got.
+ * \param[in] partition Partition of the listing.
+ * \param[in] lastModified Modification time of the last entry listed, as received from SugarCRM.
+ * \param[in] lastId Identifier of the last entry listed.
+ */
+void SyncCheckpointAttribute::setPosition(const QString &partition, const QString &lastModified, const QString &lastId)
+{
+  Position &position = positions[partition];
+  position.modified = lastModified;
+  position.id = lastId;
+  position.finished = false;
+}
+
+/*!
+ * Records that every entry of a partition has been listed.
+ * \param[in] partition Partition of the listing.
+ */
+void SyncCheckpointAttribute::setFinished(const QString &partition)
+{
+  if (!positions.contains(partition))
+    setPosition(partition, QString(), QString());
+  positions[partition].finished = true;
+}
+
+}
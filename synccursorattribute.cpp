@@ -0,0 +1,246 @@
+/*
+ * Copyright (c) 2013, 2014 Jesús Pérez (a) Chuso <kde at chuso dot net>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Library General Public License as published
+ * by the Free Software Foundation; either version 2 of the License or
+ * ( at your option ) version 3 or, at the discretion of KDE e.V.
+ * ( which shall act as a proxy as in section 14 of the GPLv3 ), any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "synccursorattribute.h"
+#include <QDataStream>
+#include <QDateTime>
+
+namespace Akonadi
+{
+
+namespace
+{
+  /* SugarCRM database timestamps, which are always UTC */
+  const char *timestampFormat = "yyyy-MM-dd hh:mm:ss";
+
+  /* Kinds of entry id, most of them are UUIDs that fit in 16 bytes */
+  enum IdKind
+  {
+    NoId,
+    UuidId,
+    TextId
+  };
+
+  QByteArray packUuid(const QString &id)
+  {
+    if ((id.length() != 36) || (id[8] != '-') || (id[13] != '-') || (id[18] != '-') || (id[23] != '-'))
+      return QByteArray();
+    QByteArray hex = id.toLatin1();
+    hex.remove(23, 1).remove(18, 1).remove(13, 1).remove(8, 1);
+    QByteArray packed = QByteArray::fromHex(hex);
+    // fromHex() skips invalid digits, so only a round trip proves it is a UUID
+    if ((packed.size() != 16) || (packed.toHex() != hex.toLower()) || (hex != hex.toLower()))
+      return QByteArray();
+    return packed;
+  }
+
+  QString unpackUuid(const QByteArray &packed)
+  {
+    QString hex = QString::fromLatin1(packed.toHex());
+    return hex.mid(0, 8) + '-' + hex.mid(8, 4) + '-' + hex.mid(12, 4) + '-' + hex.mid(16, 4) + '-' + hex.mid(20);
+  }
+}
+
+/*!
+ * \class SyncCursorAttribute
+ * \brief Akonadi custom attribute storing the position of the last synchronization of a collection.
+ *
+ * Entries are synchronized in ascending order of last modification time
+ * and id, so the last entry seen tells exactly which ones are still
+ * unseen, even if several share the same second. The server clock offset
+ * and a hash of the fields requested are kept along with it.
+ *
+ * The attribute is serialized as a versioned binary record: version, last
+ * modification time in seconds since the epoch, clock offset, schema hash
+ * and the last id, packed in 16 bytes if it is a UUID.
+ */
+
+/*!
+ * Constructs a new null cursor, that of a collection never synchronized.
+ */
+SyncCursorAttribute::SyncCursorAttribute(): modified(0), offset(0), hash(0)
+{
+}
+
+/*!
+ * Constructs a new cursor.
+ * \param[in] lastModified Modification time of the last entry seen, as received from SugarCRM.
+ * \param[in] lastId Identifier of the last entry seen, empty if unknown.
+ * \param[in] clockOffset Seconds the server clock is ahead of the local one.
+ * \param[in] schemaHash Hash of the fields requested, 0 if unknown.
+ */
+SyncCursorAttribute::SyncCursorAttribute(const QString &lastModified, const QString &lastId, int clockOffset, uint schemaHash)
+  : modified(0), id(lastId), offset(clockOffset), hash(schemaHash)
+{
+  QDateTime time = QDateTime::fromString(lastModified, timestampFormat);
+  if (time.isValid())
+  {
+    time.setTimeSpec(Qt::UTC);
+    modified = time.toTime_t();
+  }
+}
+
+/*!
+ * \return A QByteArray representation of the attribute.
+ */
+QByteArray SyncCursorAttribute::type() const
+{
+  return "SYNCCURSOR";
+}
+
+/*!
+ * \return A new SyncCursorAttribute with the same value as the current one.
+ */
+SyncCursorAttribute * SyncCursorAttribute::clone() const
+{
+  SyncCursorAttribute *cursor = new SyncCursorAttribute();
+  cursor->modified = modified;
+  cursor->id = id;
+  cursor->offset = offset;
+  cursor->hash = hash;
+  return cursor;
+}
+
+/*!
+ * \return A serialized representation of the attribute value.
+ */
+QByteArray SyncCursorAttribute::serialized() const
+{
+  QByteArray data;
+  QDataStream stream(&data, QIODevice::WriteOnly);
+  stream.setVersion(QDataStream::Qt_4_6);
+  stream << quint8(Version) << quint32(modified) << qint32(offset) << quint32(hash);
+
+  QByteArray uuid = packUuid(id);
+  if (id.isEmpty())
+    stream << quint8(NoId);
+  else if (!uuid.isEmpty())
+  {
+    stream << quint8(UuidId);
+    stream.writeRawData(uuid.constData(), uuid.size());
+  }
+  else
+    stream << quint8(TextId) << id.toUtf8();
+  return data;
+}
+
+/*!
+ * Changes stored value to the one passed as parameter. Unknown versions
+ * and damaged data leave a null cursor, so the collection is synchronized again.
+ * \param[in] s A serialized representation of a value as returned by SyncCursorAttribute::serialized().
+ */
+void SyncCursorAttribute::deserialize(const QByteArray &s)
+{
+  modified = 0;
+  id.clear();
+  offset = 0;
+  hash = 0;
+
+  QDataStream stream(s);
+  stream.setVersion(QDataStream::Qt_4_6);
+  quint8 version, kind;
+  quint32 stored_modified, stored_hash;
+  qint32 stored_offset;
+  stream >> version;
+  if ((stream.status() != QDataStream::Ok) || (version != Version))
+    return;
+  stream >> stored_modified >> stored_offset >> stored_hash >> kind;
+
+  QString stored_id;
+  if (kind == UuidId)
+  {
+    QByteArray uuid(16, '\0');
+    if (stream.readRawData(uuid.data(), uuid.size()) != uuid.size())
+      return;
+    stored_id = unpackUuid(uuid);
+  }
+  else if (kind == TextId)
+  {
+    QByteArray text;
+    stream >> text;
+    stored_id = QString::fromUtf8(text);
+  }
+  else if (kind != NoId)
+    return;
+  if (stream.status() != QDataStream::Ok)
+    return;
+
+  modified = stored_modified;
+  id = stored_id;
+  offset = stored_offset;
+  hash = stored_hash;
+}
+
+/*!
+ * \return Whether the cursor has no position, as if the collection was never synchronized.
+ */
+bool SyncCursorAttribute::isNull() const
+{
+  return modified == 0;
+}
+
+/*!
+ * \param[in] modified Modification time of an entry, as received from SugarCRM.
+ * \param[in] id Identifier of the entry.
+ * \return Whether the cursor is positioned before the entry, that is, it is still unseen.
+ */
+bool SyncCursorAttribute::isBefore(const QString &modified, const QString &id) const
+{
+  SyncCursorAttribute entry(modified, id, 0, 0);
+  if (entry.modified != this->modified)
+    return this->modified < entry.modified;
+  return this->id < id;
+}
+
+/*!
+ * \return Modification time of the last entry seen, as SugarCRM stores it, or an empty string if null.
+ */
+QString SyncCursorAttribute::lastModified() const
+{
+  if (isNull())
+    return QString();
+  return QDateTime::fromTime_t(modified).toUTC().toString(timestampFormat);
+}
+
+/*!
+ * \return Identifier of the last entry seen, empty if unknown.
+ */
+QString SyncCursorAttribute::lastId() const
+{
+  return id;
+}
+
+/*!
+ * \return Seconds the server clock was ahead of the local one.
+ */
+int SyncCursorAttribute::clockOffset() const
+{
+  return offset;
+}
+
+/*!
+ * \return Hash of the fields requested when the cursor was stored, 0 if unknown.
+ */
+uint SyncCursorAttribute::schemaHash() const
+{
+  return hash;
+}
+
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2013, 2014 Jesús Pérez (a) Chuso <kde at chuso dot net>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Library General Public License as published
+ * by the Free Software Foundation; either version 2 of the License or
+ * ( at your option ) version 3 or, at the discretion of KDE e.V.
+ * ( which shall act as a proxy as in section 14 of the GPLv3 ), any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef SYNCCURSORATTRIBUTE_H
+#define SYNCCURSORATTRIBUTE_H
+
+#include <QByteArray>
+#include <QString>
+#include <Akonadi/Attribute>
+
+namespace Akonadi
+{
+
+  class AKONADI_EXPORT SyncCursorAttribute : public Attribute
+  {
+    public:
+      SyncCursorAttribute();
+      SyncCursorAttribute(const QString &lastModified, const QString &lastId, int clockOffset, uint schemaHash);
+      QByteArray type() const;
+      SyncCursorAttribute* clone() const;
+      QByteArray serialized() const;
+      void deserialize(const QByteArray &s);
+      bool isNull() const;
+      bool isBefore(const QString &modified, const QString &id) const;
+      QString lastModified() const;
+      QString lastId() const;
+      int clockOffset() const;
+      uint schemaHash() const;
+
+      /*! Version of the layout written by serialized(). */
+      static const quint8 Version = 1;
+
+    private:
+      uint modified;
+      QString id;
+      int offset;
+      uint hash;
+  };
+
+}
+
+#endif